@@ -11,6 +11,8 @@
 #include <string.h>
 #include <stdint.h>
 
+#define LOAD_ADDRESS 0x0800
+
 // Simple 6502/6510 machine code "Hello World" program
 static uint8_t hello_world_program[] = {
     // Initialize
@@ -100,7 +102,7 @@ static uint8_t hello_world_program[] = {
 };
 
 /**
- * Utility function to write the program to a binary file
+ * Utility function to write the program to a PRG file
  */
 int write_program_to_file(const char* filename) {
     FILE* file = fopen(filename, "wb");
@@ -109,11 +111,15 @@ int write_program_to_file(const char* filename) {
         return 0;
     }
     
-    // Write the binary data to the file
-    size_t written = fwrite(hello_world_program, 1, sizeof(hello_world_program), file);
+    // PRG header: the load address, low byte first
+    uint8_t header[2] = { LOAD_ADDRESS & 0xFF, LOAD_ADDRESS >> 8 };
+    
+    // Write the header and the binary data to the file
+    size_t written = fwrite(header, 1, sizeof(header), file);
+    written += fwrite(hello_world_program, 1, sizeof(hello_world_program), file);
     fclose(file);
     
-    if (written != sizeof(hello_world_program)) {
+    if (written != sizeof(header) + sizeof(hello_world_program)) {
         printf("Error: Could not write all data to file\n");
         return 0;
     }
@@ -135,7 +141,7 @@ int main(int argc, char* argv[]) {
     
     if (write_program_to_file(filename)) {
         printf("Demo program created successfully in %s\n", filename);
-        printf("Load this program into the emulator at address $0800 and run it.\n");
+        printf("Load this program into the emulator (it loads at $0800) and run it.\n");
     } else {
         printf("Failed to create demo program.\n");
         return 1;
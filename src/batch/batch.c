@@ -0,0 +1,470 @@
+/**
+ * batch.c
+ * Batch runner for PRG test corpora
+ *
+ * Jobs are dealt out to the workers in contiguous runs, one queue per
+ * worker. A worker takes jobs from the back of its own queue; when that is
+ * empty it steals from the front of another worker's queue, so a worker
+ * stuck with long-running programs doesn't hold up the batch. Jobs are
+ * never added after the start, so a worker that finds every queue empty
+ * is done.
+ *
+ * Each worker owns one Machine and resets it between programs: memory,
+ * CPU and I/O are reinitialised and the ROMs copied from the template.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "batch.h"
+
+#define BATCH_MAX_LINE    1024
+#define BATCH_MAX_WORKERS 256
+#define BATCH_SLICE       100000  // Cycles run between checks of the exit condition
+
+/**
+ * Why a program stopped (also the exit condition asked for in the manifest)
+ */
+typedef enum {
+    BATCH_EXIT_BUDGET,  // Ran the whole budget
+    BATCH_EXIT_IDLE,    // Settled in an idle loop
+    BATCH_EXIT_PC,      // Reached the exit address
+    BATCH_EXIT_ERROR    // Couldn't be loaded
+} BatchExit;
+
+static const char *batch_exit_names[] = { "budget", "idle", "pc", "error" };
+
+/**
+ * A program from the manifest and its result
+ */
+typedef struct {
+    char *file;
+    int load;             // Load address, or -1 to use the one in the file
+    int start;            // Start address, or -1 to start at the load address
+    uint64_t budget;
+    BatchExit exit;       // BATCH_EXIT_BUDGET, _IDLE or _PC
+    uint16_t exit_pc;
+
+    BatchExit reason;
+    uint64_t cycles;
+    CPU cpu;
+    uint8_t status;
+    uint64_t screen_hash;
+} BatchJob;
+
+/**
+ * Jobs dealt to one worker (indices into the job array)
+ * The owner takes from tail, thieves from head.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    int *jobs;
+    int head;
+    int tail;
+} BatchQueue;
+
+/**
+ * State shared by all workers of a batch
+ */
+typedef struct {
+    const Machine *template;
+    BatchJob *jobs;
+    BatchQueue *queues;
+    int worker_count;
+} BatchShared;
+
+/**
+ * One worker thread
+ */
+typedef struct {
+    BatchShared *shared;
+    int index;
+    pthread_t thread;
+    int started;                      // Thread created (workers other than 0)
+    int ran;                          // Programs run
+    int stolen;                       // Of which taken from other workers
+} BatchWorker;
+
+/**
+ * Current time in seconds from a monotonic clock
+ */
+static double batch_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Parse one manifest line into a job
+ * @return 1 on success, 0 if the line is malformed
+ */
+static int batch_parse_line(char *line, BatchJob *job) {
+    char *fields[5];
+    int count = 0;
+    char *end;
+
+    memset(job, 0, sizeof(*job));
+    job->reason = BATCH_EXIT_ERROR;  // Until it has run
+    for (char *token = strtok(line, " \t\r\n"); token && count < 5; token = strtok(NULL, " \t\r\n")) {
+        fields[count++] = token;
+    }
+    if (count < 4) {
+        return 0;
+    }
+
+    job->file = strdup(fields[0]);
+    if (!job->file) {
+        return 0;
+    }
+
+    if (strcmp(fields[1], "-") == 0) {
+        job->load = -1;
+    } else {
+        job->load = (int)strtol(fields[1], &end, 16);
+        if (*end || job->load < 0 || job->load > 0xFFFF) {
+            return 0;
+        }
+    }
+
+    job->budget = strtoull(fields[2], &end, 10);
+    if (*end || job->budget == 0) {
+        return 0;
+    }
+
+    if (strcmp(fields[3], "budget") == 0) {
+        job->exit = BATCH_EXIT_BUDGET;
+    } else if (strcmp(fields[3], "idle") == 0) {
+        job->exit = BATCH_EXIT_IDLE;
+    } else if (strncmp(fields[3], "pc=", 3) == 0) {
+        long address = strtol(fields[3] + 3, &end, 16);
+        if (*end || end == fields[3] + 3 || address < 0 || address > 0xFFFF) {
+            return 0;
+        }
+        job->exit = BATCH_EXIT_PC;
+        job->exit_pc = (uint16_t)address;
+    } else {
+        return 0;
+    }
+
+    job->start = -1;
+    if (count == 5) {
+        job->start = (int)strtol(fields[4], &end, 16);
+        if (*end || job->start < 0 || job->start > 0xFFFF) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Free a job array and the file names in it
+ */
+static void batch_free_jobs(BatchJob *jobs, int count) {
+    for (int i = 0; i < count; i++) {
+        free(jobs[i].file);
+    }
+    free(jobs);
+}
+
+/**
+ * Read every job from a manifest
+ * @return Number of jobs, or -1 on error (reported)
+ */
+static int batch_read_manifest(const char *path, BatchJob **jobs_out) {
+    FILE *file = fopen(path, "r");
+    char line[BATCH_MAX_LINE];
+    BatchJob *jobs = NULL;
+    int count = 0, capacity = 0, line_number = 0, failed = 0;
+
+    if (!file) {
+        printf("Error: Could not open manifest %s\n", path);
+        return -1;
+    }
+
+    while (!failed && fgets(line, sizeof(line), file)) {
+        char *text = line;
+        line_number++;
+        while (*text == ' ' || *text == '\t') {
+            text++;
+        }
+        if (*text == '#' || *text == '\n' || *text == '\r' || *text == '\0') {
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            BatchJob *grown = realloc(jobs, capacity * sizeof(BatchJob));
+            if (!grown) {
+                printf("Error: Could not allocate memory for the manifest\n");
+                failed = 1;
+                break;
+            }
+            jobs = grown;
+        }
+        if (!batch_parse_line(text, &jobs[count])) {
+            printf("Error: %s:%d: expected <file> <load|-> <budget> <budget|idle|pc=addr> [start]\n",
+                   path, line_number);
+            free(jobs[count].file);
+            failed = 1;
+            break;
+        }
+        count++;
+    }
+    fclose(file);
+
+    if (failed) {
+        batch_free_jobs(jobs, count);
+        return -1;
+    }
+    *jobs_out = jobs;
+    return count;
+}
+
+/**
+ * Take the next job for a worker: its own newest, or another worker's oldest
+ * @return Job index, or -1 when every queue is empty
+ */
+static int batch_next_job(BatchWorker *worker) {
+    BatchShared *shared = worker->shared;
+
+    for (int i = 0; i < shared->worker_count; i++) {
+        int victim = (worker->index + i) % shared->worker_count;
+        BatchQueue *queue = &shared->queues[victim];
+        int job = -1;
+
+        pthread_mutex_lock(&queue->lock);
+        if (queue->head < queue->tail) {
+            job = victim == worker->index ? queue->jobs[--queue->tail] : queue->jobs[queue->head++];
+        }
+        pthread_mutex_unlock(&queue->lock);
+
+        if (job >= 0) {
+            if (victim != worker->index) {
+                worker->stolen++;
+            }
+            return job;
+        }
+    }
+    return -1;
+}
+
+/**
+ * FNV-1a hash of the text screen at $0400
+ */
+static uint64_t batch_screen_hash(Machine *m) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    uint8_t screen[40 * 25];
+
+    memory_read_block_r(m, SCREEN_MEMORY_START, screen, sizeof(screen));
+    for (size_t i = 0; i < sizeof(screen); i++) {
+        hash ^= screen[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Check whether the program has settled in an idle loop
+ * Idle loop detection catches polling loops in the threaded engine; a
+ * JMP to itself is also recognised directly for the other engines.
+ */
+static int batch_is_idle(Machine *m, uint64_t idle_before) {
+    uint16_t pc = cpu_get_pc_r(m);
+
+    if (cpu_get_idle_cycles_r(m) != idle_before) {
+        return 1;
+    }
+    return memory_read_r(m, pc) == 0x4C &&
+           (memory_read_r(m, pc + 1) | (memory_read_r(m, pc + 2) << 8)) == pc;
+}
+
+/**
+ * Reset a worker's machine and load a job's program into it
+ * The program is read straight into the machine's RAM; the ROMs are the
+ * template's, so nothing but the PRG file is opened.
+ * @return 1 on success, 0 if the file can't be loaded (reported)
+ */
+static int batch_load(BatchWorker *worker, Machine *m, BatchJob *job) {
+    sched_cancel_all(m);
+    memory_init_r(m);
+    memory_copy_roms_r(m, worker->shared->template);
+    cpu_init_r(m);
+    io_init_r(m);
+    cpu_clear_breakpoints_r(m);
+
+    MemoryPrgInfo info;
+    if (!memory_load_prg_r(m, job->file, job->load, &info)) {
+        return 0;
+    }
+    cpu_set_pc_r(m, job->start >= 0 ? job->start : info.start);
+    return 1;
+}
+
+/**
+ * Run one job to its exit condition or the end of its budget
+ */
+static void batch_run_job(BatchWorker *worker, Machine *m, BatchJob *job) {
+    if (!batch_load(worker, m, job)) {
+        job->reason = BATCH_EXIT_ERROR;
+        return;
+    }
+    if (job->exit == BATCH_EXIT_PC) {
+        cpu_set_breakpoint_r(m, job->exit_pc);
+    }
+
+    uint64_t end = cpu_get_cycles_r(m) + job->budget;
+    job->reason = BATCH_EXIT_BUDGET;
+    while (cpu_get_cycles_r(m) < end) {
+        uint64_t left = end - cpu_get_cycles_r(m);
+        uint64_t idle_before = cpu_get_idle_cycles_r(m);
+
+        if (cpu_run_r(m, left < BATCH_SLICE ? (uint32_t)left : BATCH_SLICE) == CPU_EXIT_BREAKPOINT) {
+            job->reason = BATCH_EXIT_PC;
+            break;
+        }
+        if (job->exit == BATCH_EXIT_IDLE && batch_is_idle(m, idle_before)) {
+            job->reason = BATCH_EXIT_IDLE;
+            break;
+        }
+    }
+
+    job->cycles = cpu_get_cycles_r(m);
+    cpu_get_state_r(m, &job->cpu);
+    job->status = cpu_get_status_r(m);
+    job->screen_hash = batch_screen_hash(m);
+}
+
+/**
+ * Worker thread: run jobs until there are none left
+ */
+static void *batch_worker(void *arg) {
+    BatchWorker *worker = arg;
+    Machine *m = machine_create();
+
+    if (!m) {
+        return NULL;  // The other workers steal this worker's jobs
+    }
+    for (int job = batch_next_job(worker); job >= 0; job = batch_next_job(worker)) {
+        batch_run_job(worker, m, &worker->shared->jobs[job]);
+        worker->ran++;
+    }
+    machine_destroy(m);
+    return NULL;
+}
+
+/**
+ * Write the results in manifest order
+ * @return 1 on success, 0 on a write error
+ */
+static int batch_write_results(FILE *file, const BatchJob *jobs, int count) {
+    fprintf(file, "# file exit cycles pc a x y sp p screen\n");
+    for (int i = 0; i < count; i++) {
+        const BatchJob *job = &jobs[i];
+        fprintf(file, "%s %s %llu %04X %02X %02X %02X %02X %02X %016llX\n",
+                job->file, batch_exit_names[job->reason], (unsigned long long)job->cycles,
+                job->cpu.pc, job->cpu.a, job->cpu.x, job->cpu.y, job->cpu.sp, job->status,
+                (unsigned long long)job->screen_hash);
+    }
+    return fflush(file) == 0 && !ferror(file);
+}
+
+/**
+ * Run the programs in a manifest and write their results
+ */
+int batch_run(const Machine *template, const char *manifest_path, const char *results_path, int workers) {
+    BatchJob *jobs = NULL;
+    int count = batch_read_manifest(manifest_path, &jobs);
+    if (count < 0) {
+        return 0;
+    }
+
+    FILE *results = fopen(results_path, "w");
+    if (!results) {
+        printf("Error: Could not create results file %s\n", results_path);
+        batch_free_jobs(jobs, count);
+        return 0;
+    }
+
+    if (workers <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = online > 0 ? (int)online : 1;
+    }
+    if (workers > BATCH_MAX_WORKERS) {
+        workers = BATCH_MAX_WORKERS;
+    }
+    if (workers > count) {
+        workers = count > 0 ? count : 1;
+    }
+
+    BatchShared shared = { template, jobs, NULL, workers };
+    BatchWorker *pool = calloc(workers, sizeof(BatchWorker));
+    int *order = malloc((count > 0 ? count : 1) * sizeof(int));
+    shared.queues = calloc(workers, sizeof(BatchQueue));
+    if (!pool || !order || !shared.queues) {
+        printf("Error: Could not allocate memory for %d workers\n", workers);
+        free(pool);
+        free(order);
+        free(shared.queues);
+        fclose(results);
+        batch_free_jobs(jobs, count);
+        return 0;
+    }
+
+    // Deal the jobs out in contiguous runs
+    for (int i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    for (int w = 0; w < workers; w++) {
+        BatchQueue *queue = &shared.queues[w];
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->jobs = order;
+        queue->head = (int)((long)count * w / workers);
+        queue->tail = (int)((long)count * (w + 1) / workers);
+        pool[w].shared = &shared;
+        pool[w].index = w;
+    }
+
+    // Worker 0 runs on this thread; a worker that can't start leaves its jobs to the others
+    double start = batch_now();
+    int started = 1;
+    for (int w = 1; w < workers; w++) {
+        if (pthread_create(&pool[w].thread, NULL, batch_worker, &pool[w]) == 0) {
+            pool[w].started = 1;
+            started++;
+        }
+    }
+    batch_worker(&pool[0]);
+    for (int w = 1; w < workers; w++) {
+        if (pool[w].started) {
+            pthread_join(pool[w].thread, NULL);
+        }
+    }
+    double elapsed = batch_now() - start;
+
+    int ran = 0, stolen = 0, errors = 0;
+    for (int w = 0; w < workers; w++) {
+        ran += pool[w].ran;
+        stolen += pool[w].stolen;
+        pthread_mutex_destroy(&shared.queues[w].lock);
+    }
+    for (int i = 0; i < count; i++) {
+        errors += jobs[i].reason == BATCH_EXIT_ERROR;
+    }
+
+    int written = batch_write_results(results, jobs, count);
+    if (fclose(results) != 0 || !written) {
+        printf("Error: Could not write results file %s\n", results_path);
+    }
+    printf("Batch: %d programs on %d workers in %.2f s (%d stolen, %d errors)\n",
+           count, started, elapsed, stolen, errors);
+
+    int ok = written && ran == count && errors == 0;
+    batch_free_jobs(jobs, count);
+    free(order);
+    free(shared.queues);
+    free(pool);
+    return ok;
+}
@@ -0,0 +1,49 @@
+/**
+ * batch.h
+ * Batch runner for PRG test corpora
+ *
+ * Runs every program listed in a manifest on a pool of worker threads,
+ * each with its own Machine, and writes one result line per program.
+ *
+ * Manifest: one program per line, blank lines and lines starting with '#'
+ * are ignored:
+ *
+ *   <file> <load> <budget> <exit> [start]
+ *
+ *   file   - PRG file (the first two bytes are the load address)
+ *   load   - Hex load address, or '-' to use the address in the file
+ *   budget - Maximum number of cycles to run (decimal)
+ *   exit   - When to stop before the budget is used up:
+ *              budget     run the whole budget
+ *              idle       the program has settled in an idle loop
+ *                         (JMP *, a branch to itself, a polling loop)
+ *              pc=<hex>   PC reaches an address
+ *   start  - Hex address to start at (default: the load address)
+ *
+ * Results file: a header line starting with '#', then one line per program
+ * in manifest order:
+ *
+ *   <file> <exit> <cycles> <pc> <a> <x> <y> <sp> <p> <screen>
+ *
+ * exit is budget, idle, pc or error; registers are hex; screen is the
+ * FNV-1a hash of the 1000 bytes of screen memory at $0400.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "../machine/machine.h"
+
+/**
+ * Run the programs in a manifest and write their results
+ * Worker machines start from the ROMs of the template machine.
+ *
+ * @param template Machine to copy the ROMs from (usually machine_default())
+ * @param manifest_path Manifest file
+ * @param results_path Results file to create
+ * @param workers Number of worker threads, or 0 for one per online CPU
+ * @return 1 if every program was loaded and run, 0 otherwise
+ */
+int batch_run(const Machine *template, const char *manifest_path, const char *results_path, int workers);
+
+#endif /* BATCH_H */
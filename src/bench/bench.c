@@ -0,0 +1,767 @@
+/**
+ * bench.c
+ * Built-in microbenchmarks for the Commodore 64 emulator
+ *
+ * Each CPU benchmark loads a small guest loop into free RAM at $C000, runs
+ * it through cpu_run() for a fixed cycle budget and reports host throughput.
+ * The RAM used and the CPU registers are saved beforehand and restored
+ * afterwards, so a benchmark can be run in the middle of a session.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "../cpu/cpu.h"
+#include "../memory/memory.h"
+#include "../memory/memory_inline.h"
+#include "../machine/machine.h"
+#include "../machine/snapshot.h"
+#include "../machine/rewind.h"
+
+#define BENCH_BASE      0xC000  // Guest code and data area (free RAM)
+#define BENCH_AREA_SIZE 0x0400  // Bytes saved and restored around a run
+#define BENCH_CYCLES    50000000
+#define BENCH_SWITCHES  10000000
+#define BENCH_ACCESSES  100000000
+#define BENCH_CHECKPOINT_CYCLES 20000  // About one video frame
+#define BENCH_DUMPS     20
+#define BENCH_SNAPSHOTS 10000
+#define BENCH_STARTUPS  50
+#define BENCH_FORKS     2000
+#define BENCH_REWIND_PASSES 5     // Runs with and without recording; the fastest counts
+#define BENCH_SELF      "/proc/self/exe"  // The running c64emu
+
+extern char **environ;
+
+/**
+ * A guest loop used as a CPU benchmark
+ * instructions/cycles describe one pass through the steady-state loop and
+ * are used to convert cycles into instructions.
+ */
+typedef struct {
+    const char *name;
+    const char *description;
+    const uint8_t *code;
+    uint16_t code_size;
+    uint16_t entry;
+    int instructions;
+    int cycles;
+} BenchProgram;
+
+// Loads and register transfers: every instruction sets N/Z and nothing reads them
+static const uint8_t bench_transfer_code[] = {
+    0xA9, 0x01,        // $C000 LDA #$01
+    0xAA,              // $C002 TAX
+    0xE8,              // $C003 INX
+    0x8A,              // $C004 TXA
+    0xA8,              // $C005 TAY
+    0x88,              // $C006 DEY
+    0x98,              // $C007 TYA
+    0xA2, 0x80,        // $C008 LDX #$80
+    0xCA,              // $C00A DEX
+    0x4C, 0x00, 0xC0   // $C00B JMP $C000
+};
+
+// Compare and branch: flags are produced and consumed on every pass
+static const uint8_t bench_branch_code[] = {
+    0xA2, 0x00,        // $C000 LDX #$00
+    0xE8,              // $C002 INX
+    0x8A,              // $C003 TXA
+    0xC9, 0x80,        // $C004 CMP #$80
+    0x90, 0x00,        // $C006 BCC $C008
+    0xD0, 0xF8,        // $C008 BNE $C002
+    0x4C, 0x02, 0xC0   // $C00A JMP $C002
+};
+
+// Memory copy: LDA abs,X / STA abs,X / INX / BNE over one page
+static const uint8_t bench_copy_code[] = {
+    0xA2, 0x00,        // $C000 LDX #$00
+    0xBD, 0x00, 0xC1,  // $C002 LDA $C100,X
+    0x9D, 0x00, 0xC2,  // $C005 STA $C200,X
+    0xE8,              // $C008 INX
+    0xD0, 0xF7,        // $C009 BNE $C002
+    0x4C, 0x00, 0xC0   // $C00B JMP $C000
+};
+
+// Delay loop: DEX / BNE counting down from 256
+static const uint8_t bench_delay_code[] = {
+    0xA2, 0x00,        // $C000 LDX #$00
+    0xCA,              // $C002 DEX
+    0xD0, 0xFD,        // $C003 BNE $C002
+    0x4C, 0x00, 0xC0   // $C005 JMP $C000
+};
+
+static const BenchProgram cpu_programs[] = {
+    { "transfer", "loads, transfers, INX/DEX", bench_transfer_code,
+      sizeof(bench_transfer_code), 0xC000, 10, 21 },
+    { "branch", "INX/TXA/CMP #imm/BCC/BNE", bench_branch_code,
+      sizeof(bench_branch_code), 0xC000, 5, 10 },
+    { "copy", "LDA abs,X/STA abs,X/INX/BNE", bench_copy_code,
+      sizeof(bench_copy_code), 0xC000, 4, 13 },
+    { "delay", "LDX #0/DEX/BNE", bench_delay_code,
+      sizeof(bench_delay_code), 0xC000, 514, 1029 },
+};
+
+/**
+ * How a CPU benchmark uses the dirty page bitmaps
+ */
+typedef enum {
+    BENCH_DIRTY_NONE,     // Never taken: every page stays dirty, nothing to record
+    BENCH_DIRTY_PAGES,    // Page bitmap taken at every checkpoint
+    BENCH_DIRTY_BLOCKS    // 64-byte blocks recorded as well, both taken at every checkpoint
+} BenchDirtyMode;
+
+/**
+ * A rerun of a CPU benchmark with dirty tracking checkpoints
+ */
+typedef struct {
+    const char *name;
+    const char *description;
+    BenchDirtyMode mode;
+} BenchDirtyRun;
+
+static const BenchDirtyRun dirty_runs[] = {
+    { "pages", "copy, page bitmap per frame", BENCH_DIRTY_PAGES },
+    { "blocks", "copy, 64-byte blocks per frame", BENCH_DIRTY_BLOCKS },
+};
+
+/**
+ * Current time in seconds from a monotonic clock
+ */
+static double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Run one guest loop and print its throughput
+ * With a dirty mode, the run stops at every checkpoint to take the
+ * MEMORY_DIRTY_USER set, as an incremental snapshot would.
+ */
+static void bench_cpu_program(const BenchProgram *program, const char *name,
+                              const char *description, BenchDirtyMode dirty) {
+    uint64_t pages[MEMORY_DIRTY_PAGE_WORDS];
+    uint64_t blocks[MEMORY_DIRTY_BLOCK_WORDS];
+
+    memory_write_block(BENCH_BASE, program->code, program->code_size);
+    cpu_set_pc(program->entry);
+    if (dirty == BENCH_DIRTY_BLOCKS) {
+        memory_set_dirty_blocks(1);
+    }
+
+    double start = bench_now();
+    if (dirty == BENCH_DIRTY_NONE) {
+        cpu_run(BENCH_CYCLES);
+    } else {
+        for (int cycles = 0; cycles < BENCH_CYCLES; cycles += BENCH_CHECKPOINT_CYCLES) {
+            cpu_run(BENCH_CHECKPOINT_CYCLES);
+            memory_take_dirty_pages(MEMORY_DIRTY_USER, pages);
+            if (dirty == BENCH_DIRTY_BLOCKS) {
+                memory_take_dirty_blocks(MEMORY_DIRTY_USER, blocks);
+            }
+        }
+    }
+    double elapsed = bench_now() - start;
+
+    if (dirty == BENCH_DIRTY_BLOCKS) {
+        memory_set_dirty_blocks(0);
+    }
+
+    double instructions = (double)BENCH_CYCLES * program->instructions / program->cycles;
+    printf("  %-10s %-30s %8.1f Mcycles/s %8.1f MIPS %6.2f ns/instr\n",
+           name, description,
+           BENCH_CYCLES / elapsed / 1e6,
+           instructions / elapsed / 1e6,
+           elapsed * 1e9 / instructions);
+}
+
+/**
+ * CPU core benchmarks
+ */
+static void bench_cpu() {
+    uint8_t saved_area[BENCH_AREA_SIZE];
+    CPU saved_cpu;
+
+    // Preserve everything the benchmark touches
+    memory_read_block(BENCH_BASE, saved_area, sizeof(saved_area));
+    cpu_get_state(&saved_cpu);
+
+    printf("CPU benchmarks (%d cycles each):\n", BENCH_CYCLES);
+    for (size_t i = 0; i < sizeof(cpu_programs) / sizeof(cpu_programs[0]); i++) {
+        bench_cpu_program(&cpu_programs[i], cpu_programs[i].name, cpu_programs[i].description,
+                          BENCH_DIRTY_NONE);
+    }
+
+    // The copy loop stores on every pass, so it shows the cost of recording writes
+    printf("Dirty tracking (checkpoint every %d cycles):\n", BENCH_CHECKPOINT_CYCLES);
+    for (size_t i = 0; i < sizeof(dirty_runs) / sizeof(dirty_runs[0]); i++) {
+        bench_cpu_program(&cpu_programs[2] /* copy */, dirty_runs[i].name, dirty_runs[i].description,
+                          dirty_runs[i].mode);
+    }
+
+    memory_write_block(BENCH_BASE, saved_area, sizeof(saved_area));
+    cpu_set_state(&saved_cpu);
+}
+
+/**
+ * Bank switch benchmark
+ * Writes the processor port the way demos do, cycling through the
+ * default configuration, RAM + I/O, all RAM and RAM + KERNAL.
+ */
+static void bench_bank() {
+    static const uint8_t port_values[] = { 0x37, 0x35, 0x34, 0x36 };
+    uint8_t saved_port = memory_read(0x0001);
+
+    printf("Bank switch benchmark (%d writes to $01):\n", BENCH_SWITCHES);
+
+    double start = bench_now();
+    for (int i = 0; i < BENCH_SWITCHES; i++) {
+        memory_write(0x0001, port_values[i & 3]);
+    }
+    double elapsed = bench_now() - start;
+
+    printf("  %-10s %-30s %8.1f M/s %14.2f ns/switch\n",
+           "port", "$37/$35/$34/$36 round robin",
+           BENCH_SWITCHES / elapsed / 1e6,
+           elapsed * 1e9 / BENCH_SWITCHES);
+
+    memory_write(0x0001, saved_port);
+}
+
+/**
+ * One memory access path measured by the access benchmark
+ * run does count accesses and returns a value depending on every byte
+ * read, so the reads can't be optimised away.
+ */
+typedef struct {
+    const char *name;
+    const char *description;
+    unsigned (*run)(Machine *m, int count);
+} BenchAccess;
+
+static unsigned bench_read_call(Machine *m, int count) {
+    unsigned sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += memory_read_r(m, BENCH_BASE + (i & 0xFF));
+    }
+    return sum;
+}
+
+static unsigned bench_read_fast(Machine *m, int count) {
+    unsigned sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += memory_read_fast_r(m, BENCH_BASE + (i & 0xFF));
+    }
+    return sum;
+}
+
+static unsigned bench_read_io(Machine *m, int count) {
+    unsigned sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += memory_read_fast_r(m, 0xD020 + (i & 0x0F));
+    }
+    return sum;
+}
+
+static unsigned bench_fetch16(Machine *m, int count) {
+    unsigned sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += memory_fetch16_r(m, BENCH_BASE + (i & 0xFE));
+    }
+    return sum;
+}
+
+static unsigned bench_read_zp(Machine *m, int count) {
+    unsigned sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += memory_read_zp_r(m, (uint8_t)i);
+    }
+    return sum;
+}
+
+static unsigned bench_read_stack(Machine *m, int count) {
+    unsigned sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += memory_read_stack_r(m, (uint8_t)i);
+    }
+    return sum;
+}
+
+static unsigned bench_write_call(Machine *m, int count) {
+    for (int i = 0; i < count; i++) {
+        memory_write_r(m, BENCH_BASE + (i & 0xFF), (uint8_t)i);
+    }
+    return 0;
+}
+
+static unsigned bench_write_fast(Machine *m, int count) {
+    for (int i = 0; i < count; i++) {
+        memory_write_fast_r(m, BENCH_BASE + (i & 0xFF), (uint8_t)i);
+    }
+    return 0;
+}
+
+static unsigned bench_write_zp(Machine *m, int count) {
+    for (int i = 0; i < count; i++) {
+        memory_write_zp_r(m, 0x80 | (i & 0x7F), (uint8_t)i);
+    }
+    return 0;
+}
+
+static unsigned bench_write_stack(Machine *m, int count) {
+    for (int i = 0; i < count; i++) {
+        memory_write_stack_r(m, (uint8_t)i, (uint8_t)i);
+    }
+    return 0;
+}
+
+static const BenchAccess access_paths[] = {
+    { "read",       "memory_read(), RAM page",         bench_read_call },
+    { "read_fast",  "Inline read, RAM page",           bench_read_fast },
+    { "read_io",    "Inline read, I/O page (VIC)",     bench_read_io },
+    { "fetch16",    "Inline operand word fetch",       bench_fetch16 },
+    { "zp_read",    "Zero page read",                  bench_read_zp },
+    { "stack_read", "Stack read",                      bench_read_stack },
+    { "write",      "memory_write(), RAM page",        bench_write_call },
+    { "write_fast", "Inline write, RAM page",          bench_write_fast },
+    { "zp_write",   "Zero page write",                 bench_write_zp },
+    { "stack_write", "Stack write",                    bench_write_stack },
+};
+
+/**
+ * Memory access benchmark
+ * Times each access path on its own. Zero page, the stack and the page at
+ * $C000 are saved and restored around the run.
+ */
+static void bench_access() {
+    Machine *m = machine_default();
+    uint8_t saved_low[0x200];
+    uint8_t saved_area[0x100];
+    volatile unsigned sink = 0;
+
+    memory_read_block_r(m, 0x0000, saved_low, sizeof(saved_low));
+    memory_read_block_r(m, BENCH_BASE, saved_area, sizeof(saved_area));
+
+    printf("Memory access benchmark (%d accesses each):\n", BENCH_ACCESSES);
+
+    for (size_t i = 0; i < sizeof(access_paths) / sizeof(access_paths[0]); i++) {
+        double start = bench_now();
+        sink += access_paths[i].run(m, BENCH_ACCESSES);
+        double elapsed = bench_now() - start;
+
+        printf("  %-11s %-30s %8.1f M/s %14.2f ns/access\n",
+               access_paths[i].name, access_paths[i].description,
+               BENCH_ACCESSES / elapsed / 1e6,
+               elapsed * 1e9 / BENCH_ACCESSES);
+    }
+
+    memory_write_block_r(m, 0x0000, saved_low, sizeof(saved_low));
+    memory_write_block_r(m, BENCH_BASE, saved_area, sizeof(saved_area));
+}
+
+/**
+ * Hex dump the way memory_dump() used to: one read and one printf per byte
+ */
+static void bench_dump_per_byte(Machine *m, FILE *out) {
+    for (int address = 0; address < MEMORY_SIZE; address++) {
+        if ((address & 0x0F) == 0) {
+            fprintf(out, "\n$%04X: ", address);
+        }
+        fprintf(out, "%02X ", memory_read_r(m, address));
+    }
+    fprintf(out, "\n");
+}
+
+/**
+ * Hex dump benchmark
+ * Dumps all 64K to /dev/null with a printf per byte and with
+ * memory_hex_dump().
+ */
+static void bench_dump() {
+    Machine *m = machine_default();
+    FILE *out = fopen("/dev/null", "w");
+
+    if (!out) {
+        printf("Error: Could not open /dev/null\n");
+        return;
+    }
+
+    printf("Hex dump benchmark (%d dumps of 64K):\n", BENCH_DUMPS);
+
+    double start = bench_now();
+    for (int i = 0; i < BENCH_DUMPS; i++) {
+        bench_dump_per_byte(m, out);
+    }
+    double per_byte = (bench_now() - start) / BENCH_DUMPS;
+
+    start = bench_now();
+    for (int i = 0; i < BENCH_DUMPS; i++) {
+        memory_hex_dump_r(m, out, 0x0000, MEMORY_SIZE);
+    }
+    double buffered = (bench_now() - start) / BENCH_DUMPS;
+    fclose(out);
+
+    printf("  %-10s %-30s %10.3f ms/dump\n", "per_byte", "printf per byte", per_byte * 1e3);
+    printf("  %-10s %-30s %10.3f ms/dump %8.1fx\n", "buffered", "memory_hex_dump()",
+           buffered * 1e3, per_byte / buffered);
+}
+
+/**
+ * Print one snapshot benchmark result
+ */
+static void bench_snapshot_result(const char *name, const char *description, double elapsed) {
+    printf("  %-12s %-36s %10.3f us\n", name, description, elapsed * 1e6 / BENCH_SNAPSHOTS);
+}
+
+/**
+ * Snapshot benchmark
+ * Captures and restores the default machine, in full (alternating between
+ * two snapshots, the second with $0800-$9FFF filled) and incrementally
+ * after a test-sized write of 4 pages. The machine is put back as it was.
+ */
+static void bench_snapshot() {
+    Machine *m = machine_default();
+    MachineSnapshot *saved = malloc(sizeof(MachineSnapshot));
+    MachineSnapshot *a = malloc(sizeof(MachineSnapshot));
+    MachineSnapshot *b = malloc(sizeof(MachineSnapshot));
+
+    if (!saved || !a || !b) {
+        printf("Error: Could not allocate snapshots\n");
+        free(saved);
+        free(a);
+        free(b);
+        return;
+    }
+
+    printf("Snapshot benchmark (%d captures or restores each, %zu bytes):\n",
+           BENCH_SNAPSHOTS, sizeof(MachineSnapshot));
+
+    snapshot_capture_r(m, saved);
+    snapshot_capture_r(m, a);
+    memory_fill_r(m, 0x0800, 0xA5, 0xA000 - 0x0800);
+    snapshot_capture_r(m, b);
+
+    double start = bench_now();
+    for (int i = 0; i < BENCH_SNAPSHOTS; i++) {
+        snapshot_capture_r(m, (i & 1) ? b : a);
+    }
+    bench_snapshot_result("capture", "full (64K RAM)", bench_now() - start);
+
+    start = bench_now();
+    for (int i = 0; i < BENCH_SNAPSHOTS; i++) {
+        memory_fill_r(m, BENCH_BASE, (uint8_t)i, 0x400);
+        snapshot_capture_r(m, a);
+    }
+    bench_snapshot_result("capture_inc", "incremental, 4 pages written", bench_now() - start);
+
+    start = bench_now();
+    for (int i = 0; i < BENCH_SNAPSHOTS; i++) {
+        snapshot_restore_r(m, (i & 1) ? a : b);
+    }
+    bench_snapshot_result("restore", "full, 152 pages differ", bench_now() - start);
+
+    start = bench_now();
+    for (int i = 0; i < BENCH_SNAPSHOTS; i++) {
+        memory_fill_r(m, BENCH_BASE, (uint8_t)(i + 1), 0x400);
+        snapshot_restore_r(m, a);
+    }
+    bench_snapshot_result("restore_inc", "incremental, 4 pages written", bench_now() - start);
+
+    snapshot_restore_r(m, saved);
+    free(saved);
+    free(a);
+    free(b);
+}
+
+/**
+ * Resident memory of the process in bytes, from /proc/self/statm
+ */
+static long bench_resident_bytes() {
+    long size = 0;
+    long resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (!statm) {
+        return 0;
+    }
+    if (fscanf(statm, "%ld %ld", &size, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(statm);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Fork benchmark
+ * Forks the default machine BENCH_FORKS times, writes 4 pages in each
+ * fork (a test-sized change) and reports the time per fork, the time per
+ * copied page and the memory each live fork adds. The default machine is
+ * not changed.
+ */
+static void bench_fork() {
+    Machine *parent = machine_default();
+    Machine **forks = calloc(BENCH_FORKS, sizeof(Machine *));
+
+    if (!forks) {
+        printf("Error: Could not allocate the fork table\n");
+        return;
+    }
+
+    printf("Fork benchmark (%d live forks, %zu-byte Machine):\n", BENCH_FORKS, sizeof(Machine));
+
+    long resident = bench_resident_bytes();
+    double start = bench_now();
+    int count = 0;
+    while (count < BENCH_FORKS && (forks[count] = machine_fork(parent)) != NULL) {
+        count++;
+    }
+    double elapsed = bench_now() - start;
+    if (count == 0) {
+        free(forks);
+        return;
+    }
+    printf("  %-12s %-36s %10.3f us\n", "fork", "RAM shared, nothing written", elapsed * 1e6 / count);
+
+    start = bench_now();
+    for (int i = 0; i < count; i++) {
+        memory_fill_r(forks[i], BENCH_BASE, (uint8_t)i, 0x400);
+    }
+    elapsed = bench_now() - start;
+    printf("  %-12s %-36s %10.3f us\n", "write", "4 pages copied on write per fork", elapsed * 1e6 / count);
+
+    double per_fork = (double)(bench_resident_bytes() - resident) / count;
+    printf("  %-12s %-36s %10.1f KB (%.0f MB for %d)\n", "memory", "resident per live fork",
+           per_fork / 1024, per_fork * count / (1024 * 1024), count);
+
+    for (int i = 0; i < count; i++) {
+        machine_destroy(forks[i]);
+    }
+    free(forks);
+}
+
+/**
+ * Run a guest loop on a machine for BENCH_CYCLES
+ * @return Seconds taken
+ */
+static double bench_rewind_run(Machine *m, const BenchProgram *program) {
+    memory_write_block_r(m, BENCH_BASE, program->code, program->code_size);
+    cpu_set_pc_r(m, program->entry);
+
+    double start = bench_now();
+    cpu_run_r(m, BENCH_CYCLES);
+    return bench_now() - start;
+}
+
+/**
+ * Rewind benchmark
+ * Runs the CPU loops on a fork of the default machine with and without
+ * recording and reports the overhead, the size of the history, and how
+ * long rewinding by various distances takes.
+ */
+static void bench_rewind() {
+    static const struct {
+        const char *name;
+        uint64_t cycles;
+    } depths[] = {
+        { "1000 cycles", 1000 },
+        { "1 frame", VIC_CYCLES_PER_FRAME },
+        { "49 frames", 49 * VIC_CYCLES_PER_FRAME },
+        { "500 frames", 500 * VIC_CYCLES_PER_FRAME },
+    };
+    Machine *m = machine_fork(machine_default());
+
+    if (!m) {
+        return;
+    }
+
+    printf("Rewind benchmark (%d cycles per run, record every %d cycles, keyframe every %d):\n",
+           BENCH_CYCLES, REWIND_RECORD_CYCLES, REWIND_KEYFRAME_INTERVAL);
+    for (size_t i = 0; i < sizeof(cpu_programs) / sizeof(cpu_programs[0]); i++) {
+        double off = 0;
+        double on = 0;
+        for (int pass = 0; pass < BENCH_REWIND_PASSES; pass++) {
+            double elapsed = bench_rewind_run(m, &cpu_programs[i]);
+            if (pass == 0 || elapsed < off) {
+                off = elapsed;
+            }
+            rewind_start_r(m, REWIND_DEFAULT_BUDGET);
+            elapsed = bench_rewind_run(m, &cpu_programs[i]);
+            if (pass == 0 || elapsed < on) {
+                on = elapsed;
+            }
+            rewind_stop_r(m);
+        }
+        printf("  %-10s %-30s %8.1f Mcycles/s off %8.1f on %+6.1f%%\n",
+               cpu_programs[i].name, cpu_programs[i].description,
+               BENCH_CYCLES / off / 1e6, BENCH_CYCLES / on / 1e6, (on - off) * 100 / off);
+    }
+
+    // A history of the copy loop, which writes a page per pass
+    rewind_start_r(m, REWIND_DEFAULT_BUDGET);
+    bench_rewind_run(m, &cpu_programs[2]);
+    rewind_print_stats_r(m);
+    for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+        double start = bench_now();
+        rewind_to_r(m, m->cycles - depths[i].cycles);
+        printf("  %-10s %-30s %10.3f ms\n", "rewind", depths[i].name, (bench_now() - start) * 1e3);
+    }
+
+    machine_destroy(m);
+}
+
+/**
+ * Launch c64emu once with --startup-probe and read the latency it reports
+ * The start time is taken just before the spawn, so the result covers
+ * process creation, exec, initialisation and the first instruction.
+ *
+ * @param resume_image Snapshot to pass to --resume, or NULL for a normal boot
+ * @return Nanoseconds to the first instruction, or -1 on failure
+ */
+static long long bench_startup_probe(const char *resume_image) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+    struct timespec ts;
+    char start[32];
+    char *argv[] = { "c64emu", "--startup-probe", start, NULL, NULL, NULL };
+    if (resume_image) {
+        argv[3] = "--resume";
+        argv[4] = (char *)resume_image;
+    }
+
+    pid_t pid;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    snprintf(start, sizeof(start), "%lld", (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+    int error = posix_spawn(&pid, BENCH_SELF, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (error != 0) {
+        close(fds[0]);
+        return -1;
+    }
+
+    long long latency = -1;
+    char line[256];
+    FILE *out = fdopen(fds[0], "r");
+    if (out) {
+        while (fgets(line, sizeof(line), out)) {
+            sscanf(line, "Startup: %lld ns", &latency);
+        }
+        fclose(out);
+    } else {
+        close(fds[0]);
+    }
+    waitpid(pid, NULL, 0);
+    return latency;
+}
+
+/**
+ * Launch c64emu BENCH_STARTUPS times one way and print the latencies
+ */
+static void bench_startup_mode(const char *name, const char *description, const char *resume_image) {
+    long long total = 0;
+    long long best = -1;
+
+    for (int i = 0; i < BENCH_STARTUPS; i++) {
+        long long latency = bench_startup_probe(resume_image);
+        if (latency < 0) {
+            printf("Error: Could not launch %s for the %s startup\n", BENCH_SELF, name);
+            return;
+        }
+        total += latency;
+        if (best < 0 || latency < best) {
+            best = latency;
+        }
+    }
+    printf("  %-8s %-30s %9.1f us mean %9.1f us min\n", name, description,
+           total / 1e3 / BENCH_STARTUPS, best / 1e3);
+}
+
+/**
+ * Startup benchmark
+ * Launches c64emu from scratch, booting normally and resuming from a
+ * snapshot of the default machine, and reports the time from spawning
+ * the process to its first instruction.
+ */
+static void bench_startup() {
+    char image[] = "/tmp/c64emu-startup-XXXXXX";
+    int fd = mkstemp(image);
+
+    if (fd < 0) {
+        printf("Error: Could not create a temporary snapshot file\n");
+        return;
+    }
+    close(fd);
+    if (!snapshot_save_file_r(machine_default(), image)) {
+        unlink(image);
+        return;
+    }
+
+    printf("Startup benchmark (%d launches each, spawn to first instruction):\n", BENCH_STARTUPS);
+    bench_startup_mode("boot", "ROM files, startup program", NULL);
+    bench_startup_mode("resume", "--resume <snapshot>", image);
+    unlink(image);
+}
+
+/**
+ * Benchmark suite table
+ */
+typedef struct {
+    const char *name;
+    const char *description;
+    void (*run)();
+} BenchSuite;
+
+static const BenchSuite bench_suites[] = {
+    { "cpu", "CPU core throughput on small guest loops", bench_cpu },
+    { "bank", "Processor port bank switches", bench_bank },
+    { "access", "Memory access paths (ns per read or write)", bench_access },
+    { "dump", "Full 64K hex dump, printf per byte vs buffered", bench_dump },
+    { "snapshot", "Machine snapshot capture and restore", bench_snapshot },
+    { "fork", "Copy-on-write machine forks: time and memory", bench_fork },
+    { "rewind", "Rewind recording overhead and rewind latency", bench_rewind },
+    { "startup", "Launch to first instruction, boot vs --resume", bench_startup },
+};
+
+#define BENCH_SUITE_COUNT (sizeof(bench_suites) / sizeof(bench_suites[0]))
+
+/**
+ * Run a benchmark suite by name, or all of them
+ */
+int bench_run(const char *name) {
+    int found = 0;
+
+    for (size_t i = 0; i < BENCH_SUITE_COUNT; i++) {
+        if (!name || !*name || strcmp(name, bench_suites[i].name) == 0) {
+            bench_suites[i].run();
+            found = 1;
+        }
+    }
+    return found;
+}
+
+/**
+ * List the benchmark suites
+ */
+void bench_list() {
+    printf("Available benchmarks:\n");
+    for (size_t i = 0; i < BENCH_SUITE_COUNT; i++) {
+        printf("  %-8s - %s\n", bench_suites[i].name, bench_suites[i].description);
+    }
+}
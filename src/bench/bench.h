@@ -0,0 +1,24 @@
+/**
+ * bench.h
+ * Built-in microbenchmarks for the Commodore 64 emulator
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/**
+ * Run a benchmark suite and print the results
+ *
+ * @param name Suite to run ("cpu", "bank", "access", "dump",
+ *             "snapshot", "fork", "rewind", "startup"), or NULL/empty to run all
+ *             suites
+ * @return 1 if the suite exists, 0 otherwise
+ */
+int bench_run(const char *name);
+
+/**
+ * Print the names of the available benchmark suites
+ */
+void bench_list();
+
+#endif /* BENCH_H */
@@ -6,74 +6,69 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
-#include <sys/time.h>
-#include <sys/types.h>
+#include <pthread.h>
 #include "cpu.h"
+#include "cpu_internal.h"
 #include "../memory/memory.h"
+#include "../memory/memory_inline.h"
+#include "../sched/sched.h"
+#include "../machine/machine.h"
+#include "../machine/rewind.h"
+#include "../machine/input_log.h"
 
-// CPU state
-static CPU cpu;
-static uint32_t cycles = 0;
-
-// Lookup tables for opcodes
-static uint8_t opcode_sizes[256];
-static uint8_t opcode_cycles[256];
-static AddressingMode opcode_modes[256];
+// Lookup tables for opcodes (also used by the threaded engine's decoder)
+uint8_t opcode_sizes[256];
+uint8_t opcode_cycles[256];
+AddressingMode opcode_modes[256];
 
 // Internal function declarations
-static uint16_t cpu_get_operand_address(AddressingMode mode);
-static void cpu_push_byte(uint8_t value);
-static uint8_t cpu_pull_byte();
-static void cpu_push_word(uint16_t value);
-static uint16_t cpu_pull_word();
-
-/**
- * Check if a key has been pressed (non-blocking)
- * This is a simplified implementation - a real one would use platform-specific code
- */
-static int kbhit() {
-#ifdef _WIN32
-    // Windows implementation would go here
-    return 0;
-#elif defined(__APPLE__) || defined(__unix__) || defined(__unix) || defined(unix)
-    // Unix-like systems (macOS, Linux)
-    struct timeval tv;
-    fd_set fds;
-    tv.tv_sec = 0;
-    tv.tv_usec = 0;
-    FD_ZERO(&fds);
-    FD_SET(STDIN_FILENO, &fds);
-    
-    // Use select to check if input is available
-    select(STDIN_FILENO+1, &fds, NULL, NULL, &tv);
-    return FD_ISSET(STDIN_FILENO, &fds);
-#else
-    // Fallback implementation
-    return 0;
+static uint16_t cpu_get_operand_address(Machine *m, AddressingMode mode);
+static void cpu_push_byte(Machine *m, uint8_t value);
+static uint8_t cpu_pull_byte(Machine *m);
+static void cpu_push_word(Machine *m, uint16_t value);
+static uint16_t cpu_pull_word(Machine *m);
+static void cpu_skip_getin_loop(Machine *m);
+static void cpu_kernal_call(Machine *m, uint16_t address);
+
+/**
+ * Memory code hook: drop cached instructions for a page (-1 for all)
+ */
+static void cpu_code_changed(Machine *m, int page) {
+#ifdef CPU_ENGINE_THREADED
+    cpu_decode_invalidate(m, page);
 #endif
+    cpu_jit_invalidate(m, page);
 }
 
 /**
- * Initialize the CPU
+ * Scheduler event: latch an interrupt request (arg is 1 for NMI, 0 for IRQ)
  */
-void cpu_init() {
-    // Reset CPU registers
-    cpu.pc = 0;
-    cpu.a = 0;
-    cpu.x = 0;
-    cpu.y = 0;
-    cpu.sp = 0xFD;  // Initial stack pointer value
-    
-    // Reset CPU flags
-    cpu.c = 0;
-    cpu.z = 0;
-    cpu.i = 1;  // Interrupts disabled at startup
-    cpu.d = 0;
-    cpu.b = 0;
-    cpu.v = 0;
-    cpu.n = 0;
-    
+static void cpu_interrupt_event(Machine *m, int arg, uint64_t cycle) {
+    (void)cycle;
+    if (arg) {
+        m->cpu_state.nmi_pending = 1;
+    } else {
+        m->cpu_state.irq_pending = 1;
+    }
+}
+
+/**
+ * Scheduler change hook: stop a running engine in time for an earlier event
+ */
+static void cpu_sched_changed(Machine *m, uint64_t next_cycle) {
+    if (next_cycle < m->cpu_state.run_limit) {
+        m->cpu_state.run_limit = next_cycle;
+    }
+}
+
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Build the opcode tables shared by every machine (once per process)
+ * Run through pthread_once(), so machines created on several threads at
+ * once wait for the first to finish, and see the tables once it has.
+ */
+static void build_cpu_tables() {
     // Initialize opcode tables with default values
     memset(opcode_sizes, 1, sizeof(opcode_sizes));
     memset(opcode_cycles, 2, sizeof(opcode_cycles));
@@ -158,121 +153,187 @@ void cpu_init() {
     opcode_sizes[0x70] = 2; opcode_cycles[0x70] = 2; opcode_modes[0x70] = ADDR_RELATIVE;      // BVS Relative
     opcode_sizes[0x50] = 2; opcode_cycles[0x50] = 2; opcode_modes[0x50] = ADDR_RELATIVE;      // BVC Relative
     
+#ifdef CPU_ENGINE_THREADED
+    cpu_threaded_init();
+#endif
+}
+
+/**
+ * Initialize the CPU
+ */
+void cpu_init_r(Machine *m) {
+    pthread_once(&tables_once, build_cpu_tables);
+    
+    // Reset CPU registers
+    m->cpu.pc = 0;
+    m->cpu.a = 0;
+    m->cpu.x = 0;
+    m->cpu.y = 0;
+    m->cpu.sp = 0xFD;  // Initial stack pointer value
+    
+    // Reset CPU flags
+    m->cpu.p = STATUS_I;  // Interrupts disabled at startup
+    m->cpu.nz = 1;        // Neither Z nor N
+    m->cpu.carry = 0;
+    
+    // Keep predecoded and compiled code in step with memory writes and banking
+#ifdef CPU_ENGINE_THREADED
+    cpu_decode_flush(m);
+#endif
+    memory_set_code_hook_r(m, cpu_code_changed);
+    
+    // Interrupt requests arrive as scheduler events
+    m->cpu_state.irq_event = sched_register(m, "IRQ", cpu_interrupt_event, 0);
+    m->cpu_state.nmi_event = sched_register(m, "NMI", cpu_interrupt_event, 1);
+    sched_set_change_hook(m, cpu_sched_changed);
+    
     // Reset the CPU
-    cpu_reset();
+    cpu_reset_r(m);
 }
 
 /**
- * Pack the status register flags into a single byte
+ * Free the decode cache and compiled code
  */
-uint8_t cpu_get_status() {
-    uint8_t status = 0;
-    status |= cpu.c << 0;
-    status |= cpu.z << 1;
-    status |= cpu.i << 2;
-    status |= cpu.d << 3;
-    status |= cpu.b << 4;
-    status |= 1 << 5;     // Bit 5 is always set
-    status |= cpu.v << 6;
-    status |= cpu.n << 7;
+void cpu_release_r(Machine *m) {
+#ifdef CPU_ENGINE_THREADED
+    cpu_decode_release(m);
+#endif
+    cpu_jit_release(m);
+}
+
+/**
+ * Build the status register byte, evaluating the lazy N/Z/C flags
+ */
+uint8_t cpu_get_status_r(Machine *m) {
+    uint8_t status = m->cpu.p | STATUS_U;  // Bit 5 is always set
+    status |= LAZY_C(m->cpu.carry) << 0;
+    status |= LAZY_Z(m->cpu.nz) << 1;
+    status |= LAZY_N(m->cpu.nz) << 7;
     return status;
 }
 
 /**
- * Unpack a status byte into the individual flag bits
+ * Load a status byte, turning N/Z/C back into lazy results
  */
-void cpu_set_status(uint8_t status) {
-    cpu.c = (status >> 0) & 1;
-    cpu.z = (status >> 1) & 1;
-    cpu.i = (status >> 2) & 1;
-    cpu.d = (status >> 3) & 1;
-    cpu.b = (status >> 4) & 1;
-    // Bit 5 is ignored
-    cpu.v = (status >> 6) & 1;
-    cpu.n = (status >> 7) & 1;
+void cpu_set_status_r(Machine *m, uint8_t status) {
+    m->cpu.p = status & (STATUS_I | STATUS_D | STATUS_B | STATUS_V);
+    
+    // Pick a result that reproduces N and Z; bit 8 covers N and Z together
+    if (status & STATUS_Z) {
+        m->cpu.nz = (status & STATUS_N) ? 0x100 : 0x00;
+    } else {
+        m->cpu.nz = (status & STATUS_N) ? 0x80 : 0x01;
+    }
+    m->cpu.carry = (status & STATUS_C) ? 0x100 : 0;
+}
+
+/**
+ * Copy the CPU registers
+ */
+void cpu_get_state_r(Machine *m, CPU *state) {
+    *state = m->cpu;
+}
+
+/**
+ * Replace the CPU registers
+ */
+void cpu_set_state_r(Machine *m, const CPU *state) {
+    m->cpu = *state;
 }
 
 /**
  * Reset the CPU - load the reset vector and start execution
  */
-void cpu_reset() {
+void cpu_reset_r(Machine *m) {
     // Read the reset vector from 0xFFFC-0xFFFD
-    uint16_t reset_vector = memory_read(RESET_VECTOR) | (memory_read(RESET_VECTOR + 1) << 8);
+    uint16_t reset_vector = memory_read_r(m, RESET_VECTOR) | (memory_read_r(m, RESET_VECTOR + 1) << 8);
     
     // Set the program counter to the reset vector
-    cpu.pc = reset_vector;
+    m->cpu.pc = reset_vector;
     
     // Set the initial status
-    cpu.sp = 0xFD;  // Reset stack pointer
-    cpu.i = 1;      // Disable interrupts
+    m->cpu.sp = 0xFD;      // Reset stack pointer
+    m->cpu.p |= STATUS_I;  // Disable interrupts
+    
+    // Reset cycle count and drop interrupt requests
+    m->cycles = 0;
+    m->cpu_state.irq_pending = 0;
+    m->cpu_state.nmi_pending = 0;
+    sched_cancel(m, m->cpu_state.irq_event);
+    sched_cancel(m, m->cpu_state.nmi_event);
+    
+    // Exported RAM header updates restart from cycle 0
+    if (m->memory.export_header) {
+        sched_schedule(m, m->memory.export_event, MEMORY_EXPORT_INTERVAL);
+    }
     
-    // Reset cycle count
-    cycles = 0;
+    // So do rewind records, in a new history
+    rewind_clock_changed_r(m);
 }
 
 /**
  * Push a byte to the stack
  */
-static void cpu_push_byte(uint8_t value) {
-    memory_write(STACK_PAGE + cpu.sp, value);
-    cpu.sp--;  // Stack grows downward
+static void cpu_push_byte(Machine *m, uint8_t value) {
+    memory_write_stack_r(m, m->cpu.sp, value);
+    m->cpu.sp--;  // Stack grows downward
 }
 
 /**
  * Pull a byte from the stack
  */
-static uint8_t cpu_pull_byte() {
-    cpu.sp++;  // Stack grows downward
-    return memory_read(STACK_PAGE + cpu.sp);
+static uint8_t cpu_pull_byte(Machine *m) {
+    m->cpu.sp++;  // Stack grows downward
+    return memory_read_stack_r(m, m->cpu.sp);
 }
 
 /**
  * Push a 16-bit word to the stack (high byte first)
  */
-static void cpu_push_word(uint16_t value) {
-    cpu_push_byte((value >> 8) & 0xFF);  // High byte
-    cpu_push_byte(value & 0xFF);         // Low byte
+static void cpu_push_word(Machine *m, uint16_t value) {
+    cpu_push_byte(m, (value >> 8) & 0xFF);  // High byte
+    cpu_push_byte(m, value & 0xFF);         // Low byte
 }
 
 /**
  * Pull a 16-bit word from the stack (low byte first)
  */
-static uint16_t cpu_pull_word() {
-    uint8_t low = cpu_pull_byte();
-    uint8_t high = cpu_pull_byte();
+static uint16_t cpu_pull_word(Machine *m) {
+    uint8_t low = cpu_pull_byte(m);
+    uint8_t high = cpu_pull_byte(m);
     return (high << 8) | low;
 }
 
 /**
  * Handle a CPU interrupt (NMI or IRQ)
  */
-void cpu_interrupt(int is_nmi) {
+void cpu_interrupt_r(Machine *m, int is_nmi) {
     // Interrupts are handled differently if they're NMI (non-maskable)
-    if (is_nmi || !cpu.i) {
+    if (is_nmi || !(m->cpu.p & STATUS_I)) {
         // Push the return address to the stack
-        cpu_push_word(cpu.pc);
+        cpu_push_word(m, m->cpu.pc);
         
         // Push the status with B flag cleared
-        uint8_t status = cpu_get_status();
+        uint8_t status = cpu_get_status_r(m);
         status &= ~(1 << 4);  // Clear B flag
-        cpu_push_byte(status);
+        cpu_push_byte(m, status);
         
         // Set the interrupt disable flag
-        cpu.i = 1;
+        m->cpu.p |= STATUS_I;
         
         // Load the interrupt vector
         uint16_t vector = is_nmi ? NMI_VECTOR : IRQ_VECTOR;
-        cpu.pc = memory_read(vector) | (memory_read(vector + 1) << 8);
+        m->cpu.pc = memory_read_r(m, vector) | (memory_read_r(m, vector + 1) << 8);
         
         // Add cycles
-        cycles += 7;
+        m->cycles += 7;
     }
 }
 
 /**
  * Get the effective address based on the addressing mode
  */
-static uint16_t cpu_get_operand_address(AddressingMode mode) {
+static uint16_t cpu_get_operand_address(Machine *m, AddressingMode mode) {
     uint16_t address = 0;
     
     switch (mode) {
@@ -283,63 +344,63 @@ static uint16_t cpu_get_operand_address(AddressingMode mode) {
             
         case ADDR_IMMEDIATE:
             // The operand is the next byte
-            return cpu.pc + 1;
+            return m->cpu.pc + 1;
             
         case ADDR_ZERO_PAGE:
             // Zero page addressing - address is the next byte
-            return memory_read(cpu.pc + 1);
+            return memory_read_fast_r(m, m->cpu.pc + 1);
             
         case ADDR_ZERO_PAGE_X:
             // Zero page,X addressing - address is the next byte + X
-            return (memory_read(cpu.pc + 1) + cpu.x) & 0xFF;
+            return (memory_read_fast_r(m, m->cpu.pc + 1) + m->cpu.x) & 0xFF;
             
         case ADDR_ZERO_PAGE_Y:
             // Zero page,Y addressing - address is the next byte + Y
-            return (memory_read(cpu.pc + 1) + cpu.y) & 0xFF;
+            return (memory_read_fast_r(m, m->cpu.pc + 1) + m->cpu.y) & 0xFF;
             
         case ADDR_RELATIVE:
             // Relative addressing - for branch instructions
             {
-                int8_t offset = (int8_t)memory_read(cpu.pc + 1);
-                return cpu.pc + 2 + offset;
+                int8_t offset = (int8_t)memory_read_fast_r(m, m->cpu.pc + 1);
+                return m->cpu.pc + 2 + offset;
             }
             
         case ADDR_ABSOLUTE:
             // Absolute addressing - address is the next two bytes
-            return memory_read(cpu.pc + 1) | (memory_read(cpu.pc + 2) << 8);
+            return memory_fetch16_r(m, m->cpu.pc + 1);
             
         case ADDR_ABSOLUTE_X:
             // Absolute,X addressing - address is the next two bytes + X
-            return (memory_read(cpu.pc + 1) | (memory_read(cpu.pc + 2) << 8)) + cpu.x;
+            return memory_fetch16_r(m, m->cpu.pc + 1) + m->cpu.x;
             
         case ADDR_ABSOLUTE_Y:
             // Absolute,Y addressing - address is the next two bytes + Y
-            return (memory_read(cpu.pc + 1) | (memory_read(cpu.pc + 2) << 8)) + cpu.y;
+            return memory_fetch16_r(m, m->cpu.pc + 1) + m->cpu.y;
             
         case ADDR_INDIRECT:
             // Indirect addressing - used by JMP
             {
-                uint16_t ptr = memory_read(cpu.pc + 1) | (memory_read(cpu.pc + 2) << 8);
+                uint16_t ptr = memory_fetch16_r(m, m->cpu.pc + 1);
                 // Simulate the 6502 indirect jump bug at page boundaries
                 if ((ptr & 0xFF) == 0xFF) {
-                    return memory_read(ptr) | (memory_read(ptr & 0xFF00) << 8);
+                    return memory_read_fast_r(m, ptr) | (memory_read_fast_r(m, ptr & 0xFF00) << 8);
                 } else {
-                    return memory_read(ptr) | (memory_read(ptr + 1) << 8);
+                    return memory_read_fast_r(m, ptr) | (memory_read_fast_r(m, ptr + 1) << 8);
                 }
             }
             
         case ADDR_INDEXED_INDIRECT:
             // (Indirect,X) addressing
             {
-                uint8_t zp = (memory_read(cpu.pc + 1) + cpu.x) & 0xFF;
-                return memory_read(zp) | (memory_read((zp + 1) & 0xFF) << 8);
+                uint8_t zp = (memory_read_fast_r(m, m->cpu.pc + 1) + m->cpu.x) & 0xFF;
+                return memory_read_zp_r(m, zp) | (memory_read_zp_r(m, (uint8_t)(zp + 1)) << 8);
             }
             
         case ADDR_INDIRECT_INDEXED:
             // (Indirect),Y addressing
             {
-                uint8_t zp = memory_read(cpu.pc + 1);
-                return (memory_read(zp) | (memory_read((zp + 1) & 0xFF) << 8)) + cpu.y;
+                uint8_t zp = memory_read_fast_r(m, m->cpu.pc + 1);
+                return (memory_read_zp_r(m, zp) | (memory_read_zp_r(m, (uint8_t)(zp + 1)) << 8)) + m->cpu.y;
             }
             
         default:
@@ -350,17 +411,38 @@ static uint16_t cpu_get_operand_address(AddressingMode mode) {
 
 /**
  * Execute a single CPU instruction
+ * The engine is selected at build time (see CPU_ENGINE in the Makefile)
  */
-void cpu_step() {
+void cpu_step_r(Machine *m) {
+    if (m->cycles >= sched_next(m)) {
+        sched_run_due(m, m->cycles);
+    }
+#ifdef CPU_ENGINE_THREADED
+    // Every instruction takes at least one cycle, so this runs exactly one
+    m->cpu_state.run_limit = m->cycles + 1;
+    if (cpu_run_threaded(m) == CPU_EXIT_KERNAL) {
+        cpu_kernal_call(m, m->cpu_state.trap_address);
+    }
+#else
+    m->cpu_state.run_limit = m->cycles + 1;
+    cpu_step_switch(m);
+#endif
+}
+
+/**
+ * Execute a single CPU instruction using the opcode switch
+ */
+void cpu_step_switch(Machine *m) {
     // Read the opcode
-    uint8_t opcode = memory_read(cpu.pc);
+    uint8_t opcode = memory_read_fast_r(m, m->cpu.pc);
     
     // Get the addressing mode and instruction size
     AddressingMode mode = opcode_modes[opcode];
     uint8_t size = opcode_sizes[opcode];
     
     // Get the operand address based on the addressing mode
-    uint16_t address = cpu_get_operand_address(mode);
+    uint16_t address = cpu_get_operand_address(m, mode);
+    int kernal_call = 0;
     
     // Execute the instruction based on the opcode
     // This is a more expanded implementation with additional opcodes
@@ -374,9 +456,8 @@ void cpu_step() {
         case 0xB9:  // LDA Absolute,Y
         case 0xA1:  // LDA (Indirect,X)
         case 0xB1:  // LDA (Indirect),Y
-            cpu.a = memory_read(address);
-            cpu.z = (cpu.a == 0);
-            cpu.n = (cpu.a & 0x80) != 0;
+            m->cpu.a = memory_read_fast_r(m, address);
+            m->cpu.nz = m->cpu.a;
             break;
             
         // LDX - Load X Register
@@ -385,9 +466,8 @@ void cpu_step() {
         case 0xB6:  // LDX Zero Page,Y
         case 0xAE:  // LDX Absolute
         case 0xBE:  // LDX Absolute,Y
-            cpu.x = memory_read(address);
-            cpu.z = (cpu.x == 0);
-            cpu.n = (cpu.x & 0x80) != 0;
+            m->cpu.x = memory_read_fast_r(m, address);
+            m->cpu.nz = m->cpu.x;
             break;
             
         // LDY - Load Y Register
@@ -396,9 +476,8 @@ void cpu_step() {
         case 0xB4:  // LDY Zero Page,X
         case 0xAC:  // LDY Absolute
         case 0xBC:  // LDY Absolute,X
-            cpu.y = memory_read(address);
-            cpu.z = (cpu.y == 0);
-            cpu.n = (cpu.y & 0x80) != 0;
+            m->cpu.y = memory_read_fast_r(m, address);
+            m->cpu.nz = m->cpu.y;
             break;
             
         // STA - Store Accumulator
@@ -409,27 +488,27 @@ void cpu_step() {
         case 0x99:  // STA Absolute,Y
         case 0x81:  // STA (Indirect,X)
         case 0x91:  // STA (Indirect),Y
-            memory_write(address, cpu.a);
+            memory_write_fast_r(m, address, m->cpu.a);
             break;
             
         // STX - Store X Register
         case 0x86:  // STX Zero Page
         case 0x96:  // STX Zero Page,Y
         case 0x8E:  // STX Absolute
-            memory_write(address, cpu.x);
+            memory_write_fast_r(m, address, m->cpu.x);
             break;
             
         // STY - Store Y Register
         case 0x84:  // STY Zero Page
         case 0x94:  // STY Zero Page,X
         case 0x8C:  // STY Absolute
-            memory_write(address, cpu.y);
+            memory_write_fast_r(m, address, m->cpu.y);
             break;
             
         // JMP - Jump
         case 0x4C:  // JMP Absolute
         case 0x6C:  // JMP Indirect
-            cpu.pc = address;
+            m->cpu.pc = address;
             size = 0;  // Don't increment PC
             break;
             
@@ -438,50 +517,47 @@ void cpu_step() {
             // Check if this is a KERNAL ROM call
             if (address >= 0xFF00) {
                 // This is a KERNAL ROM call, handle it directly
-                cpu_push_word(cpu.pc + 2);  // Push return address
-                cpu_emulate_kernal(address);
+                cpu_push_word(m, m->cpu.pc + 2);  // Push return address
+                cpu_emulate_kernal_r(m, address);
+                kernal_call = address;
                 size = 0;  // Don't increment PC
             } else {
                 // Standard JSR implementation
                 // Push the return address - 1 (PC + 2 - 1 = PC + 1)
-                cpu_push_word(cpu.pc + 2 - 1);
-                cpu.pc = address;
+                cpu_push_word(m, m->cpu.pc + 2 - 1);
+                m->cpu.pc = address;
                 size = 0;  // Don't increment PC
             }
             break;
             
         // RTS - Return from Subroutine
         case 0x60:  // RTS Implied
-            cpu.pc = cpu_pull_word() + 1;
+            m->cpu.pc = cpu_pull_word(m) + 1;
             size = 0;  // Don't increment PC
             break;
             
         // INX - Increment X Register
         case 0xE8:  // INX Implied
-            cpu.x++;
-            cpu.z = (cpu.x == 0);
-            cpu.n = (cpu.x & 0x80) != 0;
+            m->cpu.x++;
+            m->cpu.nz = m->cpu.x;
             break;
             
         // INY - Increment Y Register
         case 0xC8:  // INY Implied
-            cpu.y++;
-            cpu.z = (cpu.y == 0);
-            cpu.n = (cpu.y & 0x80) != 0;
+            m->cpu.y++;
+            m->cpu.nz = m->cpu.y;
             break;
             
         // DEX - Decrement X Register
         case 0xCA:  // DEX Implied
-            cpu.x--;
-            cpu.z = (cpu.x == 0);
-            cpu.n = (cpu.x & 0x80) != 0;
+            m->cpu.x--;
+            m->cpu.nz = m->cpu.x;
             break;
             
         // DEY - Decrement Y Register
         case 0x88:  // DEY Implied
-            cpu.y--;
-            cpu.z = (cpu.y == 0);
-            cpu.n = (cpu.y & 0x80) != 0;
+            m->cpu.y--;
+            m->cpu.nz = m->cpu.y;
             break;
             
         // CMP - Compare Accumulator
@@ -494,143 +570,140 @@ void cpu_step() {
         case 0xC1:  // CMP (Indirect,X)
         case 0xD1:  // CMP (Indirect),Y
             {
-                uint8_t value = memory_read(address);
-                uint8_t result = cpu.a - value;
-                cpu.c = (cpu.a >= value);
-                cpu.z = (result == 0);
-                cpu.n = (result & 0x80) != 0;
+                uint8_t value = memory_read_fast_r(m, address);
+                m->cpu.carry = LAZY_SUB_CARRY(m->cpu.a, value);
+                m->cpu.nz = m->cpu.carry & 0xFF;
             }
             break;
             
         // BEQ - Branch if Equal (Z=1)
         case 0xF0:  // BEQ Relative
-            if (cpu.z) {
-                cpu.pc = address;
+            if (LAZY_Z(m->cpu.nz)) {
+                m->cpu.pc = address;
                 size = 0;  // Don't increment PC
             }
             break;
             
         // BNE - Branch if Not Equal (Z=0)
         case 0xD0:  // BNE Relative
-            if (!cpu.z) {
-                cpu.pc = address;
+            if (!LAZY_Z(m->cpu.nz)) {
+                m->cpu.pc = address;
                 size = 0;  // Don't increment PC
             }
             break;
             
         // BCS - Branch if Carry Set (C=1)
         case 0xB0:  // BCS Relative
-            if (cpu.c) {
-                cpu.pc = address;
+            if (LAZY_C(m->cpu.carry)) {
+                m->cpu.pc = address;
                 size = 0;  // Don't increment PC
             }
             break;
             
         // BCC - Branch if Carry Clear (C=0)
         case 0x90:  // BCC Relative
-            if (!cpu.c) {
-                cpu.pc = address;
+            if (!LAZY_C(m->cpu.carry)) {
+                m->cpu.pc = address;
                 size = 0;  // Don't increment PC
             }
             break;
             
         // BMI - Branch if Minus (N=1)
         case 0x30:  // BMI Relative
-            if (cpu.n) {
-                cpu.pc = address;
+            if (LAZY_N(m->cpu.nz)) {
+                m->cpu.pc = address;
                 size = 0;  // Don't increment PC
             }
             break;
             
         // BPL - Branch if Plus (N=0)
         case 0x10:  // BPL Relative
-            if (!cpu.n) {
-                cpu.pc = address;
+            if (!LAZY_N(m->cpu.nz)) {
+                m->cpu.pc = address;
                 size = 0;  // Don't increment PC
             }
             break;
             
         // BVS - Branch if Overflow Set (V=1)
         case 0x70:  // BVS Relative
-            if (cpu.v) {
-                cpu.pc = address;
+            if (m->cpu.p & STATUS_V) {
+                m->cpu.pc = address;
                 size = 0;  // Don't increment PC
             }
             break;
             
         // BVC - Branch if Overflow Clear (V=0)
         case 0x50:  // BVC Relative
-            if (!cpu.v) {
-                cpu.pc = address;
+            if (!(m->cpu.p & STATUS_V)) {
+                m->cpu.pc = address;
                 size = 0;  // Don't increment PC
             }
             break;
         
         // TAX - Transfer Accumulator to X
         case 0xAA:  // TAX Implied
-            cpu.x = cpu.a;
-            cpu.z = (cpu.x == 0);
-            cpu.n = (cpu.x & 0x80) != 0;
+            m->cpu.x = m->cpu.a;
+            m->cpu.nz = m->cpu.x;
             break;
             
         // TAY - Transfer Accumulator to Y
         case 0xA8:  // TAY Implied
-            cpu.y = cpu.a;
-            cpu.z = (cpu.y == 0);
-            cpu.n = (cpu.y & 0x80) != 0;
+            m->cpu.y = m->cpu.a;
+            m->cpu.nz = m->cpu.y;
             break;
             
         // TXA - Transfer X to Accumulator
         case 0x8A:  // TXA Implied
-            cpu.a = cpu.x;
-            cpu.z = (cpu.a == 0);
-            cpu.n = (cpu.a & 0x80) != 0;
+            m->cpu.a = m->cpu.x;
+            m->cpu.nz = m->cpu.a;
             break;
             
         // TYA - Transfer Y to Accumulator
         case 0x98:  // TYA Implied
-            cpu.a = cpu.y;
-            cpu.z = (cpu.a == 0);
-            cpu.n = (cpu.a & 0x80) != 0;
+            m->cpu.a = m->cpu.y;
+            m->cpu.nz = m->cpu.a;
             break;
             
         // TSX - Transfer Stack Pointer to X
         case 0xBA:  // TSX Implied
-            cpu.x = cpu.sp;
-            cpu.z = (cpu.x == 0);
-            cpu.n = (cpu.x & 0x80) != 0;
+            m->cpu.x = m->cpu.sp;
+            m->cpu.nz = m->cpu.x;
             break;
             
         // TXS - Transfer X to Stack Pointer
         case 0x9A:  // TXS Implied
-            cpu.sp = cpu.x;
+            m->cpu.sp = m->cpu.x;
             break;
             
         default:
             if (opcode == 0x20) {
-                cpu_emulate_kernal(address);
+                cpu_emulate_kernal_r(m, address);
             } else {
-                printf("Unimplemented opcode: $%02X at $%04X\n", opcode, cpu.pc);
+                printf("Unimplemented opcode: $%02X at $%04X\n", opcode, m->cpu.pc);
             }
             break;
     }
     
     // Update the program counter and cycle count
     if (size > 0) {
-        cpu.pc += size;
+        m->cpu.pc += size;
+    }
+    m->cycles += opcode_cycles[opcode];
+    
+    if (kernal_call == 0xFFE4) {
+        cpu_skip_getin_loop(m);
     }
-    cycles += opcode_cycles[opcode];
 }
 
 /**
  * Emulate KERNAL ROM routines
  */
-void cpu_emulate_kernal(uint16_t address) {
+void cpu_emulate_kernal_r(Machine *m, uint16_t address) {
     switch (address) {
         case 0xFFD2:  // CHROUT - Output a character to the current output device
             {
                 // Character is in the accumulator
-                char c = cpu.a;
+                char c = m->cpu.a;
                 // Print the character to the screen
                 printf("%c", c);
                 // In a more advanced implementation, this would update the screen memory
@@ -639,22 +712,13 @@ void cpu_emulate_kernal(uint16_t address) {
             break;
             
         case 0xFFCF:  // CHRIN - Get a character from the current input device
-            {
-                // Simple implementation - just return a dummy character
-                cpu.a = getchar();
-            }
+            // From the terminal, or an input log being replayed
+            m->cpu.a = input_log_chrin_r(m);
             break;
             
         case 0xFFE4:  // GETIN - Check if a key has been pressed
-            {
-                // Simple implementation - just check stdin for a key
-                int c = -1;
-                // Check if there's a character available without blocking
-                if (kbhit()) {  // This would need to be properly implemented
-                    c = getchar();
-                }
-                cpu.a = (c == -1) ? 0 : c;
-            }
+            // Doesn't wait; 0 if no key is waiting
+            m->cpu.a = input_log_getin_r(m);
             break;
             
         default:
@@ -663,40 +727,314 @@ void cpu_emulate_kernal(uint16_t address) {
     }
     
     // Emulate an RTS instruction
-    cpu.pc = cpu_pull_word() + 1;
+    m->cpu.pc = cpu_pull_word(m) + 1;
 }
 
 /**
- * Execute a number of CPU cycles
+ * Fast-forward a GETIN polling loop that found no key
+ *
+ * Called once the JSR $FFE4 has been emulated and its cycles counted. If
+ * the caller is the usual "JSR $FFE4 / BEQ back" loop it would keep
+ * polling an empty keyboard, so every whole pass that fits before
+ * the run limit is skipped instead of calling GETIN again.
  */
-void cpu_execute(uint32_t num_cycles) {
-    uint32_t target_cycles = cycles + num_cycles;
+static void cpu_skip_getin_loop(Machine *m) {
+    // A key arrived, or the BEQ falls through (GETIN doesn't set Z here)
+    if (m->cpu.a != 0 || !LAZY_Z(m->cpu.nz)) {
+        return;
+    }
+    
+    // BEQ back to a JSR $FFE4
+    if (memory_read_r(m, m->cpu.pc) != 0xF0 || memory_read_r(m, m->cpu.pc + 1) != 0xFB ||
+        memory_read_r(m, m->cpu.pc - 3) != 0x20 || memory_read_r(m, m->cpu.pc - 2) != 0xE4 ||
+        memory_read_r(m, m->cpu.pc - 1) != 0xFF) {
+        return;
+    }
+    
+    // Each pass is BEQ (2) + JSR (6); it only stops for the budget before the JSR
+    if (m->cycles + 2 < m->cpu_state.run_limit) {
+        uint64_t passes = (m->cpu_state.run_limit - m->cycles - 2 + 7) / 8;
+        m->cycles += passes * 8;
+        m->cpu_state.idle_cycles += passes * 8;
+    }
+}
+
+/**
+ * Emulate a trapped KERNAL call and skip idle polling around it
+ */
+static void cpu_kernal_call(Machine *m, uint16_t address) {
+    cpu_emulate_kernal_r(m, address);
+    if (address == 0xFFE4) {
+        cpu_skip_getin_loop(m);
+    }
+}
+
+/**
+ * Run the selected engine until the cycle counter reaches the run limit
+ */
+static CpuExitReason cpu_engine_run(Machine *m) {
+    if (m->cpu_state.jit_mode != CPU_JIT_OFF) {
+        return cpu_run_jit(m);
+    }
+#ifdef CPU_ENGINE_THREADED
+    return cpu_run_threaded(m);
+#else
+    // The switch engine emulates KERNAL calls inline
+    while (m->cycles < m->cpu_state.run_limit) {
+        cpu_step_switch(m);
+    }
+    return CPU_EXIT_BUDGET;
+#endif
+}
+
+/**
+ * Deliver latched interrupt requests
+ */
+static void cpu_service_interrupts(Machine *m) {
+    if (m->cpu_state.nmi_pending) {
+        m->cpu_state.nmi_pending = 0;
+        cpu_interrupt_r(m, 1);
+    }
+    if (m->cpu_state.irq_pending && !(m->cpu.p & STATUS_I)) {
+        m->cpu_state.irq_pending = 0;
+        cpu_interrupt_r(m, 0);
+    }
+}
+
+/**
+ * Check whether a breakpoint is set at an address
+ */
+static int cpu_breakpoint_hit(Machine *m, uint16_t address) {
+    return (m->cpu_state.breakpoints[address >> 3] >> (address & 7)) & 1;
+}
+
+/**
+ * Run until target_cycles, servicing KERNAL traps and interrupts
+ * With breakpoints set the engine is entered for one instruction at a
+ * time so PC can be checked between instructions; otherwise the hot loop
+ * only returns for exit events.
+ */
+static CpuExitReason cpu_run_until(Machine *m, uint64_t target_cycles, int check_breakpoints) {
+    int first = 1;
+    
+    while (m->cycles < target_cycles) {
+        if (m->cycles >= sched_next(m)) {
+            sched_run_due(m, m->cycles);
+        }
+        cpu_service_interrupts(m);
+        
+        if (check_breakpoints && m->cpu_state.breakpoint_count > 0) {
+            // Don't stop again on the breakpoint we are resuming from
+            if (!first && cpu_breakpoint_hit(m, m->cpu.pc)) {
+                return CPU_EXIT_BREAKPOINT;
+            }
+            m->cpu_state.run_limit = m->cycles + 1;
+        } else {
+            m->cpu_state.run_limit = target_cycles;
+        }
+        first = 0;
+        
+        // The engine only ever checks one value: stop at the next event
+        if (sched_next(m) < m->cpu_state.run_limit) {
+            m->cpu_state.run_limit = sched_next(m);
+        }
+        
+        if (cpu_engine_run(m) == CPU_EXIT_KERNAL) {
+            cpu_kernal_call(m, m->cpu_state.trap_address);
+        }
+    }
     
-    while (cycles < target_cycles) {
-        cpu_step();
+    return CPU_EXIT_BUDGET;
+}
+
+/**
+ * Execute a number of CPU cycles
+ */
+void cpu_execute_r(Machine *m, uint32_t num_cycles) {
+    cpu_run_until(m, m->cycles + num_cycles, 0);
+}
+
+/**
+ * Run the CPU for a cycle budget, stopping at breakpoints
+ */
+CpuExitReason cpu_run_r(Machine *m, uint32_t budget) {
+    return cpu_run_until(m, m->cycles + budget, 1);
+}
+
+/**
+ * Post an interrupt request for the current cycle
+ * Scheduling it lowers the run limit, so a running engine stops at the
+ * next instruction and the run loop latches and delivers it.
+ */
+void cpu_request_interrupt_r(Machine *m, int is_nmi) {
+    sched_schedule(m, is_nmi ? m->cpu_state.nmi_event : m->cpu_state.irq_event, m->cycles);
+}
+
+/**
+ * Set a breakpoint at an address
+ */
+void cpu_set_breakpoint_r(Machine *m, uint16_t address) {
+    if (!cpu_breakpoint_hit(m, address)) {
+        m->cpu_state.breakpoints[address >> 3] |= 1 << (address & 7);
+        m->cpu_state.breakpoint_count++;
     }
 }
 
+/**
+ * Remove all breakpoints
+ */
+void cpu_clear_breakpoints_r(Machine *m) {
+    memset(m->cpu_state.breakpoints, 0, sizeof(m->cpu_state.breakpoints));
+    m->cpu_state.breakpoint_count = 0;
+}
+
+/**
+ * Print execution statistics
+ */
+void cpu_print_stats_r(Machine *m) {
+    printf("Cycles: %llu\n", (unsigned long long)m->cycles);
+    printf("Idle cycles skipped: %llu\n", (unsigned long long)m->cpu_state.idle_cycles);
+#ifdef CPU_ENGINE_THREADED
+    cpu_fusion_print_stats(m);
+#else
+    printf("Superinstructions are only used by the threaded engine\n");
+#endif
+}
+
 /**
  * Print the current CPU state for debugging
  */
-void cpu_print_state() {
+void cpu_print_state_r(Machine *m) {
     printf("CPU State:\n");
     printf("A: $%02X X: $%02X Y: $%02X SP: $%02X PC: $%04X\n", 
-           cpu.a, cpu.x, cpu.y, cpu.sp, cpu.pc);
+           m->cpu.a, m->cpu.x, m->cpu.y, m->cpu.sp, m->cpu.pc);
+    uint8_t status = cpu_get_status_r(m);
     printf("Flags: %c%c%c%c%c%c%c\n",
-           cpu.n ? 'N' : '.', 
-           cpu.v ? 'V' : '.', 
-           cpu.b ? 'B' : '.', 
-           cpu.d ? 'D' : '.', 
-           cpu.i ? 'I' : '.', 
-           cpu.z ? 'Z' : '.', 
-           cpu.c ? 'C' : '.');
+           (status & STATUS_N) ? 'N' : '.', 
+           (status & STATUS_V) ? 'V' : '.', 
+           (status & STATUS_B) ? 'B' : '.', 
+           (status & STATUS_D) ? 'D' : '.', 
+           (status & STATUS_I) ? 'I' : '.', 
+           (status & STATUS_Z) ? 'Z' : '.', 
+           (status & STATUS_C) ? 'C' : '.');
 }
 
 /**
  * Set the CPU program counter
  */
+void cpu_set_pc_r(Machine *m, uint16_t address) {
+    m->cpu.pc = address;
+}
+
+/**
+ * Get the number of cycles executed since reset
+ */
+uint64_t cpu_get_cycles_r(Machine *m) {
+    return m->cycles;
+}
+
+/**
+ * Get the number of cycles skipped in idle loops
+ */
+uint64_t cpu_get_idle_cycles_r(Machine *m) {
+    return m->cpu_state.idle_cycles;
+}
+
+/**
+ * Get the CPU program counter
+ */
+uint16_t cpu_get_pc_r(Machine *m) {
+    return m->cpu.pc;
+}
+
+/* ------------------------------------------------------------------ */
+/* Single-machine API                                                 */
+/* ------------------------------------------------------------------ */
+
+void cpu_init() {
+    cpu_init_r(machine_default());
+}
+
+uint8_t cpu_get_status() {
+    return cpu_get_status_r(machine_default());
+}
+
+void cpu_set_status(uint8_t status) {
+    cpu_set_status_r(machine_default(), status);
+}
+
+void cpu_get_state(CPU *state) {
+    cpu_get_state_r(machine_default(), state);
+}
+
+void cpu_set_state(const CPU *state) {
+    cpu_set_state_r(machine_default(), state);
+}
+
+void cpu_step() {
+    cpu_step_r(machine_default());
+}
+
+void cpu_execute(uint32_t num_cycles) {
+    cpu_execute_r(machine_default(), num_cycles);
+}
+
+CpuExitReason cpu_run(uint32_t budget) {
+    return cpu_run_r(machine_default(), budget);
+}
+
+void cpu_request_interrupt(int is_nmi) {
+    cpu_request_interrupt_r(machine_default(), is_nmi);
+}
+
+void cpu_set_breakpoint(uint16_t address) {
+    cpu_set_breakpoint_r(machine_default(), address);
+}
+
+void cpu_clear_breakpoints() {
+    cpu_clear_breakpoints_r(machine_default());
+}
+
+void cpu_print_stats() {
+    cpu_print_stats_r(machine_default());
+}
+
+int cpu_jit_set_mode(CpuJitMode mode) {
+    return cpu_jit_set_mode_r(machine_default(), mode);
+}
+
+void cpu_jit_print_stats() {
+    cpu_jit_print_stats_r(machine_default());
+}
+
+uint16_t cpu_get_pc() {
+    return cpu_get_pc_r(machine_default());
+}
+
+uint64_t cpu_get_cycles() {
+    return cpu_get_cycles_r(machine_default());
+}
+
+uint64_t cpu_get_idle_cycles() {
+    return cpu_get_idle_cycles_r(machine_default());
+}
+
+void cpu_interrupt(int is_nmi) {
+    cpu_interrupt_r(machine_default(), is_nmi);
+}
+
+void cpu_reset() {
+    cpu_reset_r(machine_default());
+}
+
+void cpu_print_state() {
+    cpu_print_state_r(machine_default());
+}
+
 void cpu_set_pc(uint16_t address) {
-    cpu.pc = address;
-}
\ No newline at end of file
+    cpu_set_pc_r(machine_default(), address);
+}
+
+void cpu_emulate_kernal(uint16_t address) {
+    cpu_emulate_kernal_r(machine_default(), address);
+}
@@ -31,7 +31,12 @@
  * - Accumulator (A): 8-bit general purpose register for arithmetic and logic operations
  * - X, Y: 8-bit index registers for addressing and counting
  * - Stack Pointer (SP): 8-bit offset from $0100, grows downward (0xFF to 0x00)
- * - Status Register (P): Individual status flags for CPU state
+ * - Status Register (P): I, D, B and V are stored as bits; N, Z and C are
+ *   evaluated lazily from the last result that affected them
+ * 
+ * Loads, transfers, increments and compares only record their result, so
+ * the flags are built when a branch, an interrupt, cpu_get_status() or
+ * cpu_print_state() actually needs them.
  */
 typedef struct {
     uint16_t pc;    // Program Counter
@@ -41,74 +46,258 @@ typedef struct {
     uint8_t sp;     // Stack Pointer
     
     // Status Register (P) flags
-    uint8_t c;      // Carry Flag (bit 0) - Set if operation resulted in carry or borrow
-    uint8_t z;      // Zero Flag (bit 1) - Set if result is zero
-    uint8_t i;      // Interrupt Disable (bit 2) - Set to disable IRQ interrupts
-    uint8_t d;      // Decimal Mode (bit 3) - Set for BCD arithmetic (not used in C64)
-    uint8_t b;      // Break Command (bit 4) - Set when BRK instruction executed
-    uint8_t v;      // Overflow Flag (bit 6) - Set on arithmetic overflow
-    uint8_t n;      // Negative Flag (bit 7) - Set if result is negative (bit 7 is set)
+    uint8_t p;      // I, D, B and V bits in their P positions (N, Z, C are lazy)
+    uint16_t nz;    // Last N/Z result: Z if the low byte is 0, N if bit 7 or bit 8 is set
+    uint16_t carry; // Last carry result: C is bit 8
 } CPU;
 
+/**
+ * Status register (P) bit positions
+ */
+#define STATUS_C 0x01  // Carry (bit 0)
+#define STATUS_Z 0x02  // Zero (bit 1)
+#define STATUS_I 0x04  // Interrupt Disable (bit 2)
+#define STATUS_D 0x08  // Decimal Mode (bit 3)
+#define STATUS_B 0x10  // Break Command (bit 4)
+#define STATUS_U 0x20  // Unused (bit 5), always reads as 1
+#define STATUS_V 0x40  // Overflow (bit 6)
+#define STATUS_N 0x80  // Negative (bit 7)
+
+/**
+ * Reasons for the run loop to stop
+ */
+typedef enum {
+    CPU_EXIT_BUDGET,      // The cycle budget has been used up
+    CPU_EXIT_BREAKPOINT,  // PC reached an address set with cpu_set_breakpoint()
+    CPU_EXIT_KERNAL,      // A JSR into the KERNAL needs emulating (handled by cpu_run)
+    CPU_EXIT_INTERRUPT    // An interrupt request is pending (handled by cpu_run)
+} CpuExitReason;
+
+/**
+ * JIT modes (see cpu_jit_set_mode())
+ */
+typedef enum {
+    CPU_JIT_OFF,    // Interpret only
+    CPU_JIT_ON,     // Run compiled blocks
+    CPU_JIT_CHECK   // Run compiled blocks in lockstep with the interpreter
+} CpuJitMode;
+
+// Emulator instance (see src/machine/machine.h)
+typedef struct Machine Machine;
+
+#define CPU_MAX_FUSIONS 16  // Room for the threaded engine's superinstruction counters
+
+/**
+ * Run loop state of one CPU
+ * Kept in the Machine next to the registers; only the CPU module uses it.
+ */
+typedef struct {
+    uint64_t run_limit;           // Cycle at which the engine must return (see cpu_internal.h)
+    uint16_t trap_address;        // Target of the JSR that caused a CPU_EXIT_KERNAL exit
+    uint64_t idle_cycles;         // Cycles fast-forwarded by idle loop detection
+    
+    // Run loop exit events
+    uint8_t breakpoints[0x10000 / 8];  // One bit per address
+    int breakpoint_count;
+    int irq_pending;
+    int nmi_pending;
+    int irq_event;                // Scheduler events that latch the requests above
+    int nmi_event;
+    
+    // Threaded engine: decoded instructions per page, allocated on first use
+    struct DecodedOp *decode_pages[256];
+    uint32_t decode_generation;   // Bumped whenever decoded entries are dropped
+    uint64_t fusion_runs[CPU_MAX_FUSIONS];
+    uint64_t fusion_instructions[CPU_MAX_FUSIONS];
+    
+    // JIT mode and compiled code (allocated when the JIT is first enabled)
+    CpuJitMode jit_mode;
+    struct JitState *jit;
+} CpuState;
+
 /**
  * Initialize the CPU
  * Sets up initial register values and prepares lookup tables for opcodes
  */
-void cpu_init();
+void cpu_init_r(Machine *m);
+
+/**
+ * Free the CPU's decode cache and compiled code
+ * The CPU can be used again afterwards; the caches are rebuilt on demand.
+ */
+void cpu_release_r(Machine *m);
 
 /**
  * Get the current CPU status register as a single byte
  * @return Byte representing all status flag bits combined
  */
-uint8_t cpu_get_status();
+uint8_t cpu_get_status_r(Machine *m);
 
 /**
  * Set the CPU status register from a single byte
  * @param status Byte containing all status flag bits
  */
-void cpu_set_status(uint8_t status);
+void cpu_set_status_r(Machine *m, uint8_t status);
+
+/**
+ * Copy the CPU registers
+ * @param state Receives the current register values
+ */
+void cpu_get_state_r(Machine *m, CPU *state);
+
+/**
+ * Replace the CPU registers
+ * @param state Register values to load
+ */
+void cpu_set_state_r(Machine *m, const CPU *state);
 
 /**
  * Execute a single CPU instruction
  * Reads the opcode at the current PC, processes it, and updates CPU state
  */
-void cpu_step();
+void cpu_step_r(Machine *m);
 
 /**
  * Execute multiple CPU instructions
  * @param cycles Approximate number of cycles to execute
  */
-void cpu_execute(uint32_t cycles);
+void cpu_execute_r(Machine *m, uint32_t cycles);
+
+/**
+ * Run the CPU for a cycle budget
+ * Registers are kept in host locals for the whole run and written back
+ * only when the run loop exits. KERNAL calls and pending interrupts are
+ * serviced between runs of the hot loop without returning to the caller.
+ * 
+ * @param budget Number of cycles to run
+ * @return CPU_EXIT_BUDGET when the budget is used up, or
+ *         CPU_EXIT_BREAKPOINT when PC reached a breakpoint
+ */
+CpuExitReason cpu_run_r(Machine *m, uint32_t budget);
+
+/**
+ * Request an interrupt from outside the run loop
+ * The request is posted as a scheduler event for the current cycle and
+ * delivered by cpu_run() at the next instruction boundary; an IRQ stays
+ * pending while interrupts are disabled.
+ * @param is_nmi If non-zero, request a non-maskable interrupt (NMI)
+ */
+void cpu_request_interrupt_r(Machine *m, int is_nmi);
+
+/**
+ * Set a breakpoint
+ * cpu_run() stops before executing the instruction at this address
+ * @param address The 16-bit address to stop at
+ */
+void cpu_set_breakpoint_r(Machine *m, uint16_t address);
+
+/**
+ * Remove all breakpoints
+ */
+void cpu_clear_breakpoints_r(Machine *m);
+
+/**
+ * Print execution statistics
+ * Shows the cycle counter and how often each superinstruction (fused
+ * instruction sequence) of the threaded engine ran.
+ */
+void cpu_print_stats_r(Machine *m);
+
+/**
+ * Select the JIT mode
+ * The JIT translates 6510 basic blocks into x86-64 code and is only
+ * available when built with "make JIT=1" on an x86-64 host. In check mode
+ * every block is verified against the interpreter; on a mismatch both
+ * results are printed and the JIT switches itself off.
+ * 
+ * @param mode CPU_JIT_OFF, CPU_JIT_ON or CPU_JIT_CHECK
+ * @return 1 on success, 0 if the JIT is not available
+ */
+int cpu_jit_set_mode_r(Machine *m, CpuJitMode mode);
+
+/**
+ * Print JIT statistics (blocks compiled, block runs, chained exits, ...)
+ */
+void cpu_jit_print_stats_r(Machine *m);
+
+/**
+ * Get the current program counter
+ * @return The 16-bit program counter
+ */
+uint16_t cpu_get_pc_r(Machine *m);
+
+/**
+ * Get the cycle counter
+ * Counts CPU cycles since the last reset; devices use it as the time base
+ * for scheduler events (see src/sched/sched.h).
+ * @return Cycles executed since reset
+ */
+uint64_t cpu_get_cycles_r(Machine *m);
+
+/**
+ * Get the number of cycles skipped by idle loop detection
+ * Grows whenever the CPU is found waiting in a loop that can only end
+ * when something outside the CPU changes.
+ * @return Idle cycles skipped since the machine was created
+ */
+uint64_t cpu_get_idle_cycles_r(Machine *m);
 
 /**
  * Trigger an interrupt (IRQ or NMI)
  * @param is_nmi If non-zero, this is a non-maskable interrupt (NMI)
  */
-void cpu_interrupt(int is_nmi);
+void cpu_interrupt_r(Machine *m, int is_nmi);
 
 /**
  * Reset the CPU
  * Sets the PC to the address in the reset vector and initializes registers
  */
-void cpu_reset();
+void cpu_reset_r(Machine *m);
 
 /**
  * Print the current CPU state for debugging
  * Displays all registers and flags
  */
-void cpu_print_state();
+void cpu_print_state_r(Machine *m);
 
 /**
  * Set the program counter to a specific address
  * @param address The 16-bit address to set PC to
  */
-void cpu_set_pc(uint16_t address);
+void cpu_set_pc_r(Machine *m, uint16_t address);
 
 /**
  * Emulate KERNAL ROM functions
  * This provides implementations for key C64 KERNAL routines
  * @param address The address of the KERNAL function to emulate
  */
+void cpu_emulate_kernal_r(Machine *m, uint16_t address);
+
+/*
+ * Single-machine API
+ * Each function below calls its _r variant with machine_default().
+ */
+void cpu_init();
+uint8_t cpu_get_status();
+void cpu_set_status(uint8_t status);
+void cpu_get_state(CPU *state);
+void cpu_set_state(const CPU *state);
+void cpu_step();
+void cpu_execute(uint32_t cycles);
+CpuExitReason cpu_run(uint32_t budget);
+void cpu_request_interrupt(int is_nmi);
+void cpu_set_breakpoint(uint16_t address);
+void cpu_clear_breakpoints();
+void cpu_print_stats();
+int cpu_jit_set_mode(CpuJitMode mode);
+void cpu_jit_print_stats();
+uint16_t cpu_get_pc();
+uint64_t cpu_get_cycles();
+uint64_t cpu_get_idle_cycles();
+void cpu_interrupt(int is_nmi);
+void cpu_reset();
+void cpu_print_state();
+void cpu_set_pc(uint16_t address);
 void cpu_emulate_kernal(uint16_t address);
 
 /**
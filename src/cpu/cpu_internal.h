@@ -0,0 +1,91 @@
+/**
+ * cpu_internal.h
+ * State and helpers shared between the CPU execution engines
+ *
+ * Not part of the public CPU interface; only files in src/cpu/ include this.
+ */
+
+#ifndef CPU_INTERNAL_H
+#define CPU_INTERNAL_H
+
+#include "cpu.h"
+#include "../machine/machine.h"
+
+// Opcode tables (built once, by the first cpu_init_r())
+extern uint8_t opcode_sizes[256];
+extern uint8_t opcode_cycles[256];
+extern AddressingMode opcode_modes[256];
+
+// Lazy flag evaluation (see the CPU structure in cpu.h)
+#define LAZY_Z(nz)       ((((nz) & 0xFF) == 0) ? 1 : 0)
+#define LAZY_N(nz)       (((((nz) | ((nz) >> 1)) & 0x80) != 0) ? 1 : 0)
+#define LAZY_C(carry)    (((carry) >> 8) & 1)
+
+// Carry result of A - M as the 6502 computes it (A + ~M + 1): bit 8 set if A >= M
+#define LAZY_SUB_CARRY(a, m) ((uint16_t)((a) + ((m) ^ 0xFF) + 1))
+
+// m->cpu_state.run_limit is the absolute cycle count at which the engine
+// must return to cpu.c: the earlier of the budget end and the next
+// scheduler event. It is lowered when an earlier event is scheduled, so a
+// running engine stops in time.
+
+/**
+ * Execute a single instruction with the original opcode switch
+ */
+void cpu_step_switch(Machine *m);
+
+/**
+ * Build the threaded engine's dispatch tables (called once by cpu.c)
+ */
+void cpu_threaded_init();
+
+/**
+ * Run the threaded engine until m->cycles reaches the run limit
+ * A JSR into the KERNAL trap area pushes the return address, stops the
+ * engine and returns CPU_EXIT_KERNAL; the caller emulates the routine.
+ * @return CPU_EXIT_BUDGET or CPU_EXIT_KERNAL
+ */
+CpuExitReason cpu_run_threaded(Machine *m);
+
+/**
+ * Drop the predecoded instructions of a page
+ * Called from the memory code hook; page -1 drops every page.
+ * @param page Page that was written, or -1
+ */
+void cpu_decode_invalidate(Machine *m, int page);
+
+/**
+ * Drop all predecoded instructions
+ */
+void cpu_decode_flush(Machine *m);
+
+/**
+ * Free the decoded instruction pages
+ */
+void cpu_decode_release(Machine *m);
+
+/**
+ * Print superinstruction counters (threaded engine)
+ */
+void cpu_fusion_print_stats(Machine *m);
+
+/**
+ * Run compiled blocks until m->cycles reaches the run limit
+ * Anything that can't be compiled is interpreted one instruction at a
+ * time with cpu_step_switch(), which also emulates KERNAL calls.
+ * @return CPU_EXIT_BUDGET
+ */
+CpuExitReason cpu_run_jit(Machine *m);
+
+/**
+ * Drop compiled blocks when guest code changes
+ * @param page Page that was written, or -1 for a banking change
+ */
+void cpu_jit_invalidate(Machine *m, int page);
+
+/**
+ * Free the JIT's code buffer and block tables
+ */
+void cpu_jit_release(Machine *m);
+
+#endif /* CPU_INTERNAL_H */
@@ -0,0 +1,985 @@
+/**
+ * cpu_jit.c
+ * Dynamic binary translator from 6510 basic blocks to x86-64 host code
+ *
+ * A block is a run of implemented instructions starting at some PC and
+ * ending at the first branch, jump, JSR or RTS (or after JIT_MAX_BLOCK_INSNS
+ * instructions). Blocks are compiled on first execution into an executable
+ * mmap'd buffer and called through a small entry trampoline:
+ *
+ *   rbx - &m->cpu        guest registers stay in the CPU structure
+ *   r12 - &m->cycles
+ *   r13 - &m->cpu_state.run_limit
+ *
+ * Memory is accessed through calls to small helpers around memory_read_r()
+ * and memory_write_r(), so banking behaves exactly as in the interpreter.
+ * Exits to a known address go through a jmp that is patched to chain
+ * straight into the target block once that block has been compiled.
+ *
+ * The interpreter (cpu_step_switch()) still runs anything a block can't
+ * hold: unimplemented opcodes, KERNAL calls, absolute accesses to the I/O
+ * area and code on pages that keep being written to. Indexed and indirect
+ * accesses may still reach I/O registers at run time.
+ *
+ * Cycle budgets: every block starts with a guard that only enters it if
+ * the interpreter would also have executed every instruction in it, i.e.
+ * cycles plus all but the last instruction's cycles is below the run limit.
+ * Otherwise the dispatcher single-steps, so cpu_execute() stops on exactly
+ * the same instruction with either path.
+ *
+ * Each machine has its own code buffer and block tables (a JitState,
+ * allocated when the JIT is first enabled). The public functions point
+ * the thread-local jit and jit_machine at the machine they were called
+ * for, which is how the helpers called from generated code find it.
+ *
+ * Only built with "make JIT=1" on x86-64; otherwise the public functions
+ * report that the JIT is unavailable.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu_internal.h"
+#include "../memory/memory.h"
+#include "../machine/snapshot.h"
+
+#if defined(CPU_JIT) && defined(__x86_64__)
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define JIT_BUFFER_SIZE     (4 * 1024 * 1024)  // Executable code buffer
+#define JIT_MAX_BLOCKS      16384              // Blocks before the cache is flushed
+#define JIT_MAX_BLOCK_INSNS 32                 // Instructions per block
+#define JIT_MAX_INSN_BYTES  96                 // Worst case host code per instruction
+#define JIT_SMC_LIMIT       8                  // Invalidations before a page is interpreted
+
+/**
+ * A compiled block
+ */
+typedef struct {
+    uint8_t *code;     // Entry point (starts with the budget guard)
+    uint16_t start;    // Guest address of the first instruction
+    uint16_t guard;    // Cycles of all but the last instruction
+} JitBlock;
+
+/**
+ * An instruction found while scanning a block
+ */
+typedef struct {
+    uint16_t address;
+    uint8_t opcode;
+    uint16_t operand;
+} JitInsn;
+
+typedef uint32_t (*JitEntry)(CPU *state, uint64_t *cycle_counter, uint64_t *limit, const uint8_t *code);
+
+/**
+ * Compiled code and block tables of one machine
+ */
+typedef struct JitState {
+    uint8_t *buffer;
+    uint8_t *pos;                  // Next free byte in the buffer
+    uint8_t *epilogue;             // Restores host registers and returns
+    uint8_t *code_start;           // First byte after the trampolines
+    JitEntry entry;
+
+    JitBlock blocks[JIT_MAX_BLOCKS];
+    int block_count;
+    JitBlock no_block;             // Marks addresses that can't start a block
+    JitBlock **map[256];           // Block per guest address, one array per page
+
+    uint8_t code_pages[256];       // Pages holding compiled guest code
+    uint8_t page_writes[256];      // Times each page's blocks were invalidated
+    uint32_t generation;           // Bumped on every flush
+    int flushed;                   // Set when a flush happens inside a block
+    uint64_t entry_limit;          // Run limit when the block was entered
+
+    // Memory images compared by check mode
+    uint8_t before[MEMORY_STATE_SIZE];
+    uint8_t after[MEMORY_STATE_SIZE];
+    MachineSnapshot *devices;      // Devices and schedule before a checked block
+
+    // Counters for "jit stats"
+    uint32_t compiled;
+    uint32_t flushes;
+    uint64_t block_runs;
+    uint64_t interpreted;
+    uint32_t chains;
+} JitState;
+
+// Machine the current thread is compiling or running blocks for
+static _Thread_local Machine *jit_machine;
+static _Thread_local JitState *jit;
+
+// Offsets of the guest registers from rbx
+#define OFF_PC    offsetof(CPU, pc)
+#define OFF_A     offsetof(CPU, a)
+#define OFF_X     offsetof(CPU, x)
+#define OFF_Y     offsetof(CPU, y)
+#define OFF_SP    offsetof(CPU, sp)
+#define OFF_P     offsetof(CPU, p)
+#define OFF_NZ    offsetof(CPU, nz)
+#define OFF_CARRY offsetof(CPU, carry)
+
+// x86-64 register numbers used in ModRM bytes
+#define HOST_EAX 0
+#define HOST_ECX 1
+#define HOST_ESI 6
+#define HOST_EDI 7
+
+/* ------------------------------------------------------------------ */
+/* Helpers called from generated code                                 */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Non-zero when the block has to stop after a write: the write dropped
+ * compiled code, or it caused an interrupt request
+ */
+static inline int jit_must_exit() {
+    return jit->flushed || jit_machine->cpu_state.run_limit != jit->entry_limit;
+}
+
+static uint8_t jit_read(uint16_t address) {
+    return memory_read_r(jit_machine, address);
+}
+
+static uint32_t jit_write(uint16_t address, uint8_t value) {
+    memory_write_r(jit_machine, address, value);
+    return jit_must_exit();
+}
+
+static uint32_t jit_push16(uint16_t value) {
+    Machine *m = jit_machine;
+    memory_write_r(m, STACK_PAGE + m->cpu.sp, value >> 8);
+    m->cpu.sp--;
+    memory_write_r(m, STACK_PAGE + m->cpu.sp, value & 0xFF);
+    m->cpu.sp--;
+    return jit_must_exit();
+}
+
+static uint16_t jit_pull16() {
+    Machine *m = jit_machine;
+    uint8_t low, high;
+    m->cpu.sp++;
+    low = memory_read_r(m, STACK_PAGE + m->cpu.sp);
+    m->cpu.sp++;
+    high = memory_read_r(m, STACK_PAGE + m->cpu.sp);
+    return (high << 8) | low;
+}
+
+static uint16_t jit_ea_indirect(uint16_t ptr) {
+    uint16_t high = (ptr & 0xFF) == 0xFF ? (ptr & 0xFF00) : (uint16_t)(ptr + 1);
+    return jit_read(ptr) | (jit_read(high) << 8);
+}
+
+static uint16_t jit_ea_indexed_indirect(uint8_t operand) {
+    uint8_t zp = (operand + jit_machine->cpu.x) & 0xFF;
+    return jit_read(zp) | (jit_read((zp + 1) & 0xFF) << 8);
+}
+
+static uint16_t jit_ea_indirect_indexed(uint8_t zp) {
+    return (uint16_t)((jit_read(zp) | (jit_read((zp + 1) & 0xFF) << 8)) + jit_machine->cpu.y);
+}
+
+/* ------------------------------------------------------------------ */
+/* Code emission                                                      */
+/* ------------------------------------------------------------------ */
+
+static void emit8(uint8_t value) {
+    *jit->pos++ = value;
+}
+
+static void emit16(uint16_t value) {
+    memcpy(jit->pos, &value, 2);
+    jit->pos += 2;
+}
+
+static void emit32(uint32_t value) {
+    memcpy(jit->pos, &value, 4);
+    jit->pos += 4;
+}
+
+static void emit64(uint64_t value) {
+    memcpy(jit->pos, &value, 8);
+    jit->pos += 8;
+}
+
+// jmp rel32 / jcc rel32 to an address already known
+static void emit_jump_to(uint8_t *target) {
+    emit8(0xE9);
+    emit32((uint32_t)(target - (jit->pos + 4)));
+}
+
+// movzx reg, byte [rbx+offset]
+static void emit_load_guest8(int reg, uint8_t offset) {
+    emit8(0x0F); emit8(0xB6); emit8(0x43 | (reg << 3)); emit8(offset);
+}
+
+// mov [rbx+offset], al
+static void emit_store_guest8(uint8_t offset) {
+    emit8(0x88); emit8(0x43); emit8(offset);
+}
+
+// mov [rbx+nz], ax (eax holds the zero-extended result)
+static void emit_store_nz() {
+    emit8(0x66); emit8(0x89); emit8(0x43); emit8(OFF_NZ);
+}
+
+// mov word [rbx+offset], imm16
+static void emit_store_guest16_imm(uint8_t offset, uint16_t value) {
+    emit8(0x66); emit8(0xC7); emit8(0x43); emit8(offset); emit16(value);
+}
+
+// mov edi, imm32
+static void emit_mov_edi(uint32_t value) {
+    emit8(0xBF); emit32(value);
+}
+
+// mov rax, function; call rax
+static void emit_call(void *function) {
+    emit8(0x48); emit8(0xB8); emit64((uint64_t)(uintptr_t)function);
+    emit8(0xFF); emit8(0xD0);
+}
+
+// add qword [r12], imm32
+static void emit_add_cycles(uint32_t count) {
+    emit8(0x49); emit8(0x81); emit8(0x04); emit8(0x24); emit32(count);
+}
+
+// Cycles are added in batches; flush before anything that can observe them
+static void emit_flush_cycles(uint32_t *pending) {
+    if (*pending) {
+        emit_add_cycles(*pending);
+        *pending = 0;
+    }
+}
+
+// Leave the block with PC already stored: xor eax, eax; jmp epilogue
+static void emit_exit_dynamic() {
+    emit8(0x31); emit8(0xC0);
+    emit_jump_to(jit->epilogue);
+}
+
+/**
+ * Leave the block for a known address
+ * The leading jmp falls through to the exit stub until the dispatcher
+ * patches it to jump into the compiled target block.
+ */
+static void emit_exit_chained(uint16_t target) {
+    uint8_t *site = jit->pos;
+    emit8(0xE9); emit32(0);
+    emit_store_guest16_imm(OFF_PC, target);
+    emit8(0xB8); emit32((uint32_t)(site - jit->buffer) + 1);
+    emit_jump_to(jit->epilogue);
+}
+
+// After a write helper: if eax != 0, finish this instruction and return
+static void emit_exit_if_stopped(uint32_t instruction_cycles, uint16_t next_pc) {
+    emit8(0x85); emit8(0xC0);                 // test eax, eax
+    emit8(0x74); emit8(instruction_cycles ? 21 : 13);  // jz over the exit
+    if (instruction_cycles) {
+        emit_add_cycles(instruction_cycles);  // 8 bytes
+    }
+    emit_store_guest16_imm(OFF_PC, next_pc);  // 6 bytes
+    emit_exit_dynamic();                      // 7 bytes
+}
+
+/**
+ * Compute the effective address of an instruction into edi
+ */
+static void emit_effective_address(AddressingMode mode, uint16_t operand) {
+    switch (mode) {
+        case ADDR_ZERO_PAGE:
+        case ADDR_ABSOLUTE:
+            emit_mov_edi(operand);
+            break;
+
+        case ADDR_ZERO_PAGE_X:
+        case ADDR_ZERO_PAGE_Y:
+            emit_load_guest8(HOST_EDI, mode == ADDR_ZERO_PAGE_X ? OFF_X : OFF_Y);
+            emit8(0x81); emit8(0xC7); emit32(operand);        // add edi, imm32
+            emit8(0x40); emit8(0x0F); emit8(0xB6); emit8(0xFF);  // movzx edi, dil
+            break;
+
+        case ADDR_ABSOLUTE_X:
+        case ADDR_ABSOLUTE_Y:
+            emit_load_guest8(HOST_EDI, mode == ADDR_ABSOLUTE_X ? OFF_X : OFF_Y);
+            emit8(0x81); emit8(0xC7); emit32(operand);        // add edi, imm32
+            emit8(0x0F); emit8(0xB7); emit8(0xFF);            // movzx edi, di
+            break;
+
+        case ADDR_INDEXED_INDIRECT:
+        case ADDR_INDIRECT_INDEXED:
+            emit_mov_edi(operand);
+            emit_call(mode == ADDR_INDEXED_INDIRECT ? (void *)jit_ea_indexed_indirect
+                                                    : (void *)jit_ea_indirect_indexed);
+            emit8(0x0F); emit8(0xB7); emit8(0xF8);            // movzx edi, ax
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Read the byte at edi into eax
+static void emit_read() {
+    emit_call((void *)jit_read);
+    emit8(0x0F); emit8(0xB6); emit8(0xC0);                    // movzx eax, al
+}
+
+/* ------------------------------------------------------------------ */
+/* Block compilation                                                  */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Guest register an opcode loads, stores or transfers to (offset from rbx)
+ */
+static int jit_load_register(uint8_t opcode) {
+    switch (opcode) {
+        case 0xA9: case 0xA5: case 0xB5: case 0xAD: case 0xBD: case 0xB9: case 0xA1: case 0xB1:
+            return OFF_A;
+        case 0xA2: case 0xA6: case 0xB6: case 0xAE: case 0xBE:
+            return OFF_X;
+        case 0xA0: case 0xA4: case 0xB4: case 0xAC: case 0xBC:
+            return OFF_Y;
+    }
+    return -1;
+}
+
+static int jit_store_register(uint8_t opcode) {
+    switch (opcode) {
+        case 0x85: case 0x95: case 0x8D: case 0x9D: case 0x99: case 0x81: case 0x91:
+            return OFF_A;
+        case 0x86: case 0x96: case 0x8E:
+            return OFF_X;
+        case 0x84: case 0x94: case 0x8C:
+            return OFF_Y;
+    }
+    return -1;
+}
+
+static int jit_is_compare(uint8_t opcode) {
+    switch (opcode) {
+        case 0xC9: case 0xC5: case 0xD5: case 0xCD: case 0xDD: case 0xD9: case 0xC1: case 0xD1:
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Check whether an instruction can go in a block, and whether it ends one
+ * @return 0 if it can't be compiled, 1 if the block continues, 2 if it ends here
+ */
+static int jit_classify(const JitInsn *insn) {
+    AddressingMode mode = opcode_modes[insn->opcode];
+
+    // Absolute accesses that may reach the I/O area stay in the interpreter
+    if (jit_load_register(insn->opcode) >= 0 || jit_store_register(insn->opcode) >= 0 ||
+        jit_is_compare(insn->opcode)) {
+        if (mode == ADDR_ABSOLUTE && insn->operand >= IO_REGION_START && insn->operand <= IO_REGION_END) {
+            return 0;
+        }
+        if ((mode == ADDR_ABSOLUTE_X || mode == ADDR_ABSOLUTE_Y) &&
+            insn->operand + 0xFF >= IO_REGION_START && insn->operand <= IO_REGION_END) {
+            return 0;
+        }
+        return 1;
+    }
+
+    switch (insn->opcode) {
+        case 0xE8: case 0xC8: case 0xCA: case 0x88:                         // INX INY DEX DEY
+        case 0xAA: case 0xA8: case 0x8A: case 0x98: case 0xBA: case 0x9A:   // Transfers
+            return 1;
+        case 0xF0: case 0xD0: case 0xB0: case 0x90:                         // Branches
+        case 0x30: case 0x10: case 0x70: case 0x50:
+        case 0x4C: case 0x6C: case 0x60:                                    // JMP, RTS
+            return 2;
+        case 0x20:                                                          // JSR
+            return insn->operand >= 0xFF00 ? 0 : 2;
+    }
+    return 0;
+}
+
+/**
+ * Check whether code on a page may be compiled
+ */
+static int jit_page_compilable(uint8_t page) {
+    if (page >= (IO_REGION_START >> 8) && page <= (IO_REGION_END >> 8)) {
+        return 0;
+    }
+    return jit->page_writes[page] < JIT_SMC_LIMIT;
+}
+
+/**
+ * Emit one instruction
+ */
+static void jit_emit_insn(const JitInsn *insn, uint32_t *pending) {
+    uint8_t opcode = insn->opcode;
+    AddressingMode mode = opcode_modes[opcode];
+    uint8_t cost = opcode_cycles[opcode];
+    uint16_t next = insn->address + opcode_sizes[opcode];
+    int reg;
+
+    if ((reg = jit_load_register(opcode)) >= 0) {
+        if (mode == ADDR_IMMEDIATE) {
+            emit8(0xC6); emit8(0x43); emit8(reg); emit8(insn->operand);  // mov byte [rbx+reg], imm8
+            emit_store_guest16_imm(OFF_NZ, insn->operand);
+        } else {
+            emit_flush_cycles(pending);
+            emit_effective_address(mode, insn->operand);
+            emit_read();
+            emit_store_guest8(reg);
+            emit_store_nz();
+        }
+        *pending += cost;
+        return;
+    }
+
+    if ((reg = jit_store_register(opcode)) >= 0) {
+        emit_flush_cycles(pending);
+        emit_effective_address(mode, insn->operand);
+        emit_load_guest8(HOST_ESI, reg);
+        emit_call((void *)jit_write);
+        emit_exit_if_stopped(cost, next);
+        *pending += cost;
+        return;
+    }
+
+    if (jit_is_compare(opcode)) {
+        if (mode == ADDR_IMMEDIATE) {
+            emit8(0xB8); emit32(insn->operand ^ 0xFF);       // mov eax, ~M
+        } else {
+            emit_flush_cycles(pending);
+            emit_effective_address(mode, insn->operand);
+            emit_read();
+            emit8(0x35); emit32(0xFF);                        // xor eax, 0xFF
+        }
+        emit_load_guest8(HOST_ECX, OFF_A);
+        emit8(0x8D); emit8(0x44); emit8(0x01); emit8(0x01);   // lea eax, [rcx+rax+1]
+        emit8(0x66); emit8(0x89); emit8(0x43); emit8(OFF_CARRY);  // mov [rbx+carry], ax
+        emit8(0x0F); emit8(0xB6); emit8(0xC0);                // movzx eax, al
+        emit_store_nz();
+        *pending += cost;
+        return;
+    }
+
+    switch (opcode) {
+        case 0xE8: case 0xC8: case 0xCA: case 0x88: {
+            // INX/INY/DEX/DEY: inc/dec byte [rbx+reg]
+            uint8_t target = (opcode == 0xE8 || opcode == 0xCA) ? OFF_X : OFF_Y;
+            emit8(0xFE); emit8((opcode == 0xE8 || opcode == 0xC8) ? 0x43 : 0x4B); emit8(target);
+            emit_load_guest8(HOST_EAX, target);
+            emit_store_nz();
+            *pending += cost;
+            return;
+        }
+
+        case 0xAA: case 0xA8: case 0x8A: case 0x98: case 0xBA: case 0x9A: {
+            uint8_t from = (opcode == 0xAA || opcode == 0xA8) ? OFF_A :
+                           (opcode == 0x8A || opcode == 0x9A) ? OFF_X :
+                           (opcode == 0x98) ? OFF_Y : OFF_SP;
+            uint8_t to = (opcode == 0xAA || opcode == 0xBA) ? OFF_X :
+                         (opcode == 0xA8) ? OFF_Y :
+                         (opcode == 0x9A) ? OFF_SP : OFF_A;
+            emit_load_guest8(HOST_EAX, from);
+            emit_store_guest8(to);
+            if (opcode != 0x9A) {  // TXS leaves the flags alone
+                emit_store_nz();
+            }
+            *pending += cost;
+            return;
+        }
+
+        case 0xF0: case 0xD0: case 0xB0: case 0x90:
+        case 0x30: case 0x10: case 0x70: case 0x50: {
+            int taken_if_nonzero;
+
+            *pending += cost;
+            emit_flush_cycles(pending);
+            switch (opcode) {
+                case 0xF0: case 0xD0:
+                    emit8(0xF6); emit8(0x43); emit8(OFF_NZ); emit8(0xFF);        // test byte [nz], 0xFF
+                    taken_if_nonzero = (opcode == 0xD0);
+                    break;
+                case 0xB0: case 0x90:
+                    emit8(0xF6); emit8(0x43); emit8(OFF_CARRY + 1); emit8(0x01); // test byte [carry+1], 1
+                    taken_if_nonzero = (opcode == 0xB0);
+                    break;
+                case 0x30: case 0x10:
+                    emit8(0x0F); emit8(0xB7); emit8(0x43); emit8(OFF_NZ);         // movzx eax, word [nz]
+                    emit8(0x89); emit8(0xC1);                                    // mov ecx, eax
+                    emit8(0xD1); emit8(0xE9);                                    // shr ecx, 1
+                    emit8(0x09); emit8(0xC8);                                    // or eax, ecx
+                    emit8(0xA8); emit8(0x80);                                    // test al, 0x80
+                    taken_if_nonzero = (opcode == 0x30);
+                    break;
+                default:
+                    emit8(0xF6); emit8(0x43); emit8(OFF_P); emit8(STATUS_V);     // test byte [p], V
+                    taken_if_nonzero = (opcode == 0x70);
+                    break;
+            }
+            // jnz/jz taken; fall through for not taken
+            emit8(0x0F); emit8(taken_if_nonzero ? 0x85 : 0x84);
+            uint8_t *taken_jump = jit->pos;
+            emit32(0);
+            emit_exit_chained(next);
+            uint32_t distance = (uint32_t)(jit->pos - (taken_jump + 4));
+            memcpy(taken_jump, &distance, 4);
+            emit_exit_chained(insn->operand);
+            return;
+        }
+
+        case 0x4C:  // JMP absolute
+            *pending += cost;
+            emit_flush_cycles(pending);
+            emit_exit_chained(insn->operand);
+            return;
+
+        case 0x6C:  // JMP indirect
+            emit_flush_cycles(pending);
+            emit_mov_edi(insn->operand);
+            emit_call((void *)jit_ea_indirect);
+            emit8(0x66); emit8(0x89); emit8(0x43); emit8(OFF_PC);  // mov [rbx+pc], ax
+            emit_add_cycles(cost);
+            emit_exit_dynamic();
+            return;
+
+        case 0x20:  // JSR (never into the KERNAL trap area, see jit_classify)
+            *pending += cost;
+            emit_flush_cycles(pending);
+            emit_mov_edi((uint16_t)(insn->address + 2 - 1));  // As the interpreter pushes it
+            emit_call((void *)jit_push16);
+            emit_exit_if_stopped(0, insn->operand);
+            emit_exit_chained(insn->operand);
+            return;
+
+        case 0x60:  // RTS
+            emit_flush_cycles(pending);
+            emit_call((void *)jit_pull16);
+            emit8(0xFF); emit8(0xC0);                              // inc eax
+            emit8(0x66); emit8(0x89); emit8(0x43); emit8(OFF_PC);  // mov [rbx+pc], ax
+            emit_add_cycles(cost);
+            emit_exit_dynamic();
+            return;
+    }
+}
+
+/**
+ * Set up the code buffer, entry trampoline and epilogue
+ * @return 1 on success, 0 if no executable memory is available
+ */
+static int jit_init_buffer() {
+    if (jit->buffer) {
+        return 1;
+    }
+
+    void *buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        printf("Error: Could not allocate executable memory for the JIT\n");
+        return 0;
+    }
+    jit->buffer = buffer;
+    jit->pos = jit->buffer;
+
+    // Entry: save callee-saved registers (five pushes keep calls 16-byte
+    // aligned), load the context registers and jump to the block
+    jit->entry = (JitEntry)(void *)jit->pos;
+    emit8(0x53);                             // push rbx
+    emit8(0x41); emit8(0x54);                // push r12
+    emit8(0x41); emit8(0x55);                // push r13
+    emit8(0x41); emit8(0x56);                // push r14
+    emit8(0x41); emit8(0x57);                // push r15
+    emit8(0x48); emit8(0x89); emit8(0xFB);   // mov rbx, rdi
+    emit8(0x49); emit8(0x89); emit8(0xF4);   // mov r12, rsi
+    emit8(0x49); emit8(0x89); emit8(0xD5);   // mov r13, rdx
+    emit8(0xFF); emit8(0xE1);                // jmp rcx
+
+    jit->epilogue = jit->pos;
+    emit8(0x41); emit8(0x5F);                // pop r15
+    emit8(0x41); emit8(0x5E);                // pop r14
+    emit8(0x41); emit8(0x5D);                // pop r13
+    emit8(0x41); emit8(0x5C);                // pop r12
+    emit8(0x5B);                             // pop rbx
+    emit8(0xC3);                             // ret
+
+    jit->code_start = jit->pos;
+    return 1;
+}
+
+/**
+ * Drop every compiled block
+ */
+static void jit_flush() {
+    for (int i = 0; i < 256; i++) {
+        if (jit->map[i]) {
+            memset(jit->map[i], 0, 256 * sizeof(JitBlock *));
+        }
+    }
+    memset(jit->code_pages, 0, sizeof(jit->code_pages));
+    jit->block_count = 0;
+    if (jit->buffer) {
+        jit->pos = jit->code_start;
+    }
+    jit->generation++;
+    jit->flushed = 1;
+    jit->flushes++;
+}
+
+/**
+ * Compile the block starting at an address
+ * @return The block, or &jit->no_block if the first instruction can't be compiled
+ */
+static JitBlock *jit_compile(uint16_t start) {
+    JitInsn insns[JIT_MAX_BLOCK_INSNS];
+    int count = 0;
+    uint16_t address = start;
+
+    // Scan until an instruction ends the block or can't be compiled
+    while (count < JIT_MAX_BLOCK_INSNS) {
+        JitInsn *insn = &insns[count];
+        uint8_t size;
+
+        if (!jit_page_compilable(address >> 8) || !jit_page_compilable((uint16_t)(address + 2) >> 8)) {
+            break;
+        }
+        insn->address = address;
+        insn->opcode = jit_read(address);
+        size = opcode_sizes[insn->opcode];
+        if (opcode_modes[insn->opcode] == ADDR_RELATIVE) {
+            insn->operand = (uint16_t)(address + 2 + (int8_t)jit_read(address + 1));
+        } else if (size == 3) {
+            insn->operand = jit_read(address + 1) | (jit_read(address + 2) << 8);
+        } else if (size == 2) {
+            insn->operand = jit_read(address + 1);
+        } else {
+            insn->operand = 0;
+        }
+
+        int kind = jit_classify(insn);
+        if (kind == 0) {
+            break;
+        }
+        count++;
+        address += size;
+        if (kind == 2) {
+            break;
+        }
+    }
+
+    if (count == 0) {
+        return &jit->no_block;
+    }
+
+    // Make room for the block
+    if (jit->block_count >= JIT_MAX_BLOCKS ||
+        jit->pos + (count + 1) * JIT_MAX_INSN_BYTES > jit->buffer + JIT_BUFFER_SIZE) {
+        jit_flush();
+    }
+
+    JitBlock *block = &jit->blocks[jit->block_count++];
+    block->code = jit->pos;
+    block->start = start;
+    block->guard = 0;
+    for (int i = 0; i < count - 1; i++) {
+        block->guard += opcode_cycles[insns[i].opcode];
+    }
+
+    // Budget guard: enter only if cycles + guard < run limit
+    emit8(0x49); emit8(0x8B); emit8(0x04); emit8(0x24);   // mov rax, [r12]
+    emit8(0x48); emit8(0x05); emit32(block->guard);       // add rax, guard
+    emit8(0x49); emit8(0x8B); emit8(0x4D); emit8(0x00);   // mov rcx, [r13]
+    emit8(0x48); emit8(0x39); emit8(0xC8);                // cmp rax, rcx
+    emit8(0x72); emit8(13);                               // jb body
+    emit_store_guest16_imm(OFF_PC, start);
+    emit_exit_dynamic();
+
+    uint32_t pending = 0;
+    for (int i = 0; i < count; i++) {
+        jit_emit_insn(&insns[i], &pending);
+    }
+
+    // The block stopped before something it can't hold: continue there
+    int last_kind = jit_classify(&insns[count - 1]);
+    if (last_kind != 2) {
+        emit_flush_cycles(&pending);
+        emit_exit_chained(address);
+    }
+
+    // Writes to any page the block was read from drop it again
+    for (uint32_t page = start >> 8; ; page = (page + 1) & 0xFF) {
+        jit->code_pages[page] = 1;
+        memory_watch_code_page_r(jit_machine, page);
+        if (page == (uint16_t)(address - 1) >> 8) {
+            break;
+        }
+    }
+
+    jit->compiled++;
+    return block;
+}
+
+/**
+ * Find or compile the block for an address
+ */
+static JitBlock *jit_lookup(uint16_t pc) {
+    JitBlock **page = jit->map[pc >> 8];
+
+    if (!page) {
+        page = calloc(256, sizeof(JitBlock *));
+        if (!page) {
+            return &jit->no_block;
+        }
+        jit->map[pc >> 8] = page;
+    }
+    if (!page[pc & 0xFF]) {
+        // Stored after compiling: a flush while compiling clears the map
+        JitBlock *block = jit_compile(pc);
+        page[pc & 0xFF] = block;
+    }
+    return page[pc & 0xFF];
+}
+
+/**
+ * Run one block and verify it against the interpreter
+ * The block runs first; then memory, registers, I/O chips and scheduled
+ * events are put back, the interpreter runs the same cycles and the
+ * results are compared. Devices therefore see each access once, from the
+ * interpreter, whose result is kept. On a mismatch the JIT is switched off.
+ */
+static void jit_check_block(Machine *m, JitBlock *block) {
+    uint8_t *before = jit->before;
+    uint8_t *after = jit->after;
+    CPU cpu_jit;
+    uint64_t cycles_jit;
+    uint16_t start = block->start;
+
+    memory_save_state_r(m, before);
+    snapshot_capture_devices_r(m, jit->devices);
+    jit->entry(&m->cpu, &m->cycles, &m->cpu_state.run_limit, block->code);
+    cpu_jit = m->cpu;
+    cycles_jit = m->cycles;
+    memory_save_state_r(m, after);
+
+    memory_restore_state_r(m, before);
+    snapshot_restore_devices_r(m, jit->devices);
+    m->cpu_state.run_limit = jit->entry_limit;
+    while (m->cycles < cycles_jit) {
+        cpu_step_switch(m);
+    }
+
+    CPU cpu_interp = m->cpu;
+    uint8_t status_interp = cpu_get_status_r(m);
+    m->cpu = cpu_jit;
+    uint8_t status_jit = cpu_get_status_r(m);
+    m->cpu = cpu_interp;
+
+    memory_save_state_r(m, before);
+    int memory_differs = memcmp(before, after, MEMORY_STATE_SIZE) != 0;
+    if (m->cycles != cycles_jit || cpu_interp.pc != cpu_jit.pc || cpu_interp.a != cpu_jit.a ||
+        cpu_interp.x != cpu_jit.x || cpu_interp.y != cpu_jit.y || cpu_interp.sp != cpu_jit.sp ||
+        status_interp != status_jit || memory_differs) {
+        printf("JIT mismatch in block at $%04X:\n", start);
+        printf("  interpreter: PC=$%04X A=$%02X X=$%02X Y=$%02X SP=$%02X P=$%02X cycles=%llu\n",
+               cpu_interp.pc, cpu_interp.a, cpu_interp.x, cpu_interp.y, cpu_interp.sp,
+               status_interp, (unsigned long long)m->cycles);
+        printf("  JIT:         PC=$%04X A=$%02X X=$%02X Y=$%02X SP=$%02X P=$%02X cycles=%llu\n",
+               cpu_jit.pc, cpu_jit.a, cpu_jit.x, cpu_jit.y, cpu_jit.sp, status_jit,
+               (unsigned long long)cycles_jit);
+        for (int i = 0; memory_differs && i < MEMORY_SIZE; i++) {
+            if (before[i] != after[i]) {
+                printf("  first memory difference at $%04X: interpreter $%02X, JIT $%02X\n",
+                       i, before[i], after[i]);
+                break;
+            }
+        }
+        printf("JIT disabled\n");
+        m->cpu_state.jit_mode = CPU_JIT_OFF;
+    }
+}
+
+/**
+ * Make a machine's JIT state the current one for this thread
+ */
+static void jit_select(Machine *m) {
+    jit_machine = m;
+    jit = m->cpu_state.jit;
+}
+
+/**
+ * Run compiled blocks until the cycle counter reaches the run limit
+ */
+CpuExitReason cpu_run_jit(Machine *m) {
+    uint64_t *limit = &m->cpu_state.run_limit;
+
+    jit_select(m);
+    while (m->cycles < *limit && m->cpu_state.jit_mode != CPU_JIT_OFF) {
+        JitBlock *block = jit_lookup(m->cpu.pc);
+
+        // Nothing compiled here, or the block would overrun the budget
+        if (block == &jit->no_block || m->cycles + block->guard >= *limit) {
+            cpu_step_switch(m);
+            jit->interpreted++;
+            continue;
+        }
+
+        jit->block_runs++;
+        jit->flushed = 0;
+        jit->entry_limit = *limit;
+        if (m->cpu_state.jit_mode == CPU_JIT_CHECK) {
+            jit_check_block(m, block);
+            continue;
+        }
+
+        uint32_t generation = jit->generation;
+        uint32_t site = jit->entry(&m->cpu, &m->cycles, limit, block->code);
+
+        // Chain the exit into its target when both are still valid
+        if (site && generation == jit->generation && m->cycles < *limit) {
+            JitBlock *target = jit_lookup(m->cpu.pc);
+            if (target != &jit->no_block && generation == jit->generation) {
+                uint8_t *jump = jit->buffer + site - 1;
+                uint32_t distance = (uint32_t)(target->code - (jump + 5));
+                memcpy(jump + 1, &distance, 4);
+                jit->chains++;
+            }
+        }
+    }
+
+    // Switched off by a failed check: finish the budget in the interpreter
+    while (m->cycles < *limit) {
+        cpu_step_switch(m);
+    }
+    return CPU_EXIT_BUDGET;
+}
+
+/**
+ * Drop compiled code when guest code changes
+ */
+void cpu_jit_invalidate(Machine *m, int page) {
+    if (!m->cpu_state.jit) {
+        return;
+    }
+    jit_select(m);
+    if (page < 0) {
+        jit_flush();
+    } else if (jit->code_pages[page]) {
+        if (jit->page_writes[page] < JIT_SMC_LIMIT) {
+            jit->page_writes[page]++;
+        }
+        jit_flush();
+    }
+}
+
+/**
+ * Select the JIT mode
+ */
+int cpu_jit_set_mode_r(Machine *m, CpuJitMode mode) {
+    if (mode != CPU_JIT_OFF && !m->cpu_state.jit) {
+        m->cpu_state.jit = calloc(1, sizeof(JitState));
+        if (!m->cpu_state.jit) {
+            printf("Error: Could not allocate JIT state\n");
+            return 0;
+        }
+    }
+    if (!m->cpu_state.jit) {
+        m->cpu_state.jit_mode = mode;
+        return 1;
+    }
+    jit_select(m);
+    if (mode != CPU_JIT_OFF && !jit_init_buffer()) {
+        return 0;
+    }
+    if (mode == CPU_JIT_CHECK && !jit->devices) {
+        // Only the part before RAM is used (see snapshot_capture_devices())
+        jit->devices = malloc(offsetof(MachineSnapshot, memory));
+        if (!jit->devices) {
+            printf("Error: Could not allocate JIT check state\n");
+            return 0;
+        }
+    }
+    m->cpu_state.jit_mode = mode;
+    memset(jit->page_writes, 0, sizeof(jit->page_writes));
+    jit_flush();
+    return 1;
+}
+
+/**
+ * Print JIT counters
+ */
+void cpu_jit_print_stats_r(Machine *m) {
+    static const char *mode_names[] = { "off", "on", "check" };
+    const JitState *state = m->cpu_state.jit;
+
+    printf("JIT: %s\n", mode_names[m->cpu_state.jit_mode]);
+    if (!state) {
+        printf("  never enabled\n");
+        return;
+    }
+    printf("  blocks compiled:      %u (%d live, %ld bytes of code)\n",
+           state->compiled, state->block_count, state->buffer ? (long)(state->pos - state->buffer) : 0L);
+    printf("  block runs:           %llu\n", (unsigned long long)state->block_runs);
+    printf("  chained exits:        %u\n", state->chains);
+    printf("  interpreted steps:    %llu\n", (unsigned long long)state->interpreted);
+    printf("  flushes:              %u\n", state->flushes);
+}
+
+/**
+ * Free the code buffer and block tables
+ */
+void cpu_jit_release(Machine *m) {
+    JitState *state = m->cpu_state.jit;
+
+    if (!state) {
+        return;
+    }
+    if (state->buffer) {
+        munmap(state->buffer, JIT_BUFFER_SIZE);
+    }
+    for (int i = 0; i < 256; i++) {
+        free(state->map[i]);
+    }
+    free(state->devices);
+    free(state);
+    m->cpu_state.jit = NULL;
+    m->cpu_state.jit_mode = CPU_JIT_OFF;
+    if (jit == state) {
+        jit = NULL;
+        jit_machine = NULL;
+    }
+}
+
+#else /* !(CPU_JIT && __x86_64__) */
+
+CpuExitReason cpu_run_jit(Machine *m) {
+    while (m->cycles < m->cpu_state.run_limit) {
+        cpu_step_switch(m);
+    }
+    return CPU_EXIT_BUDGET;
+}
+
+void cpu_jit_invalidate(Machine *m, int page) {
+    (void)m;
+    (void)page;
+}
+
+void cpu_jit_release(Machine *m) {
+    (void)m;
+}
+
+int cpu_jit_set_mode_r(Machine *m, CpuJitMode mode) {
+    (void)m;
+    if (mode != CPU_JIT_OFF) {
+        printf("JIT not available in this build (x86-64 only, build with 'make JIT=1')\n");
+        return 0;
+    }
+    return 1;
+}
+
+void cpu_jit_print_stats_r(Machine *m) {
+    (void)m;
+    printf("JIT not available in this build\n");
+}
+
+#endif /* CPU_JIT && __x86_64__ */
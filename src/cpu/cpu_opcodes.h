@@ -0,0 +1,318 @@
+/**
+ * cpu_opcodes.h
+ * Per-opcode handler bodies for the threaded CPU engine
+ *
+ * This file has no include guard on purpose. cpu_threaded.c defines
+ * HANDLER()/END_HANDLER and the register and memory access macros, then
+ * includes it: with computed goto every handler becomes a label inside the
+ * run loop, otherwise every handler becomes a small static function that is
+ * reached through a function pointer table.
+ *
+ * The addressing mode of each opcode is folded into its handler, so there
+ * is no separate operand-address lookup or second switch per instruction.
+ * Operand bytes come from the decoded instruction (OPERAND8/OPERAND16 and
+ * the EA_* macros), never from memory at PC. Sizes and cycle counts match
+ * the tables built in cpu_init().
+ */
+
+// Loads: fetch the value, update N/Z, advance PC
+#define OP_LOAD(name, reg, value, size, cyc) \
+    HANDLER(name) reg = (value); SET_NZ(reg); REG_PC += size; ADD_CYCLES(cyc); END_HANDLER
+
+// Stores: write the register, flags are unaffected
+#define OP_STORE(name, reg, ea, size, cyc) \
+    HANDLER(name) WRITE(ea, reg); REG_PC += size; ADD_CYCLES(cyc); END_HANDLER
+
+// Compare accumulator: C = A >= M, N/Z from A - M
+#define OP_CMP(name, operand, size, cyc) \
+    HANDLER(name) { \
+        uint8_t value = (operand); \
+        SET_COMPARE(REG_A, value); \
+    } REG_PC += size; ADD_CYCLES(cyc); END_HANDLER
+
+// Register to register transfers and increments, all implied and 2 cycles
+#define OP_IMPLIED(name, expr, flag_reg) \
+    HANDLER(name) expr; SET_NZ(flag_reg); REG_PC += 1; ADD_CYCLES(2); END_HANDLER
+
+// Relative branches: 2 cycles whether or not the branch is taken
+#define OP_BRANCH(name, cond) \
+    HANDLER(name) if (cond) { REG_PC = EA_REL(); } else { REG_PC += 2; } ADD_CYCLES(2); END_HANDLER
+
+// LDA - Load Accumulator
+OP_LOAD(LDA_IMM, REG_A, OPERAND8(),     2, 2)
+OP_LOAD(LDA_ZP,  REG_A, READ(EA_ZP()),  2, 3)
+OP_LOAD(LDA_ZPX, REG_A, READ(EA_ZPX()), 2, 4)
+OP_LOAD(LDA_ABS, REG_A, READ(EA_ABS()), 3, 4)
+OP_LOAD(LDA_ABX, REG_A, READ(EA_ABX()), 3, 4)
+OP_LOAD(LDA_ABY, REG_A, READ(EA_ABY()), 3, 4)
+OP_LOAD(LDA_IZX, REG_A, READ(EA_IZX()), 2, 6)
+OP_LOAD(LDA_IZY, REG_A, READ(EA_IZY()), 2, 5)
+
+// LDX - Load X Register
+OP_LOAD(LDX_IMM, REG_X, OPERAND8(),     2, 2)
+OP_LOAD(LDX_ZP,  REG_X, READ(EA_ZP()),  2, 3)
+OP_LOAD(LDX_ZPY, REG_X, READ(EA_ZPY()), 2, 4)
+OP_LOAD(LDX_ABS, REG_X, READ(EA_ABS()), 3, 4)
+OP_LOAD(LDX_ABY, REG_X, READ(EA_ABY()), 3, 4)
+
+// LDY - Load Y Register
+OP_LOAD(LDY_IMM, REG_Y, OPERAND8(),     2, 2)
+OP_LOAD(LDY_ZP,  REG_Y, READ(EA_ZP()),  2, 3)
+OP_LOAD(LDY_ZPX, REG_Y, READ(EA_ZPX()), 2, 4)
+OP_LOAD(LDY_ABS, REG_Y, READ(EA_ABS()), 3, 4)
+OP_LOAD(LDY_ABX, REG_Y, READ(EA_ABX()), 3, 4)
+
+// STA - Store Accumulator
+OP_STORE(STA_ZP,  REG_A, EA_ZP(),  2, 3)
+OP_STORE(STA_ZPX, REG_A, EA_ZPX(), 2, 4)
+OP_STORE(STA_ABS, REG_A, EA_ABS(), 3, 4)
+OP_STORE(STA_ABX, REG_A, EA_ABX(), 3, 5)
+OP_STORE(STA_ABY, REG_A, EA_ABY(), 3, 5)
+OP_STORE(STA_IZX, REG_A, EA_IZX(), 2, 6)
+OP_STORE(STA_IZY, REG_A, EA_IZY(), 2, 6)
+
+// STX - Store X Register
+OP_STORE(STX_ZP,  REG_X, EA_ZP(),  2, 3)
+OP_STORE(STX_ZPY, REG_X, EA_ZPY(), 2, 4)
+OP_STORE(STX_ABS, REG_X, EA_ABS(), 3, 4)
+
+// STY - Store Y Register
+OP_STORE(STY_ZP,  REG_Y, EA_ZP(),  2, 3)
+OP_STORE(STY_ZPX, REG_Y, EA_ZPX(), 2, 4)
+OP_STORE(STY_ABS, REG_Y, EA_ABS(), 3, 4)
+
+// JMP - Jump
+HANDLER(JMP_ABS) REG_PC = EA_ABS(); ADD_CYCLES(3); END_HANDLER
+HANDLER(JMP_IND) REG_PC = EA_IND(); ADD_CYCLES(5); END_HANDLER
+
+// JSR - Jump to Subroutine
+// Calls into $FF00+ leave the run loop so the KERNAL routine can be emulated
+HANDLER(JSR) {
+    uint16_t target = EA_ABS();
+    ADD_CYCLES(6);
+    if (target >= 0xFF00) {
+        PUSH16(REG_PC + 2);
+        KERNAL_TRAP(target);
+    }
+    PUSH16(REG_PC + 2 - 1);
+    REG_PC = target;
+} END_HANDLER
+
+// RTS - Return from Subroutine
+HANDLER(RTS) REG_PC = PULL16() + 1; ADD_CYCLES(6); END_HANDLER
+
+// Register increment/decrement
+OP_IMPLIED(INX, REG_X++, REG_X)
+OP_IMPLIED(INY, REG_Y++, REG_Y)
+OP_IMPLIED(DEX, REG_X--, REG_X)
+OP_IMPLIED(DEY, REG_Y--, REG_Y)
+
+// CMP - Compare Accumulator
+OP_CMP(CMP_IMM, OPERAND8(),     2, 2)
+OP_CMP(CMP_ZP,  READ(EA_ZP()),  2, 3)
+OP_CMP(CMP_ZPX, READ(EA_ZPX()), 2, 4)
+OP_CMP(CMP_ABS, READ(EA_ABS()), 3, 4)
+OP_CMP(CMP_ABX, READ(EA_ABX()), 3, 4)
+OP_CMP(CMP_ABY, READ(EA_ABY()), 3, 4)
+OP_CMP(CMP_IZX, READ(EA_IZX()), 2, 6)
+OP_CMP(CMP_IZY, READ(EA_IZY()), 2, 5)
+
+// Branch instructions
+OP_BRANCH(BEQ, FLAG_Z)
+OP_BRANCH(BNE, !FLAG_Z)
+OP_BRANCH(BCS, FLAG_C)
+OP_BRANCH(BCC, !FLAG_C)
+OP_BRANCH(BMI, FLAG_N)
+OP_BRANCH(BPL, !FLAG_N)
+OP_BRANCH(BVS, FLAG_V)
+OP_BRANCH(BVC, !FLAG_V)
+
+// Register transfers
+OP_IMPLIED(TAX, REG_X = REG_A, REG_X)
+OP_IMPLIED(TAY, REG_Y = REG_A, REG_Y)
+OP_IMPLIED(TXA, REG_A = REG_X, REG_A)
+OP_IMPLIED(TYA, REG_A = REG_Y, REG_A)
+OP_IMPLIED(TSX, REG_X = REG_SP, REG_X)
+HANDLER(TXS) REG_SP = REG_X; REG_PC += 1; ADD_CYCLES(2); END_HANDLER
+
+/*
+ * Superinstructions (see CPU_FUSION_LIST in cpu_threaded.c)
+ *
+ * Each one first checks that the budget allows the whole sequence (or at
+ * least one whole loop pass) the way single instructions would have run
+ * it; if not, it runs as the plain first instruction instead.
+ */
+#define FUSE_GUARD(cycles_before_last, plain) \
+    do { if (R.cycles + (cycles_before_last) >= RUN_LIMIT) RUN_HANDLER(plain); } while (0)
+#define FUSION_RAN(name, instructions) \
+    do { FUSION_RUNS[FUSION_##name]++; FUSION_INSTRUCTIONS[FUSION_##name] += (instructions); } while (0)
+
+// LDA #imm / JSR abs - the character output idiom (JSR $FFD2)
+HANDLER(LDA_IMM_JSR) {
+    FUSE_GUARD(2, LDA_IMM);
+    uint16_t target = OPERAND2();
+    FUSION_RAN(LDA_IMM_JSR, 2);
+    REG_A = OPERAND8();
+    SET_NZ(REG_A);
+    REG_PC += 2;
+    ADD_CYCLES(2 + 6);
+    if (target >= 0xFF00) {
+        PUSH16(REG_PC + 2);
+        KERNAL_TRAP(target);
+    }
+    PUSH16(REG_PC + 2 - 1);
+    REG_PC = target;
+} END_HANDLER
+
+// LDA abs,r / STA abs,r / INr / BNE back: copy until the index wraps to 0
+// Stops early, before the increment, if a store drops decoded code.
+#define OP_COPY_LOOP(name, reg, plain) \
+    HANDLER(name) { \
+        FUSE_GUARD(4 + 5 + 2, plain); \
+        uint16_t loop = REG_PC, from = OPERAND16(), to = OPERAND2(); \
+        uint32_t generation = DECODE_GENERATION; \
+        uint32_t passes = 0; \
+        for (;;) { \
+            REG_A = READ((uint16_t)(from + reg)); \
+            ADD_CYCLES(4); \
+            WRITE((uint16_t)(to + reg), REG_A); \
+            passes++; \
+            if (DECODE_GENERATION != generation) { \
+                SET_NZ(REG_A); ADD_CYCLES(5); REG_PC = loop + 6; \
+                break; \
+            } \
+            reg++; SET_NZ(reg); ADD_CYCLES(5 + 2 + 2); \
+            if (reg == 0) { REG_PC = loop + 9; break; } \
+            if (R.cycles + 4 + 5 + 2 >= RUN_LIMIT) { REG_PC = loop; break; } \
+        } \
+        FUSION_RAN(name, passes * 4); \
+    } END_HANDLER
+
+OP_COPY_LOOP(COPY_X, REG_X, LDA_ABX)
+OP_COPY_LOOP(COPY_Y, REG_Y, LDA_ABY)
+
+// DEr / BNE back: count the register down to 0 in one step
+// Runs as many whole passes as the budget allows; the rest is single-stepped.
+#define OP_DELAY_LOOP(name, reg, plain) \
+    HANDLER(name) { \
+        FUSE_GUARD(2, plain); \
+        uint64_t passes = reg ? reg : 256; \
+        uint64_t room = (RUN_LIMIT - R.cycles - 2 + 3) / 4; \
+        if (passes > room) passes = room; \
+        reg -= passes; \
+        SET_NZ(reg); \
+        ADD_CYCLES(passes * 4); \
+        if (reg == 0) REG_PC += 3; \
+        FUSION_RAN(name, passes * 2); \
+    } END_HANDLER
+
+OP_DELAY_LOOP(DEX_BNE, REG_X, DEX)
+OP_DELAY_LOOP(DEY_BNE, REG_Y, DEY)
+
+/*
+ * Idle loops
+ *
+ * Nothing in these loops writes memory, so every pass after the first
+ * reads the same values and takes the same branch until something outside
+ * the CPU changes. That can only happen at RUN_LIMIT (the budget end
+ * or the next scheduler event), so after one real pass the handler adds
+ * the cycles of every whole pass that would still have run.
+ * The rest of the last pass, if any, is single-stepped as usual.
+ * I/O registers (the raster line, CIA timers) change as cycles pass. For
+ * a register its device can predict (io_peek()), the handler skips to
+ * the pass that reads a value ending the loop, or to RUN_LIMIT; a loop
+ * polling any other register is run a pass at a time.
+ */
+
+// Whole passes that can still run, given the cycles before a pass's last instruction
+#define IDLE_PASSES(pass_cycles, cycles_before_last) \
+    (R.cycles + (cycles_before_last) < RUN_LIMIT ? \
+     (RUN_LIMIT - R.cycles - (cycles_before_last) + (pass_cycles) - 1) / (pass_cycles) : 0)
+#define IDLE_SKIP(name, pass_cycles, cycles_before_last, pass_instructions) \
+    IDLE_SKIP_PASSES(name, pass_cycles, pass_instructions, IDLE_PASSES(pass_cycles, cycles_before_last))
+#define IDLE_SKIP_PASSES(name, pass_cycles, pass_instructions, count) \
+    do { \
+        uint64_t passes = (count); \
+        ADD_CYCLES(passes * (pass_cycles)); \
+        IDLE_CYCLES += passes * (pass_cycles); \
+        FUSION_RAN(name, (passes + 1) * (pass_instructions)); \
+    } while (0)
+// Same, for a loop polling an I/O register: only the passes that still
+// loop, leaving A as the last one loaded it
+#define IDLE_SKIP_IO(name, pass_cycles, cycles_before_last, pass_instructions, compare, branch) \
+    IDLE_SKIP_PASSES(name, pass_cycles, pass_instructions, \
+                     idle_io_passes(m, OPERAND16(), R.cycles, pass_cycles, \
+                                    IDLE_PASSES(pass_cycles, cycles_before_last), compare, branch, \
+                                    R.carry, &REG_A))
+
+// JMP * - spin until the budget ends
+HANDLER(IDLE_JMP) {
+    ADD_CYCLES(3);
+    IDLE_SKIP(IDLE_JMP, 3, 0, 1);
+} END_HANDLER
+
+// Branch to itself - taken forever if the condition holds
+HANDLER(IDLE_BRANCH) {
+    ADD_CYCLES(2);
+    if (!branch_taken(OPERAND2(), R.nz, R.carry, REG_P)) {
+        REG_PC += 2;
+    } else {
+        IDLE_SKIP(IDLE_BRANCH, 2, 0, 1);
+    }
+} END_HANDLER
+
+// LDA zp|abs / Bxx back - wait for a flag in memory
+#define OP_IDLE_POLL(name, size, load_cycles, plain) \
+    HANDLER(name) { \
+        FUSE_GUARD(load_cycles, plain); \
+        REG_A = READ(OPERAND16()); \
+        SET_NZ(REG_A); \
+        ADD_CYCLES((load_cycles) + 2); \
+        if (!branch_taken(OPERAND2(), R.nz, R.carry, REG_P)) { \
+            REG_PC += (size) + 2; \
+        } else if (READS_IO(OPERAND16())) { \
+            IDLE_SKIP_IO(name, (load_cycles) + 2, load_cycles, 2, -1, OPERAND2()); \
+            SET_NZ(REG_A); \
+        } else { \
+            IDLE_SKIP(name, (load_cycles) + 2, load_cycles, 2); \
+        } \
+    } END_HANDLER
+
+OP_IDLE_POLL(IDLE_POLL_ZP,  2, 3, LDA_ZP)
+OP_IDLE_POLL(IDLE_POLL_ABS, 3, 4, LDA_ABS)
+
+// LDA abs / CMP #imm / Bxx back - e.g. waiting for a raster line in $D012
+HANDLER(IDLE_WAIT_ABS) {
+    FUSE_GUARD(4 + 2, LDA_ABS);
+    REG_A = READ(OPERAND16());
+    SET_COMPARE(REG_A, OPERAND2() & 0xFF);
+    ADD_CYCLES(4 + 2 + 2);
+    if (!branch_taken(OPERAND2() >> 8, R.nz, R.carry, REG_P)) {
+        REG_PC += 7;
+    } else if (READS_IO(OPERAND16())) {
+        IDLE_SKIP_IO(IDLE_WAIT_ABS, 8, 6, 3, OPERAND2() & 0xFF, OPERAND2() >> 8);
+        SET_COMPARE(REG_A, OPERAND2() & 0xFF);
+    } else {
+        IDLE_SKIP(IDLE_WAIT_ABS, 8, 6, 3);
+    }
+} END_HANDLER
+
+// Anything not implemented yet: report it and skip a single byte
+HANDLER(UNIMPLEMENTED) {
+    printf("Unimplemented opcode: $%02X at $%04X\n", READ(REG_PC), REG_PC);
+} REG_PC += 1; ADD_CYCLES(2); END_HANDLER
+
+#undef OP_LOAD
+#undef OP_STORE
+#undef OP_CMP
+#undef OP_IMPLIED
+#undef OP_BRANCH
+#undef OP_COPY_LOOP
+#undef OP_DELAY_LOOP
+#undef OP_IDLE_POLL
+#undef IDLE_PASSES
+#undef IDLE_SKIP
+#undef IDLE_SKIP_PASSES
+#undef IDLE_SKIP_IO
+#undef FUSE_GUARD
+#undef FUSION_RAN
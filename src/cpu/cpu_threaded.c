@@ -0,0 +1,664 @@
+/**
+ * cpu_threaded.c
+ * Threaded-dispatch execution engine for the MOS 6510 CPU
+ *
+ * Instead of looking up the addressing mode, resolving the operand address
+ * through one switch and then executing through a second switch, every
+ * opcode has its own handler (see cpu_opcodes.h) with the addressing mode
+ * folded in. On GCC and Clang the handlers are labels and each one jumps
+ * straight to the next handler through a computed goto; other compilers
+ * use a table of function pointers.
+ *
+ * Instructions are decoded once into a per-page cache (handler, operand,
+ * length, base cycles) and executed from there, so a loop that stays in a
+ * page does no opcode or operand fetches. The memory code hook drops a
+ * page's entries when it is written, which keeps self-modifying code working.
+ *
+ * While decoding, a few common instruction sequences are recognised and
+ * given a fused handler (superinstruction) that runs the whole sequence,
+ * or a whole loop in closed form, in one dispatch. Loops that only poll
+ * memory without writing anything (JMP *, raster waits, flag polls) are
+ * idle until something outside the CPU changes; their handlers run one
+ * pass and then skip the cycle counter ahead to the run limit.
+ *
+ * The dispatch tables are shared by all machines; the decode cache and
+ * the counters live in each machine's CpuState.
+ *
+ * Define CPU_NO_COMPUTED_GOTO to force the portable fallback on GCC.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu_internal.h"
+#include "../memory/memory.h"
+#include "../memory/memory_inline.h"
+
+#if defined(__GNUC__) && !defined(CPU_NO_COMPUTED_GOTO)
+#define CPU_COMPUTED_GOTO 1
+#else
+#define CPU_COMPUTED_GOTO 0
+#endif
+
+/**
+ * Opcode to handler mapping
+ * Every opcode not listed here goes to the UNIMPLEMENTED handler.
+ */
+#define CPU_OPCODE_LIST(X) \
+    X(0xA9, LDA_IMM) X(0xA5, LDA_ZP)  X(0xB5, LDA_ZPX) X(0xAD, LDA_ABS) \
+    X(0xBD, LDA_ABX) X(0xB9, LDA_ABY) X(0xA1, LDA_IZX) X(0xB1, LDA_IZY) \
+    X(0xA2, LDX_IMM) X(0xA6, LDX_ZP)  X(0xB6, LDX_ZPY) X(0xAE, LDX_ABS) \
+    X(0xBE, LDX_ABY) \
+    X(0xA0, LDY_IMM) X(0xA4, LDY_ZP)  X(0xB4, LDY_ZPX) X(0xAC, LDY_ABS) \
+    X(0xBC, LDY_ABX) \
+    X(0x85, STA_ZP)  X(0x95, STA_ZPX) X(0x8D, STA_ABS) X(0x9D, STA_ABX) \
+    X(0x99, STA_ABY) X(0x81, STA_IZX) X(0x91, STA_IZY) \
+    X(0x86, STX_ZP)  X(0x96, STX_ZPY) X(0x8E, STX_ABS) \
+    X(0x84, STY_ZP)  X(0x94, STY_ZPX) X(0x8C, STY_ABS) \
+    X(0x4C, JMP_ABS) X(0x6C, JMP_IND) X(0x20, JSR)     X(0x60, RTS) \
+    X(0xE8, INX)     X(0xC8, INY)     X(0xCA, DEX)     X(0x88, DEY) \
+    X(0xC9, CMP_IMM) X(0xC5, CMP_ZP)  X(0xD5, CMP_ZPX) X(0xCD, CMP_ABS) \
+    X(0xDD, CMP_ABX) X(0xD9, CMP_ABY) X(0xC1, CMP_IZX) X(0xD1, CMP_IZY) \
+    X(0xF0, BEQ)     X(0xD0, BNE)     X(0xB0, BCS)     X(0x90, BCC) \
+    X(0x30, BMI)     X(0x10, BPL)     X(0x70, BVS)     X(0x50, BVC) \
+    X(0xAA, TAX)     X(0xA8, TAY)     X(0x8A, TXA)     X(0x98, TYA) \
+    X(0xBA, TSX)     X(0x9A, TXS)
+
+/**
+ * Superinstructions: name and the sequence each one replaces
+ */
+#define CPU_FUSION_LIST(X) \
+    X(LDA_IMM_JSR,   "LDA #imm / JSR abs") \
+    X(COPY_X,        "LDA abs,X / STA abs,X / INX / BNE loop") \
+    X(COPY_Y,        "LDA abs,Y / STA abs,Y / INY / BNE loop") \
+    X(DEX_BNE,       "DEX / BNE loop") \
+    X(DEY_BNE,       "DEY / BNE loop") \
+    X(IDLE_JMP,      "JMP * (idle)") \
+    X(IDLE_BRANCH,   "Bxx * (idle)") \
+    X(IDLE_POLL_ZP,  "LDA zp / Bxx back (idle poll)") \
+    X(IDLE_POLL_ABS, "LDA abs / Bxx back (idle poll)") \
+    X(IDLE_WAIT_ABS, "LDA abs / CMP #imm / Bxx back (idle wait)")
+
+enum {
+#define X(name, description) FUSION_##name,
+    CPU_FUSION_LIST(X)
+#undef X
+    FUSION_COUNT
+};
+
+// Longest byte sequence a decoded entry can depend on (the copy loops)
+#define DECODE_MAX_SPAN 9
+
+/**
+ * Register file used while the run loop is active
+ * With computed goto these are plain locals of cpu_run_threaded(), so the
+ * compiler can keep them in host registers; the portable version passes a
+ * pointer to one of these to every handler.
+ */
+typedef struct {
+    Machine *m;
+    uint16_t pc;
+    uint8_t a, x, y, sp;
+    uint16_t nz, carry;
+    uint64_t cycles;
+} RunState;
+
+typedef struct DecodedOp DecodedOp;
+
+#if CPU_COMPUTED_GOTO
+typedef void *OpcodeHandler;
+#else
+typedef int (*OpcodeHandler)(RunState *r, const DecodedOp *op);
+#endif
+
+/**
+ * A predecoded instruction
+ * operand holds the immediate byte, the zero page or absolute address, or,
+ * for branches, the target address. Superinstructions keep a second
+ * operand in operand2, and length/cycles cover the whole sequence (one
+ * pass for loops). An entry with no handler is empty.
+ */
+struct DecodedOp {
+    OpcodeHandler handler;
+    uint16_t operand;
+    uint16_t operand2;
+    uint8_t length;
+    uint8_t cycles;
+};
+
+_Static_assert(FUSION_COUNT <= CPU_MAX_FUSIONS, "raise CPU_MAX_FUSIONS in cpu.h");
+
+// Handler for each opcode and superinstruction (filled by cpu_threaded_init())
+static OpcodeHandler dispatch[256];
+static OpcodeHandler fused_dispatch[FUSION_COUNT];
+
+// Helpers and handlers act on the machine m. Run loop state of that machine:
+// the run limit, the decode generation (bumped whenever decoded entries are
+// dropped; fused loops check it after writes), the idle cycle counter and
+// how often each superinstruction ran and the instructions it stood in for.
+#define RUN_LIMIT           (m->cpu_state.run_limit)
+#define DECODE_GENERATION   (m->cpu_state.decode_generation)
+#define IDLE_CYCLES         (m->cpu_state.idle_cycles)
+#define FUSION_RUNS         (m->cpu_state.fusion_runs)
+#define FUSION_INSTRUCTIONS (m->cpu_state.fusion_instructions)
+
+// Register and flag access
+#define REG_PC  (R.pc)
+#define REG_A   (R.a)
+#define REG_X   (R.x)
+#define REG_Y   (R.y)
+#define REG_SP  (R.sp)
+// N/Z/C are lazy: instructions record results, branches evaluate them.
+// Nothing inside the run loop changes I, D, B or V, so they stay in cpu.p.
+#define REG_P   (m->cpu.p)
+#define FLAG_C  LAZY_C(R.carry)
+#define FLAG_Z  LAZY_Z(R.nz)
+#define FLAG_V  (REG_P & STATUS_V)
+#define FLAG_N  LAZY_N(R.nz)
+#define SET_NZ(value) (R.nz = (value))
+#define SET_COMPARE(reg, value) do { R.carry = LAZY_SUB_CARRY(reg, value); R.nz = R.carry & 0xFF; } while (0)
+#define ADD_CYCLES(n) (R.cycles += (n))
+
+// Memory and stack access, through the inline accessors in
+// memory_inline.h. I/O devices see m->cycles, so handlers bring it up to
+// date first: R.cycles is the start of the current instruction, as in the
+// other engines. PEEK is for the decoder and helpers, which only read
+// code, the stack and zero page.
+#define SYNC_CYCLES()         (m->cycles = R.cycles)
+#define READ(address)         (SYNC_CYCLES(), memory_read_fast_r(m, (uint16_t)(address)))
+#define WRITE(address, value) (SYNC_CYCLES(), memory_write_fast_r(m, (uint16_t)(address), (value)))
+#define PEEK(address)         memory_read_fast_r(m, (uint16_t)(address))
+#define READS_IO(address)     memory_is_io_r(m, (uint16_t)(address))
+#define PUSH8(value)  do { memory_write_stack_r(m, REG_SP, (value)); REG_SP--; } while (0)
+#define PULL8()       (REG_SP++, memory_read_stack_r(m, REG_SP))
+#define PUSH16(value) do { uint16_t w_ = (value); PUSH8(w_ >> 8); PUSH8(w_ & 0xFF); } while (0)
+#define PULL16()      pull16(&R)
+
+// Operands and effective addresses, taken from the decoded instruction
+#define OPERAND8()  ((uint8_t)op->operand)
+#define OPERAND16() (op->operand)
+#define OPERAND2()  (op->operand2)
+#define EA_ZP()     OPERAND8()
+#define EA_ZPX()    ((OPERAND8() + REG_X) & 0xFF)
+#define EA_ZPY()    ((OPERAND8() + REG_Y) & 0xFF)
+#define EA_ABS()    OPERAND16()
+#define EA_ABX()    ((uint16_t)(OPERAND16() + REG_X))
+#define EA_ABY()    ((uint16_t)(OPERAND16() + REG_Y))
+#define EA_REL()    OPERAND16()
+#define EA_IND()    (SYNC_CYCLES(), ea_indirect(m, OPERAND16()))
+#define EA_IZX()    ea_indexed_indirect(m, OPERAND8(), REG_X)
+#define EA_IZY()    ea_indirect_indexed(m, OPERAND8(), REG_Y)
+
+/**
+ * Copy the CPU registers into a run loop register file
+ */
+static inline void run_state_load(Machine *m, RunState *r) {
+    r->m = m;
+    r->pc = m->cpu.pc;
+    r->a = m->cpu.a;
+    r->x = m->cpu.x;
+    r->y = m->cpu.y;
+    r->sp = m->cpu.sp;
+    r->nz = m->cpu.nz;
+    r->carry = m->cpu.carry;
+    r->cycles = m->cycles;
+}
+
+/**
+ * Write a run loop register file back to the CPU registers
+ */
+static inline void run_state_store(const RunState *r) {
+    Machine *m = r->m;
+    
+    m->cpu.pc = r->pc;
+    m->cpu.a = r->a;
+    m->cpu.x = r->x;
+    m->cpu.y = r->y;
+    m->cpu.sp = r->sp;
+    m->cpu.nz = r->nz;
+    m->cpu.carry = r->carry;
+    m->cycles = r->cycles;
+}
+
+/**
+ * Pull a 16-bit word from the stack (low byte first)
+ */
+static inline uint16_t pull16(RunState *r) {
+    Machine *m = r->m;
+    uint8_t low, high;
+    r->sp++;
+    low = memory_read_stack_r(m, r->sp);
+    r->sp++;
+    high = memory_read_stack_r(m, r->sp);
+    return (high << 8) | low;
+}
+
+/**
+ * JMP ($nnnn), including the 6502 page wrap bug
+ */
+static inline uint16_t ea_indirect(Machine *m, uint16_t ptr) {
+    uint16_t high = (ptr & 0xFF) == 0xFF ? (ptr & 0xFF00) : (uint16_t)(ptr + 1);
+    return PEEK(ptr) | (PEEK(high) << 8);
+}
+
+/**
+ * ($nn,X) - pointer in zero page at operand + X
+ */
+static inline uint16_t ea_indexed_indirect(Machine *m, uint8_t operand, uint8_t x) {
+    uint8_t zp = (operand + x) & 0xFF;
+    return memory_read_zp_r(m, zp) | (memory_read_zp_r(m, (uint8_t)(zp + 1)) << 8);
+}
+
+/**
+ * ($nn),Y - pointer in zero page at operand, plus Y
+ */
+static inline uint16_t ea_indirect_indexed(Machine *m, uint8_t zp, uint8_t y) {
+    return (uint16_t)((memory_read_zp_r(m, zp) | (memory_read_zp_r(m, (uint8_t)(zp + 1)) << 8)) + y);
+}
+
+/**
+ * Evaluate the condition of a branch opcode
+ */
+static inline int branch_taken(uint8_t opcode, uint16_t nz, uint16_t carry, uint8_t p) {
+    switch (opcode) {
+        case 0xF0: return LAZY_Z(nz);
+        case 0xD0: return !LAZY_Z(nz);
+        case 0xB0: return LAZY_C(carry);
+        case 0x90: return !LAZY_C(carry);
+        case 0x30: return LAZY_N(nz);
+        case 0x10: return !LAZY_N(nz);
+        case 0x70: return (p & STATUS_V) != 0;
+        default:   return (p & STATUS_V) == 0;
+    }
+}
+
+/**
+ * Count the passes of an idle loop polling an I/O register that still
+ * take the branch back
+ * Asks the device what the register reads at each pass that could see a
+ * new value, so a raster wait skips straight to the pass that reads the
+ * line it waits for.
+ *
+ * @param cycle Cycle the next pass reads the register at
+ * @param max_passes Whole passes before the run limit
+ * @param compare CMP #imm operand, or -1 if the branch tests the load
+ * @param last Set to the value the last of those passes loads (left
+ *             alone if there are none)
+ * @return Passes that loop before one that exits (at most max_passes),
+ *         or 0 if the device can't predict the register
+ */
+static uint64_t idle_io_passes(Machine *m, uint16_t address, uint64_t cycle, uint64_t pass_cycles,
+                               uint64_t max_passes, int compare, uint8_t branch, uint16_t carry,
+                               uint8_t *last) {
+    uint64_t passes = 0;
+    uint8_t value;
+
+    while (passes < max_passes) {
+        uint64_t until = io_peek_r(m, address, cycle + passes * pass_cycles, &value);
+        if (until == IO_PEEK_UNKNOWN) {
+            return 0;
+        }
+        uint16_t nz = value;
+        if (compare >= 0) {
+            carry = LAZY_SUB_CARRY(value, compare);
+            nz = carry & 0xFF;
+        }
+        if (!branch_taken(branch, nz, carry, m->cpu.p)) {
+            break;
+        }
+        // The first pass reading at or after the change
+        if (until == IO_PEEK_NEVER || until - cycle > (max_passes - 1) * pass_cycles) {
+            passes = max_passes;
+            break;
+        }
+        passes = (until - cycle + pass_cycles - 1) / pass_cycles;
+    }
+    // Registers are left as the last pass that looped left them
+    if (passes > 0) {
+        io_peek_r(m, address, cycle + (passes - 1) * pass_cycles, last);
+    }
+    return passes;
+}
+
+/**
+ * Check whether an opcode is one of the eight relative branches
+ */
+static inline int is_branch(uint8_t opcode) {
+    return (opcode & 0x1F) == 0x10;
+}
+
+/**
+ * Check whether the bytes at an address match a pattern
+ */
+static int decode_match(Machine *m, uint16_t pc, const uint8_t *pattern, const uint8_t *mask, int length) {
+    for (int i = 0; i < length; i++) {
+        if ((PEEK(pc + i) & mask[i]) != pattern[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Replace a decoded instruction with a superinstruction if it starts one
+ * @return Number of bytes the entry now depends on
+ */
+static int decode_fuse(Machine *m, uint16_t pc, DecodedOp *op) {
+    // Operand bytes are masked out (0x00); branch offsets must loop back
+    static const uint8_t lda_jsr[]      = { 0xA9, 0x00, 0x20, 0x00, 0x00 };
+    static const uint8_t lda_jsr_mask[] = { 0xFF, 0x00, 0xFF, 0x00, 0x00 };
+    static const uint8_t copy_x[]       = { 0xBD, 0x00, 0x00, 0x9D, 0x00, 0x00, 0xE8, 0xD0, 0xF7 };
+    static const uint8_t copy_y[]       = { 0xB9, 0x00, 0x00, 0x99, 0x00, 0x00, 0xC8, 0xD0, 0xF7 };
+    static const uint8_t copy_mask[]    = { 0xFF, 0x00, 0x00, 0xFF, 0x00, 0x00, 0xFF, 0xFF, 0xFF };
+    static const uint8_t dex_bne[]      = { 0xCA, 0xD0, 0xFD };
+    static const uint8_t dey_bne[]      = { 0x88, 0xD0, 0xFD };
+    static const uint8_t delay_mask[]   = { 0xFF, 0xFF, 0xFF };
+    int fusion = -1;
+    
+    switch (PEEK(pc)) {
+        case 0xA9:
+            if (decode_match(m, pc, lda_jsr, lda_jsr_mask, 5)) {
+                fusion = FUSION_LDA_IMM_JSR;
+                op->operand2 = PEEK(pc + 3) | (PEEK(pc + 4) << 8);
+                op->length = 5;
+                op->cycles = 2 + 6;
+            }
+            break;
+        case 0xBD:
+        case 0xB9:
+            if (decode_match(m, pc, PEEK(pc) == 0xBD ? copy_x : copy_y, copy_mask, 9)) {
+                fusion = PEEK(pc) == 0xBD ? FUSION_COPY_X : FUSION_COPY_Y;
+                op->operand2 = PEEK(pc + 4) | (PEEK(pc + 5) << 8);
+                op->length = 9;
+                op->cycles = 4 + 5 + 2 + 2;
+            }
+            break;
+        case 0xCA:
+        case 0x88:
+            if (decode_match(m, pc, PEEK(pc) == 0xCA ? dex_bne : dey_bne, delay_mask, 3)) {
+                fusion = PEEK(pc) == 0xCA ? FUSION_DEX_BNE : FUSION_DEY_BNE;
+                op->length = 3;
+                op->cycles = 2 + 2;
+            }
+            break;
+        
+        // Idle loops: every branch below has to lead back to pc
+        case 0x4C:
+            if (op->operand == pc) {
+                fusion = FUSION_IDLE_JMP;
+            }
+            break;
+        case 0xA5:
+            if (is_branch(PEEK(pc + 2)) && PEEK(pc + 3) == 0xFC) {
+                fusion = FUSION_IDLE_POLL_ZP;
+                op->operand2 = PEEK(pc + 2);
+                op->length = 4;
+                op->cycles = 3 + 2;
+            }
+            break;
+        case 0xAD:
+            if (is_branch(PEEK(pc + 3)) && PEEK(pc + 4) == 0xFB) {
+                fusion = FUSION_IDLE_POLL_ABS;
+                op->operand2 = PEEK(pc + 3);
+                op->length = 5;
+                op->cycles = 4 + 2;
+            } else if (PEEK(pc + 3) == 0xC9 && is_branch(PEEK(pc + 5)) && PEEK(pc + 6) == 0xF9) {
+                fusion = FUSION_IDLE_WAIT_ABS;
+                op->operand2 = PEEK(pc + 4) | (PEEK(pc + 5) << 8);  // CMP value, branch opcode
+                op->length = 7;
+                op->cycles = 4 + 2 + 2;
+            }
+            break;
+        default:
+            if (is_branch(PEEK(pc)) && op->operand == pc) {
+                fusion = FUSION_IDLE_BRANCH;
+                op->operand2 = PEEK(pc);
+            }
+            break;
+    }
+    
+    if (fusion >= 0) {
+        op->handler = fused_dispatch[fusion];
+    }
+    return op->length;
+}
+
+/**
+ * Decode the instruction at an address into its cache entry
+ * Watches the pages the instruction bytes live on, so that a write to any
+ * of them drops the entry again. Code in the I/O area reads live device
+ * registers, so it is decoded afresh every time it runs, at the current
+ * cycle and without superinstructions.
+ */
+static const DecodedOp *decode_fill(Machine *m, uint16_t pc, uint64_t cycles) {
+    static _Thread_local DecodedOp uncached;
+    int io = memory_is_io_r(m, pc) || memory_is_io_r(m, pc + DECODE_MAX_SPAN - 1);
+    DecodedOp *page = m->cpu_state.decode_pages[pc >> 8];
+    DecodedOp *op;
+    
+    m->cycles = cycles;
+    uint8_t opcode = PEEK(pc);
+    
+    if (!page && !io) {
+        page = calloc(256, sizeof(DecodedOp));
+        m->cpu_state.decode_pages[pc >> 8] = page;
+    }
+    // Out of memory: decode into a scratch entry that is rebuilt every time
+    op = (page && !io) ? &page[pc & 0xFF] : &uncached;
+    
+    op->length = opcode_sizes[opcode];
+    op->cycles = opcode_cycles[opcode];
+    if (opcode_modes[opcode] == ADDR_RELATIVE) {
+        op->operand = (uint16_t)(pc + 2 + (int8_t)PEEK(pc + 1));
+    } else if (op->length == 3) {
+        op->operand = memory_fetch16_r(m, (uint16_t)(pc + 1));
+    } else if (op->length == 2) {
+        op->operand = PEEK(pc + 1);
+    } else {
+        op->operand = 0;
+    }
+    op->operand2 = 0;
+    op->handler = dispatch[opcode];
+    
+    if (io) {
+        return op;
+    }
+    int span = decode_fuse(m, pc, op);
+    if (page) {
+        memory_watch_code_page_r(m, pc >> 8);
+        if ((pc & 0xFF) + span > 0x100) {
+            memory_watch_code_page_r(m, (pc >> 8) + 1);
+        }
+    }
+    return op;
+}
+
+/**
+ * Find the decoded instruction at an address, decoding it if needed
+ */
+static inline const DecodedOp *decode_op(Machine *m, uint16_t pc, uint64_t cycles) {
+    DecodedOp *page = m->cpu_state.decode_pages[pc >> 8];
+    if (page && page[pc & 0xFF].handler) {
+        return &page[pc & 0xFF];
+    }
+    return decode_fill(m, pc, cycles);
+}
+
+/**
+ * Drop the decoded instructions of a page
+ * Entries near the end of the previous page can depend on bytes here
+ * (operands, or the rest of a superinstruction), so those go as well.
+ */
+void cpu_decode_invalidate(Machine *m, int page) {
+    DecodedOp **pages = m->cpu_state.decode_pages;
+    
+    if (page < 0) {
+        cpu_decode_flush(m);
+        return;
+    }
+    DECODE_GENERATION++;
+    if (pages[page]) {
+        memset(pages[page], 0, 256 * sizeof(DecodedOp));
+    }
+    DecodedOp *previous = pages[(page - 1) & 0xFF];
+    if (previous) {
+        memset(&previous[0x100 - (DECODE_MAX_SPAN - 1)], 0, (DECODE_MAX_SPAN - 1) * sizeof(DecodedOp));
+    }
+}
+
+/**
+ * Drop all decoded instructions
+ */
+void cpu_decode_flush(Machine *m) {
+    DecodedOp **pages = m->cpu_state.decode_pages;
+    
+    DECODE_GENERATION++;
+    for (int i = 0; i < 256; i++) {
+        if (pages[i]) {
+            memset(pages[i], 0, 256 * sizeof(DecodedOp));
+        }
+    }
+}
+
+/**
+ * Free the decoded instruction pages
+ */
+void cpu_decode_release(Machine *m) {
+    DECODE_GENERATION++;
+    for (int i = 0; i < 256; i++) {
+        free(m->cpu_state.decode_pages[i]);
+        m->cpu_state.decode_pages[i] = NULL;
+    }
+}
+
+/**
+ * Print how often each superinstruction ran
+ */
+void cpu_fusion_print_stats(Machine *m) {
+    static const char *names[] = {
+#define X(name, description) description,
+        CPU_FUSION_LIST(X)
+#undef X
+    };
+    
+    printf("Superinstructions:\n");
+    for (int i = 0; i < FUSION_COUNT; i++) {
+        printf("  %-44s %10llu runs %12llu instructions\n", names[i],
+               (unsigned long long)FUSION_RUNS[i], (unsigned long long)FUSION_INSTRUCTIONS[i]);
+    }
+}
+
+#if CPU_COMPUTED_GOTO
+
+/**
+ * Run until the cycle counter reaches the run limit or a KERNAL call traps
+ * Registers live in locals for the whole run and are written back to the
+ * CPU structure only on exit. Each handler ends by looking up the next
+ * decoded instruction and jumping directly to its handler, so there is no
+ * central dispatch branch shared by all opcodes.
+ * Called with NULL by cpu_threaded_init() to fill the dispatch tables,
+ * since the handler addresses are only known inside this function.
+ */
+CpuExitReason cpu_run_threaded(Machine *m) {
+    RunState R;
+    const DecodedOp *op;
+    CpuExitReason reason = CPU_EXIT_BUDGET;
+
+    if (!m) {
+        for (int i = 0; i < 256; i++) {
+            dispatch[i] = &&op_UNIMPLEMENTED;
+        }
+#define X(opcode, name) dispatch[opcode] = &&op_##name;
+        CPU_OPCODE_LIST(X)
+#undef X
+#define X(name, description) fused_dispatch[FUSION_##name] = &&op_##name;
+        CPU_FUSION_LIST(X)
+#undef X
+        return reason;
+    }
+
+    run_state_load(m, &R);
+
+#define RUN_HANDLER(name) goto op_##name
+#define DISPATCH() do { op = decode_op(m, REG_PC, R.cycles); goto *op->handler; } while (0)
+#define NEXT() do { if (R.cycles >= RUN_LIMIT) goto run_exit; DISPATCH(); } while (0)
+#define KERNAL_TRAP(address) do { m->cpu_state.trap_address = (address); reason = CPU_EXIT_KERNAL; goto run_exit; } while (0)
+#define HANDLER(name) op_##name: {
+#define END_HANDLER } NEXT();
+
+    NEXT();
+
+#include "cpu_opcodes.h"
+
+#undef HANDLER
+#undef END_HANDLER
+#undef KERNAL_TRAP
+#undef NEXT
+#undef DISPATCH
+#undef RUN_HANDLER
+
+run_exit:
+    run_state_store(&R);
+    return reason;
+}
+
+#else /* !CPU_COMPUTED_GOTO */
+
+// Handlers return non-zero when the run loop has to stop
+#define R (*r)
+#define RUN_HANDLER(name) return op_##name(r, op)
+#define KERNAL_TRAP(address) do { m->cpu_state.trap_address = (address); return 1; } while (0)
+#define HANDLER(name) static int op_##name(RunState *r, const DecodedOp *op) { Machine *m = r->m; (void)m;
+#define END_HANDLER return 0; }
+
+#include "cpu_opcodes.h"
+
+#undef HANDLER
+#undef END_HANDLER
+#undef KERNAL_TRAP
+#undef RUN_HANDLER
+#undef R
+
+/**
+ * Run until the cycle counter reaches the run limit or a KERNAL call traps
+ * Portable version: one indirect call per decoded instruction, with the
+ * register file held in a local structure that is written back only on exit.
+ * Called with NULL by cpu_threaded_init() to fill the dispatch tables.
+ */
+CpuExitReason cpu_run_threaded(Machine *m) {
+    RunState R;
+    CpuExitReason reason = CPU_EXIT_BUDGET;
+
+    if (!m) {
+        for (int i = 0; i < 256; i++) {
+            dispatch[i] = op_UNIMPLEMENTED;
+        }
+#define X(opcode, name) dispatch[opcode] = op_##name;
+        CPU_OPCODE_LIST(X)
+#undef X
+#define X(name, description) fused_dispatch[FUSION_##name] = op_##name;
+        CPU_FUSION_LIST(X)
+#undef X
+        return reason;
+    }
+
+    run_state_load(m, &R);
+    while (R.cycles < RUN_LIMIT) {
+        const DecodedOp *op = decode_op(m, R.pc, R.cycles);
+        if (op->handler(&R, op)) {
+            reason = CPU_EXIT_KERNAL;
+            break;
+        }
+    }
+    run_state_store(&R);
+    return reason;
+}
+
+#endif /* CPU_COMPUTED_GOTO */
+
+/**
+ * Build the dispatch tables shared by all machines
+ */
+void cpu_threaded_init() {
+    cpu_run_threaded(NULL);
+}
@@ -8,183 +8,583 @@
 #include <string.h>
 #include <ctype.h>
 #include "io.h"
+#include "../cpu/cpu.h"
 #include "../memory/memory.h"
+#include "../sched/sched.h"
+#include "../machine/machine.h"
 
-// I/O registers
-static uint8_t vic_registers[VIC_REGISTERS_SIZE];
-static uint8_t sid_registers[SID_REGISTERS_SIZE];
-static uint8_t cia1_registers[CIA_REGISTERS_SIZE];
-static uint8_t cia2_registers[CIA_REGISTERS_SIZE];
-
-// Screen data
-static uint8_t screen_data[40 * 25];
-static uint8_t color_data[40 * 25];
-
-// Keyboard state
-static uint8_t keyboard_matrix[8];  // 8x8 keyboard matrix
-static int audio_enabled = 1;
+// Scheduler event arguments of the CIA timers: CIA number * 2 + timer index
+#define CIA_TIMER_ARG(cia_number, index) ((cia_number) * 2 + (index))
 
 /**
- * Initialize the I/O subsystems
+ * Check whether a CIA timer is counting CPU cycles
  */
-void io_init() {
-    // Clear all registers
-    memset(vic_registers, 0, sizeof(vic_registers));
-    memset(sid_registers, 0, sizeof(sid_registers));
-    memset(cia1_registers, 0, sizeof(cia1_registers));
-    memset(cia2_registers, 0, sizeof(cia2_registers));
+static int cia_timer_running(const Cia *cia, int index) {
+    uint8_t control = cia->registers[0x0E + index];
     
-    // Clear screen and color memory
-    memset(screen_data, 32, sizeof(screen_data));  // Fill with spaces
-    memset(color_data, 14, sizeof(color_data));    // Fill with light blue
+    // Timer B can also count timer A underflows or CNT pulses; those modes aren't modelled
+    if (index == 1 && (control & 0x60)) {
+        return 0;
+    }
+    return control & 0x01;
+}
+
+/**
+ * Current value of a CIA timer
+ */
+static uint16_t cia_timer_value(const Cia *cia, int index, uint64_t now) {
+    const CiaTimer *timer = &cia->timers[index];
     
-    // Clear keyboard matrix
-    memset(keyboard_matrix, 0xFF, sizeof(keyboard_matrix));
+    if (!cia_timer_running(cia, index) || now < timer->base_cycle) {
+        return timer->counter;
+    }
     
-    // Set up default VIC-II registers
-    vic_registers[0x11] = 0x1B;  // Screen control register
-    vic_registers[0x16] = 0x08;  // Screen control register
-    vic_registers[0x18] = 0x14;  // Memory setup
-    vic_registers[0x20] = 0x0F;  // Border color (light blue)
-    vic_registers[0x21] = 0x06;  // Background color (blue)
+    uint64_t elapsed = now - timer->base_cycle;
+    if (elapsed <= timer->counter) {
+        return timer->counter - elapsed;
+    }
     
-    // Set up default CIA registers
-    cia1_registers[0x0D] = 0x00;  // CIA 1 ICR
-    cia2_registers[0x0D] = 0x00;  // CIA 2 ICR
+    // Between an underflow and its event being handled: the timer has reloaded
+    if (cia->registers[0x0E + index] & 0x08) {
+        return timer->latch;
+    }
+    return timer->latch - (elapsed - timer->counter - 1) % (timer->latch + 1);
+}
+
+/**
+ * Restart a CIA timer from a value and schedule its underflow
+ */
+static void cia_timer_restart(Machine *m, Cia *cia, int index, uint16_t value, uint64_t now) {
+    CiaTimer *timer = &cia->timers[index];
     
-    // Clear the screen
-    io_clear_screen();
+    timer->counter = value;
+    timer->base_cycle = now;
+    if (cia_timer_running(cia, index)) {
+        sched_schedule(m, timer->event, now + value + 1);
+    } else {
+        sched_cancel(m, timer->event);
+    }
 }
 
 /**
- * Update I/O state (called once per frame)
+ * Latch CIA interrupt sources and raise the interrupt if any is enabled
  */
-void io_update() {
-    // Update timers and other I/O components that need regular updates
-    // For now, this is a placeholder
+static void cia_raise(Machine *m, Cia *cia, uint8_t sources) {
+    cia->icr_data |= sources;
+    if ((cia->icr_data & cia->icr_mask & 0x1F) && !(cia->icr_data & 0x80)) {
+        cia->icr_data |= 0x80;
+        cpu_request_interrupt_r(m, cia->is_nmi);
+    }
+}
+
+/**
+ * Scheduler event: a CIA timer underflowed (arg from CIA_TIMER_ARG())
+ */
+static void cia_timer_underflow(Machine *m, int arg, uint64_t cycle) {
+    Cia *cia = (arg / 2) ? &m->io.cia2 : &m->io.cia1;
+    int index = arg % 2;
+    uint8_t *control = &cia->registers[0x0E + index];
+    
+    cia_raise(m, cia, 1 << index);
     
-    // Update the display
-    io_update_display();
+    // One-shot timers stop after reloading; continuous ones count on from the latch
+    if (*control & 0x08) {
+        *control &= ~0x01;
+    }
+    cia_timer_restart(m, cia, index, cia->timers[index].latch, cycle);
 }
 
 /**
- * Read from an I/O register
+ * Register a CIA's timer events and reset its timers and interrupt state
  */
-uint8_t io_read(uint16_t address) {
-    // VIC-II registers (Video Interface Controller)
-    if (address >= VIC_BASE_ADDRESS && address < VIC_BASE_ADDRESS + VIC_REGISTERS_SIZE) {
-        return vic_registers[address - VIC_BASE_ADDRESS];
+static void cia_init(Machine *m, Cia *cia, int cia_number, const char *name_a, const char *name_b) {
+    cia->timers[0].event = sched_register(m, name_a, cia_timer_underflow, CIA_TIMER_ARG(cia_number, 0));
+    cia->timers[1].event = sched_register(m, name_b, cia_timer_underflow, CIA_TIMER_ARG(cia_number, 1));
+    cia->icr_data = 0;
+    cia->icr_mask = 0;
+    cia->is_nmi = cia_number == 1;
+    for (int i = 0; i < 2; i++) {
+        cia->timers[i].latch = 0xFFFF;
+        cia->timers[i].counter = 0xFFFF;
+        sched_cancel(m, cia->timers[i].event);
     }
+}
+
+/**
+ * Read a CIA register
+ */
+static uint8_t cia_read(Machine *m, Cia *cia, uint8_t reg) {
+    uint64_t now = m->cycles;
     
-    // SID registers (Sound Interface Device)
-    if (address >= SID_BASE_ADDRESS && address < SID_BASE_ADDRESS + SID_REGISTERS_SIZE) {
-        return sid_registers[address - SID_BASE_ADDRESS];
+    switch (reg) {
+        case 0x04: return cia_timer_value(cia, 0, now) & 0xFF;
+        case 0x05: return cia_timer_value(cia, 0, now) >> 8;
+        case 0x06: return cia_timer_value(cia, 1, now) & 0xFF;
+        case 0x07: return cia_timer_value(cia, 1, now) >> 8;
+        case 0x0D:
+            {
+                // Reading the ICR acknowledges every source
+                uint8_t value = cia->icr_data;
+                cia->icr_data = 0;
+                return value;
+            }
+        default:
+            return cia->registers[reg];
     }
+}
+
+/**
+ * Write a CIA register
+ */
+static void cia_write(Machine *m, Cia *cia, uint8_t reg, uint8_t value) {
+    uint64_t now = m->cycles;
     
-    // CIA1 registers (Complex Interface Adapter 1 - Keyboard, Joystick, etc.)
-    if (address >= CIA1_BASE_ADDRESS && address < CIA1_BASE_ADDRESS + CIA_REGISTERS_SIZE) {
-        // Special handling for keyboard matrix
-        if (address == CIA1_BASE_ADDRESS) {
-            // Keyboard matrix
-            uint8_t row_select = cia1_registers[0] & 0xFF;
-            uint8_t result = 0xFF;
-            
-            // Return key state for the selected rows
-            for (int row = 0; row < 8; row++) {
-                if (!(row_select & (1 << row))) {
-                    result &= keyboard_matrix[row];
+    switch (reg) {
+        case 0x04:
+        case 0x06:
+            {
+                CiaTimer *timer = &cia->timers[(reg - 0x04) / 2];
+                timer->latch = (timer->latch & 0xFF00) | value;
+            }
+            break;
+        case 0x05:
+        case 0x07:
+            {
+                // A stopped timer loads the latch when its high byte is written
+                int index = (reg - 0x04) / 2;
+                CiaTimer *timer = &cia->timers[index];
+                timer->latch = (timer->latch & 0x00FF) | (value << 8);
+                if (!cia_timer_running(cia, index)) {
+                    timer->counter = timer->latch;
                 }
             }
-            return result;
-        }
-        return cia1_registers[address - CIA1_BASE_ADDRESS];
+            break;
+        case 0x0D:
+            // Bit 7 selects whether the other set bits enable or disable sources
+            if (value & 0x80) {
+                cia->icr_mask |= value & 0x1F;
+            } else {
+                cia->icr_mask &= ~value;
+            }
+            cia_raise(m, cia, 0);
+            break;
+        case 0x0E:
+        case 0x0F:
+            {
+                // Bit 4 (force load) is a strobe and doesn't stay set
+                int index = reg - 0x0E;
+                uint16_t current = cia_timer_value(cia, index, now);
+                cia->registers[reg] = value & ~0x10;
+                cia_timer_restart(m, cia, index, (value & 0x10) ? cia->timers[index].latch : current, now);
+            }
+            break;
+        default:
+            cia->registers[reg] = value;
+            break;
     }
+}
+
+/**
+ * Raster compare line from $D012 and bit 7 of $D011
+ */
+static uint16_t vic_raster_compare(Machine *m) {
+    return m->io.vic_registers[0x12] | ((m->io.vic_registers[0x11] & 0x80) << 1);
+}
+
+/**
+ * Schedule the raster event for the next start of the compare line
+ */
+static void vic_schedule_raster(Machine *m) {
+    uint64_t now = m->cycles;
+    uint16_t line = vic_raster_compare(m);
     
-    // CIA2 registers (Complex Interface Adapter 2 - Serial bus, User port, etc.)
-    if (address >= CIA2_BASE_ADDRESS && address < CIA2_BASE_ADDRESS + CIA_REGISTERS_SIZE) {
-        return cia2_registers[address - CIA2_BASE_ADDRESS];
+    if (line >= VIC_LINES_PER_FRAME) {
+        sched_cancel(m, m->io.raster_event);  // Never reached
+        return;
     }
     
-    // Default case - return 0xFF for unimplemented registers
-    return 0xFF;
+    uint64_t cycle = now - now % VIC_CYCLES_PER_FRAME + line * VIC_CYCLES_PER_LINE;
+    if (cycle < now) {
+        cycle += VIC_CYCLES_PER_FRAME;
+    }
+    sched_schedule(m, m->io.raster_event, cycle);
 }
 
 /**
- * Write to an I/O register
+ * Latch VIC-II interrupt sources and raise an IRQ if any is enabled
  */
-void io_write(uint16_t address, uint8_t value) {
-    // VIC-II registers
-    if (address >= VIC_BASE_ADDRESS && address < VIC_BASE_ADDRESS + VIC_REGISTERS_SIZE) {
-        vic_registers[address - VIC_BASE_ADDRESS] = value;
-        return;
+static void vic_raise(Machine *m, uint8_t sources) {
+    m->io.vic_irq_latch |= sources;
+    if (m->io.vic_irq_latch & m->io.vic_irq_mask & 0x0F) {
+        cpu_request_interrupt_r(m, 0);
     }
+}
+
+/**
+ * Scheduler event: the raster reached the compare line
+ */
+static void vic_raster_event(Machine *m, int arg, uint64_t cycle) {
+    (void)arg;
+    vic_raise(m, 0x01);
+    sched_schedule(m, m->io.raster_event, cycle + VIC_CYCLES_PER_FRAME);
+}
+
+/**
+ * Scheduler event: a frame has been completed
+ */
+static void vic_frame_event(Machine *m, int arg, uint64_t cycle) {
+    (void)arg;
+    m->io.frame_count++;
+    
+    // Input is sampled once per frame
+    io_handle_keyboard_input_r(m);
+    if (m->io.frame_hook) {
+        m->io.frame_hook(m, m->io.frame_count);
+    }
+    sched_schedule(m, m->io.frame_event, cycle + VIC_CYCLES_PER_FRAME);
+}
+
+/**
+ * Read a VIC-II register
+ */
+static uint8_t vic_read(Machine *m, uint16_t reg) {
+    IoState *io = &m->io;
+    
+    switch (reg) {
+        case 0x11: return (io->vic_registers[0x11] & 0x7F) | ((io_get_raster_line_r(m) >> 1) & 0x80);
+        case 0x12: return io_get_raster_line_r(m) & 0xFF;
+        case 0x19: return io->vic_irq_latch | ((io->vic_irq_latch & io->vic_irq_mask) ? 0x80 : 0) | 0x70;
+        case 0x1A: return io->vic_irq_mask | 0xF0;
+        default:   return io->vic_registers[reg];
+    }
+}
+
+/**
+ * Peek a VIC-II register
+ * The raster line ($D011 bit 7, $D012) follows the cycle count and
+ * changes at the start of each line; the other registers only change on
+ * writes and scheduler events.
+ */
+static uint64_t vic_peek(Machine *m, uint16_t reg, uint64_t cycle, uint8_t *value) {
+    IoState *io = &m->io;
+    
+    if (reg != 0x11 && reg != 0x12) {
+        *value = vic_read(m, reg);
+        return IO_PEEK_NEVER;
+    }
+    uint16_t line = (cycle / VIC_CYCLES_PER_LINE) % VIC_LINES_PER_FRAME;
+    *value = reg == 0x12 ? (line & 0xFF) : ((io->vic_registers[0x11] & 0x7F) | ((line >> 1) & 0x80));
+    return (cycle / VIC_CYCLES_PER_LINE + 1) * VIC_CYCLES_PER_LINE;
+}
+
+/**
+ * Write a VIC-II register
+ */
+static void vic_write(Machine *m, uint16_t reg, uint8_t value) {
+    IoState *io = &m->io;
+    
+    switch (reg) {
+        case 0x19:
+            // Writing 1 to a source acknowledges it
+            io->vic_irq_latch &= ~value & 0x0F;
+            break;
+        case 0x1A:
+            io->vic_irq_mask = value & 0x0F;
+            vic_raise(m, 0);
+            break;
+        default:
+            io->vic_registers[reg] = value;
+            if (reg == 0x11 || reg == 0x12) {
+                vic_schedule_raster(m);  // Raster compare line changed
+            }
+            break;
+    }
+}
+
+/**
+ * Read a SID register
+ */
+static uint8_t sid_read(Machine *m, uint16_t reg) {
+    return m->io.sid_registers[reg];
+}
+
+/**
+ * Write a SID register
+ */
+static void sid_write(Machine *m, uint16_t reg, uint8_t value) {
+    m->io.sid_registers[reg] = value;
+    // If writing to a frequency register, potentially generate sound
+    if (reg == 0x01 && m->io.audio_enabled) {
+        io_beep_r(m);
+    }
+}
+
+/**
+ * Read Color RAM; the upper nybble is not connected
+ */
+static uint8_t color_ram_read(Machine *m, uint16_t reg) {
+    return m->io.color_ram[reg] | 0xF0;
+}
+
+/**
+ * Write Color RAM
+ */
+static void color_ram_write(Machine *m, uint16_t reg, uint8_t value) {
+    m->io.color_ram[reg] = value & 0x0F;
+}
+
+/**
+ * Read a CIA1 register (keyboard, joystick, IRQ timers)
+ */
+static uint8_t cia1_read(Machine *m, uint16_t reg) {
+    IoState *io = &m->io;
     
-    // SID registers
-    if (address >= SID_BASE_ADDRESS && address < SID_BASE_ADDRESS + SID_REGISTERS_SIZE) {
-        sid_registers[address - SID_BASE_ADDRESS] = value;
-        // If writing to a frequency register, potentially generate sound
-        if ((address - SID_BASE_ADDRESS) == 0x01 && audio_enabled) {
-            io_beep();
+    // Special handling for keyboard matrix
+    if (reg == 0x00) {
+        uint8_t row_select = io->cia1.registers[0] & 0xFF;
+        uint8_t result = 0xFF;
+        
+        // Return key state for the selected rows
+        for (int row = 0; row < 8; row++) {
+            if (!(row_select & (1 << row))) {
+                result &= io->keyboard_matrix[row];
+            }
         }
-        return;
+        return result;
     }
+    return cia_read(m, &io->cia1, reg);
+}
+
+/**
+ * Write a CIA1 register
+ */
+static void cia1_write(Machine *m, uint16_t reg, uint8_t value) {
+    cia_write(m, &m->io.cia1, reg, value);
+}
+
+/**
+ * Read a CIA2 register (serial bus, user port, NMI timers)
+ */
+static uint8_t cia2_read(Machine *m, uint16_t reg) {
+    return cia_read(m, &m->io.cia2, reg);
+}
+
+/**
+ * Write a CIA2 register
+ */
+static void cia2_write(Machine *m, uint16_t reg, uint8_t value) {
+    cia_write(m, &m->io.cia2, reg, value);
+}
+
+/**
+ * Unconnected I/O page (I/O 1 and 2 without a cartridge): reads $FF
+ */
+static uint8_t open_read(Machine *m, uint16_t reg) {
+    (void)m;
+    (void)reg;
+    return 0xFF;
+}
+
+/**
+ * Unconnected I/O page: writes are dropped
+ */
+static void open_write(Machine *m, uint16_t reg, uint8_t value) {
+    (void)m;
+    (void)reg;
+    (void)value;
+}
+
+/**
+ * Initialize the I/O subsystems
+ */
+void io_init_r(Machine *m) {
+    IoState *io = &m->io;
+    
+    // Clear all registers
+    memset(io->vic_registers, 0, sizeof(io->vic_registers));
+    memset(io->sid_registers, 0, sizeof(io->sid_registers));
+    memset(io->cia1.registers, 0, sizeof(io->cia1.registers));
+    memset(io->cia2.registers, 0, sizeof(io->cia2.registers));
+    
+    // Clear screen and color memory
+    memset(io->screen_data, 32, sizeof(io->screen_data));  // Fill with spaces
+    memset(io->color_ram, 14, sizeof(io->color_ram));      // Fill with light blue
+    
+    // Clear keyboard matrix
+    memset(io->keyboard_matrix, 0xFF, sizeof(io->keyboard_matrix));
+    io->audio_enabled = 1;
+    
+    // Set up default VIC-II registers
+    io->vic_registers[0x11] = 0x1B;  // Screen control register
+    io->vic_registers[0x16] = 0x08;  // Screen control register
+    io->vic_registers[0x18] = 0x14;  // Memory setup
+    io->vic_registers[0x20] = 0x0F;  // Border color (light blue)
+    io->vic_registers[0x21] = 0x06;  // Background color (blue)
+    
+    // Map the devices; each one mirrors its registers across its pages
+    io_map_device_r(m, 0xD000, 0xD3FF, vic_read, vic_write, VIC_REGISTERS_SIZE - 1);
+    io_map_device_r(m, 0xD400, 0xD7FF, sid_read, sid_write, SID_REGISTERS_SIZE - 1);
+    io_map_device_r(m, 0xD800, 0xDBFF, color_ram_read, color_ram_write, COLOR_RAM_SIZE - 1);
+    io_map_device_r(m, 0xDC00, 0xDCFF, cia1_read, cia1_write, CIA_REGISTERS_SIZE - 1);
+    io_map_device_r(m, 0xDD00, 0xDDFF, cia2_read, cia2_write, CIA_REGISTERS_SIZE - 1);
+    io_map_device_r(m, 0xDE00, 0xDFFF, open_read, open_write, 0xFF);
+    io_map_peek_r(m, 0xD000, 0xD3FF, vic_peek);
     
-    // CIA1 registers
-    if (address >= CIA1_BASE_ADDRESS && address < CIA1_BASE_ADDRESS + CIA_REGISTERS_SIZE) {
-        cia1_registers[address - CIA1_BASE_ADDRESS] = value;
+    // Set up default CIA registers
+    io->cia1.registers[0x0D] = 0x00;  // CIA 1 ICR
+    io->cia2.registers[0x0D] = 0x00;  // CIA 2 ICR
+    
+    // Device timing runs on scheduler events from the current cycle on
+    io->frame_event = sched_register(m, "VIC frame", vic_frame_event, 0);
+    io->raster_event = sched_register(m, "VIC raster", vic_raster_event, 0);
+    cia_init(m, &io->cia1, 0, "CIA1 timer A", "CIA1 timer B");
+    cia_init(m, &io->cia2, 1, "CIA2 timer A", "CIA2 timer B");
+    io->vic_irq_latch = 0;
+    io->vic_irq_mask = 0;
+    io->frame_count = 0;
+    uint64_t now = m->cycles;
+    sched_schedule(m, io->frame_event, now - now % VIC_CYCLES_PER_FRAME + VIC_CYCLES_PER_FRAME);
+    vic_schedule_raster(m);
+    
+    // Clear the screen
+    io_clear_screen_r(m);
+}
+
+/**
+ * Update I/O state
+ * Device timing is driven by scheduler events; this only redraws the
+ * screen, and only when screen memory was written since the last redraw.
+ */
+void io_update_r(Machine *m) {
+    if (!memory_take_dirty_range_r(m, MEMORY_DIRTY_SCREEN, SCREEN_MEMORY_START >> 8,
+                                   (SCREEN_MEMORY_START + sizeof(m->io.screen_data) - 1) >> 8)) {
         return;
     }
+    memory_read_block_r(m, SCREEN_MEMORY_START, m->io.screen_data, sizeof(m->io.screen_data));
+    io_update_display_r(m);
+}
+
+/**
+ * Map a device to the I/O pages from start to end
+ */
+void io_map_device_r(Machine *m, uint16_t start, uint16_t end, IoReadHandler read, IoWriteHandler write, uint16_t mask) {
+    for (int page = (start >> 8) & 0x0F; page <= ((end >> 8) & 0x0F); page++) {
+        m->io.pages[page].read = read;
+        m->io.pages[page].write = write;
+        m->io.pages[page].peek = NULL;
+        m->io.pages[page].mask = mask;
+    }
+}
+
+/**
+ * Let idle loops predict reads of the I/O pages from start to end
+ */
+void io_map_peek_r(Machine *m, uint16_t start, uint16_t end, IoPeekHandler peek) {
+    for (int page = (start >> 8) & 0x0F; page <= ((end >> 8) & 0x0F); page++) {
+        m->io.pages[page].peek = peek;
+    }
+}
+
+/**
+ * Predict a read of an I/O register at a cycle
+ */
+uint64_t io_peek_r(Machine *m, uint16_t address, uint64_t cycle, uint8_t *value) {
+    const IoPage *page = &m->io.pages[(address >> 8) & 0x0F];
     
-    // CIA2 registers
-    if (address >= CIA2_BASE_ADDRESS && address < CIA2_BASE_ADDRESS + CIA_REGISTERS_SIZE) {
-        cia2_registers[address - CIA2_BASE_ADDRESS] = value;
-        return;
+    if (!page->peek) {
+        return IO_PEEK_UNKNOWN;
+    }
+    return page->peek(m, address & page->mask, cycle, value);
+}
+
+/**
+ * Read from an I/O register
+ */
+uint8_t io_read_r(Machine *m, uint16_t address) {
+    const IoPage *page = &m->io.pages[(address >> 8) & 0x0F];
+    
+    // Pages with no device (before io_init()) read as open bus
+    if (!page->read) {
+        return 0xFF;
+    }
+    return page->read(m, address & page->mask);
+}
+
+/**
+ * Write to an I/O register
+ */
+void io_write_r(Machine *m, uint16_t address, uint8_t value) {
+    const IoPage *page = &m->io.pages[(address >> 8) & 0x0F];
+    
+    if (page->write) {
+        page->write(m, address & page->mask, value);
     }
 }
 
+/**
+ * Current raster line, derived from the cycle counter
+ */
+uint16_t io_get_raster_line_r(Machine *m) {
+    return (m->cycles / VIC_CYCLES_PER_LINE) % VIC_LINES_PER_FRAME;
+}
+
+/**
+ * Number of frames completed since io_init()
+ */
+uint64_t io_get_frame_count_r(Machine *m) {
+    return m->io.frame_count;
+}
+
+/**
+ * Install a function to call at the end of every frame
+ */
+void io_set_frame_hook_r(Machine *m, IoFrameHook hook) {
+    m->io.frame_hook = hook;
+}
+
 /**
  * Handle keyboard input
  */
-void io_handle_keyboard_input() {
+void io_handle_keyboard_input_r(Machine *m) {
     // In a real implementation, this would read input from the host system
     // and update the keyboard matrix accordingly
     // For now, this is a placeholder
+    (void)m;
 }
 
 /**
  * Set a key in the keyboard matrix as pressed or released
  */
-void io_set_key_pressed(uint8_t key, int is_pressed) {
+void io_set_key_pressed_r(Machine *m, uint8_t key, int is_pressed) {
     // Key is encoded as (row << 4) | column
     uint8_t row = (key >> 4) & 0x07;
     uint8_t col = key & 0x07;
     
     if (is_pressed) {
         // When a key is pressed, the corresponding bit is cleared
-        keyboard_matrix[row] &= ~(1 << col);
+        m->io.keyboard_matrix[row] &= ~(1 << col);
     } else {
         // When a key is released, the corresponding bit is set
-        keyboard_matrix[row] |= (1 << col);
+        m->io.keyboard_matrix[row] |= (1 << col);
     }
 }
 
 /**
  * Clear the screen
  */
-void io_clear_screen() {
-    memset(screen_data, 32, sizeof(screen_data));  // Fill with spaces
+void io_clear_screen_r(Machine *m) {
+    memset(m->io.screen_data, 32, sizeof(m->io.screen_data));  // Fill with spaces
+    
+    memset(m->io.color_ram, 14, 1000);                          // Light blue
     
     // Update screen memory
-    for (int i = 0; i < 1000; i++) {
-        memory_write(SCREEN_MEMORY_START + i, 32);  // Space character
-        memory_write(COLOR_RAM_START + i, 14);     // Light blue
-    }
+    memory_fill_r(m, SCREEN_MEMORY_START, 32, 1000);  // Space character
 }
 
 /**
  * Print text at the specified screen position
  */
-void io_print_text(uint8_t x, uint8_t y, const char* text) {
+void io_print_text_r(Machine *m, uint8_t x, uint8_t y, const char* text) {
     if (x >= 40 || y >= 25) {
         return;  // Out of bounds
     }
@@ -217,17 +617,17 @@ void io_print_text(uint8_t x, uint8_t y, const char* text) {
             petscii = c;  // Other characters, not properly mapped
         }
         
-        // Write to screen memory
-        memory_write(SCREEN_MEMORY_START + screen_pos + i, petscii);
-        // Also update our internal buffer
-        screen_data[screen_pos + i] = petscii;
+        m->io.screen_data[screen_pos + i] = petscii;
     }
+    
+    // Write the converted text to screen memory in one block
+    memory_write_block_r(m, SCREEN_MEMORY_START + screen_pos, &m->io.screen_data[screen_pos], text_len);
 }
 
 /**
  * Update the display
  */
-void io_update_display() {
+void io_update_display_r(Machine *m) {
     // In a real implementation, this would render the screen based on VIC-II state
     // For now, this is a simplified version that just uses our internal buffer
     
@@ -237,7 +637,7 @@ void io_update_display() {
     // Draw the screen
     for (int y = 0; y < 25; y++) {
         for (int x = 0; x < 40; x++) {
-            uint8_t character = screen_data[y * 40 + x];
+            uint8_t character = m->io.screen_data[y * 40 + x];
             
             // Convert PETSCII to ASCII for terminal output (very simplified)
             char ascii;
@@ -262,8 +662,8 @@ void io_update_display() {
 /**
  * Generate a beep sound
  */
-void io_beep() {
-    if (audio_enabled) {
+void io_beep_r(Machine *m) {
+    if (m->io.audio_enabled) {
         // In a real implementation, this would use the host system to generate sound
         // For now, just print a placeholder
         printf("\007");  // ASCII BEL character may generate a beep on some terminals
@@ -273,6 +673,78 @@ void io_beep() {
 /**
  * Enable or disable audio
  */
+void io_set_audio_enabled_r(Machine *m, int enabled) {
+    m->io.audio_enabled = enabled;
+}
+
+/* ------------------------------------------------------------------ */
+/* Single-machine API                                                 */
+/* ------------------------------------------------------------------ */
+
+void io_init() {
+    io_init_r(machine_default());
+}
+
+void io_update() {
+    io_update_r(machine_default());
+}
+
+uint8_t io_read(uint16_t address) {
+    return io_read_r(machine_default(), address);
+}
+
+void io_write(uint16_t address, uint8_t value) {
+    io_write_r(machine_default(), address, value);
+}
+
+void io_map_device(uint16_t start, uint16_t end, IoReadHandler read, IoWriteHandler write, uint16_t mask) {
+    io_map_device_r(machine_default(), start, end, read, write, mask);
+}
+
+void io_map_peek(uint16_t start, uint16_t end, IoPeekHandler peek) {
+    io_map_peek_r(machine_default(), start, end, peek);
+}
+
+uint64_t io_peek(uint16_t address, uint64_t cycle, uint8_t *value) {
+    return io_peek_r(machine_default(), address, cycle, value);
+}
+
+void io_handle_keyboard_input() {
+    io_handle_keyboard_input_r(machine_default());
+}
+
+void io_set_key_pressed(uint8_t key, int is_pressed) {
+    io_set_key_pressed_r(machine_default(), key, is_pressed);
+}
+
+uint16_t io_get_raster_line() {
+    return io_get_raster_line_r(machine_default());
+}
+
+uint64_t io_get_frame_count() {
+    return io_get_frame_count_r(machine_default());
+}
+
+void io_set_frame_hook(IoFrameHook hook) {
+    io_set_frame_hook_r(machine_default(), hook);
+}
+
+void io_clear_screen() {
+    io_clear_screen_r(machine_default());
+}
+
+void io_print_text(uint8_t x, uint8_t y, const char* text) {
+    io_print_text_r(machine_default(), x, y, text);
+}
+
+void io_update_display() {
+    io_update_display_r(machine_default());
+}
+
+void io_beep() {
+    io_beep_r(machine_default());
+}
+
 void io_set_audio_enabled(int enabled) {
-    audio_enabled = enabled;
-}
\ No newline at end of file
+    io_set_audio_enabled_r(machine_default(), enabled);
+}
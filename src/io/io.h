@@ -21,20 +21,169 @@
 #define CIA2_BASE_ADDRESS 0xDD00
 #define CIA_REGISTERS_SIZE 0x10
 
+// Color RAM (4 bits per cell)
+#define COLOR_RAM_BASE_ADDRESS 0xD800
+#define COLOR_RAM_SIZE 0x400
+
+// I/O area: one device per 256-byte page from $D000 to $DFFF
+#define IO_BASE_ADDRESS 0xD000
+#define IO_PAGE_COUNT 16
+
+// PAL video timing, in CPU cycles
+#define VIC_CYCLES_PER_LINE 63
+#define VIC_LINES_PER_FRAME 312
+#define VIC_CYCLES_PER_FRAME (VIC_CYCLES_PER_LINE * VIC_LINES_PER_FRAME)
+
+/*
+ * Device timing
+ *
+ * CIA timer underflows, the VIC-II raster compare line and the end of
+ * each frame are scheduler events (see src/sched/sched.h), so nothing is
+ * polled per instruction. CIA1 and the VIC-II raise IRQs, CIA2 raises NMIs.
+ * Timers count CPU cycles only; timer B counting timer A underflows is not
+ * modelled. io_init() (re)schedules everything relative to the current cycle.
+ */
+
+// Emulator instance (see src/machine/machine.h)
+typedef struct Machine Machine;
+
+/**
+ * Frame hook
+ * @param frame Number of frames completed since io_init()
+ */
+typedef void (*IoFrameHook)(Machine *m, uint64_t frame);
+
+/**
+ * I/O device register handlers
+ * reg is the address ANDed with the device's register mask, so every
+ * mirror of a register reaches the handler as the same reg.
+ */
+typedef uint8_t (*IoReadHandler)(Machine *m, uint16_t reg);
+typedef void (*IoWriteHandler)(Machine *m, uint16_t reg, uint8_t value);
+
+/**
+ * I/O register peek handler
+ * Tells what a read of reg at a cycle would return, without its side
+ * effects, and until when, assuming nothing but the cycle count changes
+ * (no writes or scheduler events) in between.
+ *
+ * @param value Set to the value read at cycle
+ * @return First cycle after cycle at which the value may differ
+ *         (IO_PEEK_NEVER if it can't), or IO_PEEK_UNKNOWN if the device
+ *         can't tell
+ */
+typedef uint64_t (*IoPeekHandler)(Machine *m, uint16_t reg, uint64_t cycle, uint8_t *value);
+
+#define IO_PEEK_UNKNOWN 0
+#define IO_PEEK_NEVER   UINT64_MAX
+
+/**
+ * Device mapped to an I/O page
+ */
+typedef struct {
+    IoReadHandler read;
+    IoWriteHandler write;
+    IoPeekHandler peek;    // NULL if reads can't be predicted (see io_map_peek())
+    uint16_t mask;         // Register mirroring: address bits the device decodes
+} IoPage;
+
+/**
+ * CIA interval timer
+ * While running, the timer counted down from counter at base_cycle and
+ * its underflow is a scheduler event; while stopped, counter holds the value.
+ */
+typedef struct {
+    uint16_t latch;        // Reload value
+    uint16_t counter;
+    uint64_t base_cycle;
+    int event;             // Scheduler event for the underflow
+} CiaTimer;
+
+/**
+ * CIA chip: register file, timers and interrupt state
+ */
+typedef struct {
+    uint8_t registers[CIA_REGISTERS_SIZE];
+    CiaTimer timers[2];    // Timer A and timer B
+    uint8_t icr_data;      // Latched interrupt sources (bit 7: interrupt raised)
+    uint8_t icr_mask;      // Enabled interrupt sources
+    int is_nmi;            // CIA2 is wired to NMI, CIA1 to IRQ
+} Cia;
+
+/**
+ * I/O chips, screen and keyboard of one machine
+ */
+typedef struct {
+    // Device of each page from $D000 to $DFFF (see io_map_device())
+    IoPage pages[IO_PAGE_COUNT];
+    
+    // I/O registers
+    uint8_t vic_registers[VIC_REGISTERS_SIZE];
+    uint8_t sid_registers[SID_REGISTERS_SIZE];
+    Cia cia1;
+    Cia cia2;
+    
+    // Screen data
+    uint8_t screen_data[40 * 25];
+    uint8_t color_ram[COLOR_RAM_SIZE];  // Low nybble of each cell
+    
+    // Keyboard state
+    uint8_t keyboard_matrix[8];  // 8x8 keyboard matrix
+    int audio_enabled;
+    
+    // VIC-II interrupt and frame state
+    uint8_t vic_irq_latch;       // $D019 sources
+    uint8_t vic_irq_mask;        // $D01A
+    uint64_t frame_count;
+    IoFrameHook frame_hook;
+    int raster_event;            // Scheduler events
+    int frame_event;
+} IoState;
+
 // I/O functions
+void io_init_r(Machine *m);
+void io_update_r(Machine *m);
+uint8_t io_read_r(Machine *m, uint16_t address);
+void io_write_r(Machine *m, uint16_t address, uint8_t value);
+void io_map_device_r(Machine *m, uint16_t start, uint16_t end, IoReadHandler read, IoWriteHandler write, uint16_t mask);
+void io_map_peek_r(Machine *m, uint16_t start, uint16_t end, IoPeekHandler peek);
+uint64_t io_peek_r(Machine *m, uint16_t address, uint64_t cycle, uint8_t *value);
+void io_handle_keyboard_input_r(Machine *m);
+void io_set_key_pressed_r(Machine *m, uint8_t key, int is_pressed);
+
+// Timing functions
+uint16_t io_get_raster_line_r(Machine *m);
+uint64_t io_get_frame_count_r(Machine *m);
+void io_set_frame_hook_r(Machine *m, IoFrameHook hook);
+
+// Screen functions
+void io_clear_screen_r(Machine *m);
+void io_print_text_r(Machine *m, uint8_t x, uint8_t y, const char* text);
+void io_update_display_r(Machine *m);
+
+// Audio functions
+void io_beep_r(Machine *m);
+void io_set_audio_enabled_r(Machine *m, int enabled);
+
+/*
+ * Single-machine API
+ * Each function below calls its _r variant with machine_default().
+ */
 void io_init();
 void io_update();
 uint8_t io_read(uint16_t address);
 void io_write(uint16_t address, uint8_t value);
+void io_map_device(uint16_t start, uint16_t end, IoReadHandler read, IoWriteHandler write, uint16_t mask);
+void io_map_peek(uint16_t start, uint16_t end, IoPeekHandler peek);
+uint64_t io_peek(uint16_t address, uint64_t cycle, uint8_t *value);
 void io_handle_keyboard_input();
 void io_set_key_pressed(uint8_t key, int is_pressed);
-
-// Screen functions
+uint16_t io_get_raster_line();
+uint64_t io_get_frame_count();
+void io_set_frame_hook(IoFrameHook hook);
 void io_clear_screen();
 void io_print_text(uint8_t x, uint8_t y, const char* text);
 void io_update_display();
-
-// Audio functions
 void io_beep();
 void io_set_audio_enabled(int enabled);
 
@@ -0,0 +1,382 @@
+/**
+ * input_log.c
+ * Host input recording and replay for the Commodore 64 emulator
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include "input_log.h"
+
+#define INPUT_LOG_HEADER_SIZE 12  // Magic and version
+#define INPUT_LOG_ENTRY_MAX   11  // A 64-bit varint and the character
+
+/**
+ * One logged character
+ */
+typedef struct {
+    uint64_t cycle;               // Cycle it was handed to the guest at
+    int getin;                    // 1 for GETIN, 0 for CHRIN
+    uint8_t value;
+} InputLogEntry;
+
+/**
+ * Recording or replay in progress on a machine
+ */
+typedef struct InputLog {
+    char *filename;
+    int replaying;
+    FILE *file;                   // Recording: the log being written
+    uint8_t *data;                // Replaying: the whole log
+    size_t size;
+    size_t pos;                   // Replaying: offset of the entry after next
+    InputLogEntry next;           // Replaying: the entry due next
+    int has_next;
+    uint64_t last_cycle;          // Cycle of the previous entry
+    uint64_t entries;             // Entries written or replayed
+    uint64_t diverged;            // Entries replayed at another cycle than recorded
+    int event;                    // Replaying: scheduler event at the next GETIN entry
+} InputLog;
+
+/**
+ * Check if a key has been pressed (non-blocking)
+ * This is a simplified implementation - a real one would use platform-specific code
+ */
+static int kbhit() {
+#ifdef _WIN32
+    // Windows implementation would go here
+    return 0;
+#elif defined(__APPLE__) || defined(__unix__) || defined(__unix) || defined(unix)
+    // Unix-like systems (macOS, Linux)
+    struct timeval tv;
+    fd_set fds;
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    FD_ZERO(&fds);
+    FD_SET(STDIN_FILENO, &fds);
+
+    // Use select to check if input is available
+    select(STDIN_FILENO+1, &fds, NULL, NULL, &tv);
+    return FD_ISSET(STDIN_FILENO, &fds);
+#else
+    // Fallback implementation
+    return 0;
+#endif
+}
+
+/**
+ * Read a character from the terminal for CHRIN (waits for one)
+ */
+static uint8_t input_host_chrin() {
+    return (uint8_t)getchar();
+}
+
+/**
+ * Read a key from the terminal for GETIN, or 0 if none is waiting
+ */
+static uint8_t input_host_getin() {
+    int c = -1;
+    // Check if there's a character available without blocking
+    if (kbhit()) {
+        c = getchar();
+    }
+    return (c == -1) ? 0 : c;
+}
+
+/**
+ * Append an entry to the log being recorded
+ */
+static void input_log_write(InputLog *log, uint64_t cycle, int getin, uint8_t value) {
+    uint8_t entry[INPUT_LOG_ENTRY_MAX];
+    size_t used = 0;
+
+    // Zigzag, so a clock that went back (reset, restore) costs a few bytes
+    int64_t delta = (int64_t)(cycle - log->last_cycle);
+    uint64_t field = ((((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63)) << 1) | (getin != 0);
+    while (field >= 0x80) {
+        entry[used++] = (uint8_t)(field | 0x80);
+        field >>= 7;
+    }
+    entry[used++] = (uint8_t)field;
+    entry[used++] = value;
+
+    fwrite(entry, 1, used, log->file);
+    log->last_cycle = cycle;
+    log->entries++;
+}
+
+/**
+ * Decode the next entry of the log being replayed
+ * A GETIN entry is scheduled as an event, so an idle GETIN loop doesn't
+ * skip past the cycle it is due at.
+ */
+static void input_log_read(Machine *m, InputLog *log) {
+    uint64_t field = 0;
+    int shift = 0;
+    uint8_t byte;
+
+    log->has_next = 0;
+    do {
+        if (log->pos >= log->size || shift > 63) {
+            return;
+        }
+        byte = log->data[log->pos++];
+        field |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    if (log->pos >= log->size) {
+        return;  // Cut short
+    }
+
+    uint64_t zigzag = field >> 1;
+    int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    log->next.cycle = log->last_cycle + (uint64_t)delta;
+    log->next.getin = field & 1;
+    log->next.value = log->data[log->pos++];
+    log->last_cycle = log->next.cycle;
+    log->has_next = 1;
+
+    if (log->next.getin) {
+        sched_schedule(m, log->event, log->next.cycle);
+    }
+}
+
+/**
+ * Hand the next entry of a replay to the guest
+ * @return The character
+ */
+static uint8_t input_log_take(Machine *m, InputLog *log) {
+    uint8_t value = log->next.value;
+
+    if (log->next.cycle != m->cycles) {
+        if (log->diverged == 0) {
+            printf("Warning: Input replay diverged at cycle %llu (recorded at cycle %llu)\n",
+                   (unsigned long long)m->cycles, (unsigned long long)log->next.cycle);
+        }
+        log->diverged++;
+    }
+    log->entries++;
+    input_log_read(m, log);
+    return value;
+}
+
+/**
+ * Scheduler event: a GETIN entry is due
+ * Nothing to do; being scheduled is what stops idle GETIN loops short.
+ */
+static void input_log_due(Machine *m, int arg, uint64_t cycle) {
+    (void)m;
+    (void)arg;
+    (void)cycle;
+}
+
+/**
+ * Allocate the state for a recording or replay
+ */
+static InputLog *input_log_create(const char *filename) {
+    InputLog *log = calloc(1, sizeof(InputLog));
+
+    if (log) {
+        log->filename = strdup(filename);
+    }
+    if (!log || !log->filename) {
+        printf("Error: Could not allocate the input log\n");
+        free(log);
+        return NULL;
+    }
+    return log;
+}
+
+/**
+ * Free the state of a recording or replay
+ */
+static void input_log_free(InputLog *log) {
+    free(log->filename);
+    free(log->data);
+    free(log);
+}
+
+/**
+ * Start logging the machine's input to a file
+ */
+int input_log_record_r(Machine *m, const char *filename) {
+    uint8_t header[INPUT_LOG_HEADER_SIZE] = INPUT_LOG_MAGIC;
+    uint32_t version = INPUT_LOG_VERSION;
+
+    input_log_stop_r(m);
+    InputLog *log = input_log_create(filename);
+    if (!log) {
+        return 0;
+    }
+    log->file = fopen(filename, "wb");
+    if (!log->file) {
+        printf("Error: Could not create file %s\n", filename);
+        input_log_free(log);
+        return 0;
+    }
+    memcpy(header + 8, &version, sizeof(version));
+    fwrite(header, 1, sizeof(header), log->file);
+
+    m->input_log = log;
+    return 1;
+}
+
+/**
+ * Start feeding the machine input from a log file
+ */
+int input_log_replay_r(Machine *m, const char *filename) {
+    uint32_t version;
+    struct stat st;
+
+    input_log_stop_r(m);
+    InputLog *log = input_log_create(filename);
+    if (!log) {
+        return 0;
+    }
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        printf("Error: Could not open file %s\n", filename);
+        input_log_free(log);
+        return 0;
+    }
+    if (fstat(fileno(file), &st) != 0 || st.st_size < INPUT_LOG_HEADER_SIZE ||
+        !(log->data = malloc(st.st_size)) ||
+        fread(log->data, 1, st.st_size, file) != (size_t)st.st_size) {
+        printf("Error: Could not read file %s\n", filename);
+        fclose(file);
+        input_log_free(log);
+        return 0;
+    }
+    fclose(file);
+
+    memcpy(&version, log->data + 8, sizeof(version));
+    if (memcmp(log->data, INPUT_LOG_MAGIC, sizeof(INPUT_LOG_MAGIC)) != 0 || version != INPUT_LOG_VERSION) {
+        printf("Error: %s is not an input log (version %u)\n", filename, INPUT_LOG_VERSION);
+        input_log_free(log);
+        return 0;
+    }
+    log->event = sched_register(m, "Input replay", input_log_due, 0);
+    if (log->event < 0) {
+        input_log_free(log);
+        return 0;
+    }
+    log->replaying = 1;
+    log->size = st.st_size;
+    log->pos = INPUT_LOG_HEADER_SIZE;
+
+    m->input_log = log;
+    input_log_read(m, log);
+    return 1;
+}
+
+/**
+ * Stop recording or replaying and print a summary
+ */
+void input_log_stop_r(Machine *m) {
+    InputLog *log = m->input_log;
+
+    if (!log) {
+        return;
+    }
+    if (log->replaying) {
+        sched_cancel(m, log->event);
+        printf("Input replay: %llu characters from '%s'", (unsigned long long)log->entries, log->filename);
+        if (log->diverged) {
+            printf(", %llu at other cycles than recorded", (unsigned long long)log->diverged);
+        }
+        printf("\n");
+    } else {
+        int failed = ferror(log->file);
+        if (fclose(log->file) != 0 || failed) {
+            printf("Error: Could not write file %s\n", log->filename);
+        } else {
+            printf("Input recording: %llu characters to '%s'\n", (unsigned long long)log->entries, log->filename);
+        }
+    }
+    input_log_free(log);
+    m->input_log = NULL;
+}
+
+/**
+ * Schedule the next GETIN entry again after a restore
+ */
+void input_log_clock_changed_r(Machine *m) {
+    InputLog *log = m->input_log;
+
+    if (log && log->replaying && log->has_next && log->next.getin) {
+        sched_schedule(m, log->event, log->next.cycle);
+    }
+}
+
+/**
+ * Get the next character for CHRIN
+ */
+uint8_t input_log_chrin_r(Machine *m) {
+    InputLog *log = m->input_log;
+
+    if (!log) {
+        return input_host_chrin();
+    }
+    if (!log->replaying) {
+        uint8_t c = input_host_chrin();
+        input_log_write(log, m->cycles, 0, c);
+        return c;
+    }
+
+    // The recording ended here, or read a key with GETIN instead
+    if (!log->has_next) {
+        return 0xFF;
+    }
+    if (log->next.getin) {
+        if (log->diverged == 0) {
+            printf("Warning: Input replay diverged at cycle %llu (CHRIN, but GETIN was recorded)\n",
+                   (unsigned long long)m->cycles);
+        }
+        log->diverged++;
+        return 0xFF;
+    }
+    return input_log_take(m, log);
+}
+
+/**
+ * Get a key for GETIN without waiting
+ */
+uint8_t input_log_getin_r(Machine *m) {
+    InputLog *log = m->input_log;
+
+    if (!log) {
+        return input_host_getin();
+    }
+    if (!log->replaying) {
+        uint8_t c = input_host_getin();
+        if (c) {
+            input_log_write(log, m->cycles, 1, c);
+        }
+        return c;
+    }
+
+    if (!log->has_next || !log->next.getin || log->next.cycle > m->cycles) {
+        return 0;
+    }
+    return input_log_take(m, log);
+}
+
+/* ------------------------------------------------------------------ */
+/* Single-machine API                                                 */
+/* ------------------------------------------------------------------ */
+
+int input_log_record(const char *filename) {
+    return input_log_record_r(machine_default(), filename);
+}
+
+int input_log_replay(const char *filename) {
+    return input_log_replay_r(machine_default(), filename);
+}
+
+void input_log_stop() {
+    input_log_stop_r(machine_default());
+}
@@ -0,0 +1,84 @@
+/**
+ * input_log.h
+ * Host input recording and replay for the Commodore 64 emulator
+ *
+ * The only host input a guest sees comes through the emulated KERNAL:
+ * CHRIN ($FFCF) blocks for a character from stdin and GETIN ($FFE4)
+ * polls it. Both go through input_log_chrin_r() and input_log_getin_r().
+ * Normally they read the terminal. While recording, every character
+ * handed to the guest is also written to a log with the cycle it was
+ * handed over at; while replaying, characters come from a log instead,
+ * at the same cycles, and the terminal is never read. A replay started
+ * from the same machine state with the same build then runs the guest
+ * bit for bit as recorded.
+ *
+ * A log file is an 8-byte magic string and a 32-bit version, followed by
+ * one entry per character: a LEB128 varint holding the zigzag-encoded
+ * cycle difference from the previous entry shifted left by one, with
+ * bit 0 set for GETIN, then the character. Most entries are 3-4 bytes.
+ * A polling GETIN that finds no key is not logged.
+ */
+
+#ifndef INPUT_LOG_H
+#define INPUT_LOG_H
+
+#include <stdint.h>
+#include "machine.h"
+
+#define INPUT_LOG_MAGIC   "C64INPT"
+#define INPUT_LOG_VERSION 1
+
+/**
+ * Start logging the machine's input to a file
+ * Replaces any recording or replay in progress.
+ *
+ * @param filename Log file to create
+ * @return 1 on success, 0 if the file can't be created
+ */
+int input_log_record_r(Machine *m, const char *filename);
+
+/**
+ * Start feeding the machine input from a log file
+ * Replaces any recording or replay in progress. The log should be replayed
+ * from the machine state its recording started in. Once the log runs out,
+ * CHRIN returns end of file ($FF) and GETIN finds no key.
+ *
+ * @param filename Log file to read
+ * @return 1 on success, 0 if the file can't be read or isn't a log
+ */
+int input_log_replay_r(Machine *m, const char *filename);
+
+/**
+ * Stop recording or replaying and print a summary
+ * A recording is flushed and closed. Does nothing if neither is running.
+ */
+void input_log_stop_r(Machine *m);
+
+/**
+ * Keep replaying after a restore replaced the clock and events
+ * A snapshot restore cancels the event at the next GETIN entry along with
+ * every other event the snapshot doesn't name; this schedules it again.
+ */
+void input_log_clock_changed_r(Machine *m);
+
+/**
+ * Get the next character for CHRIN
+ * @return The character; $FF at end of input
+ */
+uint8_t input_log_chrin_r(Machine *m);
+
+/**
+ * Get a key for GETIN without waiting
+ * @return The key, or 0 if none is waiting
+ */
+uint8_t input_log_getin_r(Machine *m);
+
+/*
+ * Single-machine API
+ * Each function below calls its _r variant with machine_default().
+ */
+int input_log_record(const char *filename);
+int input_log_replay(const char *filename);
+void input_log_stop();
+
+#endif /* INPUT_LOG_H */
@@ -0,0 +1,68 @@
+/**
+ * machine.c
+ * Emulator instance implementation for the Commodore 64 emulator
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "machine.h"
+#include "input_log.h"
+#include "rewind.h"
+#include "snapshot.h"
+
+// Machine behind the single-machine API
+static Machine default_machine;
+
+/**
+ * Get the default machine
+ */
+Machine *machine_default() {
+    return &default_machine;
+}
+
+/**
+ * Create and initialise a machine
+ */
+Machine *machine_create() {
+    Machine *m = calloc(1, sizeof(Machine));
+    if (!m) {
+        printf("Error: Could not allocate a machine\n");
+        return NULL;
+    }
+
+    memory_init_r(m);
+    cpu_init_r(m);
+    io_init_r(m);
+    return m;
+}
+
+/**
+ * Create a machine in the state of another, sharing its RAM pages
+ */
+Machine *machine_fork(Machine *parent) {
+    Machine *m = machine_create();
+    if (!m) {
+        return NULL;
+    }
+
+    if (!memory_fork_r(m, parent) || !snapshot_copy_devices_r(m, parent)) {
+        machine_destroy(m);
+        return NULL;
+    }
+    return m;
+}
+
+/**
+ * Free a machine and its caches
+ */
+void machine_destroy(Machine *m) {
+    if (!m || m == &default_machine) {
+        return;
+    }
+    rewind_stop_r(m);
+    input_log_stop_r(m);
+    cpu_release_r(m);
+    memory_unexport_r(m);
+    memory_release_r(m);
+    free(m);
+}
@@ -0,0 +1,87 @@
+/**
+ * machine.h
+ * Emulator instance for the Commodore 64 emulator
+ *
+ * A Machine holds everything one emulated C64 needs: CPU registers and
+ * cycle counter, run loop and cache state, RAM and ROMs, I/O chips,
+ * scheduled events and shell state. Every cpu_*, memory_* and io_*
+ * function has a variant with an _r suffix that takes the Machine to act
+ * on, so any number of machines can run in one process, each on its own
+ * thread. The functions without the suffix act on machine_default().
+ *
+ * Opcode tables and dispatch tables are shared by all machines and never
+ * change once built; they are built when the first machine is
+ * initialised, which has to happen before other threads create machines.
+ */
+
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stdint.h>
+#include "../cpu/cpu.h"
+#include "../memory/memory.h"
+#include "../io/io.h"
+#include "../sched/sched.h"
+#include "../shell/shell.h"
+
+/**
+ * Emulator instance
+ */
+struct Machine {
+    CPU cpu;              // Registers
+    uint64_t cycles;      // CPU cycles since reset
+    CpuState cpu_state;   // Run loop, breakpoints, decode cache and JIT
+    MemoryState memory;   // RAM, ROMs and banking
+    IoState io;           // VIC-II, SID, CIAs, screen and keyboard
+    SchedState sched;     // Device events
+    ShellState shell;     // Shell mode flags
+    
+    // Snapshot RAM was last captured into or restored from (see snapshot.h)
+    const struct MachineSnapshot *snapshot;
+    uint64_t snapshot_id;
+
+    // Rewind history, or NULL when not recording (see rewind.h)
+    struct RewindState *rewind;
+
+    // KERNAL input being recorded or replayed, or NULL (see input_log.h)
+    struct InputLog *input_log;
+};
+
+/**
+ * Get the machine used by the functions without an _r suffix
+ * @return The default machine (never NULL)
+ */
+Machine *machine_default();
+
+/**
+ * Create a machine
+ * Memory, CPU and I/O are initialised as by memory_init(), cpu_init() and
+ * io_init(), with the built-in placeholder ROMs.
+ *
+ * @return The new machine, or NULL if it can't be allocated
+ */
+Machine *machine_create();
+
+/**
+ * Fork a machine
+ * The new machine starts in the parent's emulated state: CPU registers,
+ * cycle count, RAM and banking, ROMs, I/O chips and scheduled events.
+ * RAM is shared copy-on-write (see memory_fork()), so a fork costs the
+ * Machine structure plus the RAM pages either side writes afterwards.
+ * Host-side state (decode cache, JIT, breakpoints) starts out empty.
+ * The parent must not be running while it is forked; after that, parent
+ * and forks can run on different threads.
+ *
+ * @param parent Machine to fork
+ * @return The new machine, to be freed with machine_destroy(), or NULL if
+ *         it can't be allocated
+ */
+Machine *machine_fork(Machine *parent);
+
+/**
+ * Destroy a machine created with machine_create() or machine_fork()
+ * @param m Machine to free (NULL is ignored)
+ */
+void machine_destroy(Machine *m);
+
+#endif /* MACHINE_H */
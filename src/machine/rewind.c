@@ -0,0 +1,543 @@
+/**
+ * rewind.c
+ * Rewind history for the Commodore 64 emulator
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+#include "snapshot.h"
+
+// Largest delta; one that would be bigger is stored as a keyframe instead
+#define REWIND_ENCODE_SIZE sizeof(MachineSnapshot)
+
+// rewind_encode_region() result when the delta doesn't fit
+#define REWIND_OVERFLOW ((size_t)-1)
+
+/**
+ * A record: a whole snapshot (keyframe) or a list of regions (delta)
+ */
+typedef struct {
+    uint64_t cycle;               // Cycle the state was recorded at
+    int keyframe;
+    size_t size;                  // Bytes of data
+    uint8_t data[];
+} RewindRecord;
+
+/**
+ * Header of one region of a delta
+ * The runs that follow change the bytes of a MachineSnapshot from offset
+ * on: 0x00-0x7F skips n + 1 unchanged bytes, 0x80-0xFF is followed by
+ * n - 0x7F bytes to XOR in. Unchanged bytes at the end aren't encoded.
+ */
+typedef struct {
+    uint32_t offset;              // Offset of the region in a MachineSnapshot
+    uint32_t size;                // Bytes of runs that follow
+} RewindRegion;
+
+/**
+ * Rewind history of one machine
+ */
+typedef struct RewindState {
+    RewindRecord **records;       // Ring of records, oldest at first
+    int capacity;
+    int first;
+    int count;
+    size_t bytes;                 // Bytes held by the records
+    size_t budget;
+    int since_keyframe;           // Deltas since the newest keyframe
+    MachineSnapshot *reference;   // State at the newest record
+    MachineSnapshot *scratch;     // Current state, captured for the next delta
+    uint8_t *buffer;              // REWIND_ENCODE_SIZE bytes for encoding a delta
+    int event;                    // Scheduler event taking the records
+} RewindState;
+
+/**
+ * Get the record at a position in the ring (0 is the oldest)
+ */
+static RewindRecord *rewind_record_at(RewindState *rw, int index) {
+    return rw->records[(rw->first + index) % rw->capacity];
+}
+
+/**
+ * Drop the oldest record
+ */
+static void rewind_drop_oldest(RewindState *rw) {
+    RewindRecord *record = rw->records[rw->first];
+
+    rw->bytes -= sizeof(RewindRecord) + record->size;
+    free(record);
+    rw->first = (rw->first + 1) % rw->capacity;
+    rw->count--;
+}
+
+/**
+ * Drop the newest record
+ */
+static void rewind_drop_newest(RewindState *rw) {
+    RewindRecord *record = rewind_record_at(rw, rw->count - 1);
+
+    rw->bytes -= sizeof(RewindRecord) + record->size;
+    free(record);
+    rw->count--;
+}
+
+/**
+ * Drop every record
+ * The next record is a keyframe.
+ */
+static void rewind_clear(RewindState *rw) {
+    while (rw->count > 0) {
+        rewind_drop_newest(rw);
+    }
+    rw->first = 0;
+    rw->since_keyframe = 0;
+}
+
+/**
+ * Keep the records within the budget
+ * Deltas left without their keyframe can't be used, so they go too; the
+ * oldest record is always a keyframe.
+ */
+static void rewind_evict(RewindState *rw) {
+    while (rw->count > 1 && rw->bytes > rw->budget) {
+        rewind_drop_oldest(rw);
+    }
+    while (rw->count > 0 && !rewind_record_at(rw, 0)->keyframe) {
+        rewind_drop_oldest(rw);
+    }
+}
+
+/**
+ * Add a record at the newest end of the ring
+ * @return 1 on success, 0 if memory runs out
+ */
+static int rewind_push(RewindState *rw, uint64_t cycle, int keyframe, const void *data, size_t size) {
+    if (rw->count == rw->capacity) {
+        int capacity = rw->capacity ? rw->capacity * 2 : 1024;
+        RewindRecord **records = malloc(capacity * sizeof(RewindRecord *));
+        if (!records) {
+            return 0;
+        }
+        for (int i = 0; i < rw->count; i++) {
+            records[i] = rewind_record_at(rw, i);
+        }
+        free(rw->records);
+        rw->records = records;
+        rw->capacity = capacity;
+        rw->first = 0;
+    }
+
+    RewindRecord *record = malloc(sizeof(RewindRecord) + size);
+    if (!record) {
+        return 0;
+    }
+    record->cycle = cycle;
+    record->keyframe = keyframe;
+    record->size = size;
+    memcpy(record->data, data, size);
+
+    rw->records[(rw->first + rw->count) % rw->capacity] = record;
+    rw->count++;
+    rw->bytes += sizeof(RewindRecord) + size;
+    rw->since_keyframe = keyframe ? 0 : rw->since_keyframe + 1;
+    rewind_evict(rw);
+    return 1;
+}
+
+/**
+ * Encode the changes to one region and bring the old copy up to date
+ * Unchanged bytes are compared 64 bytes, then a word, at a time. Runs
+ * of changed bytes alternating with unchanged ones cost up to 1.5 times
+ * the region, so every run is checked against the space left.
+ *
+ * @param space Bytes free at out
+ * @return Bytes written to out (nothing if the region is unchanged), or
+ *         REWIND_OVERFLOW if they don't fit; the old copy is brought up
+ *         to date either way
+ */
+static size_t rewind_encode_region(uint8_t *out, size_t space, uint8_t *old, const uint8_t *new,
+                                   size_t offset, size_t length) {
+    uint8_t *runs = out + sizeof(RewindRegion);
+    size_t used = 0;
+    size_t i = 0;
+
+    old += offset;
+    new += offset;
+    if (space < sizeof(RewindRegion)) {
+        if (memcmp(old, new, length) == 0) {
+            return 0;
+        }
+        memcpy(old, new, length);
+        return REWIND_OVERFLOW;
+    }
+    space -= sizeof(RewindRegion);
+
+    while (i < length) {
+        size_t start = i;
+        uint64_t a, b;
+        while (i + 64 <= length && memcmp(old + i, new + i, 64) == 0) {
+            i += 64;
+        }
+        while (i + 8 <= length) {
+            memcpy(&a, old + i, 8);
+            memcpy(&b, new + i, 8);
+            if (a != b) {
+                break;
+            }
+            i += 8;
+        }
+        while (i < length && old[i] == new[i]) {
+            i++;
+        }
+        if (i == length) {
+            break;
+        }
+        size_t skip = i - start;
+
+        start = i;
+        while (i < length && old[i] != new[i] && i - start < 128) {
+            i++;
+        }
+        if (used + (skip + 127) / 128 + 1 + (i - start) > space) {
+            memcpy(old, new, length);
+            return REWIND_OVERFLOW;
+        }
+        while (skip > 0) {
+            size_t n = skip < 128 ? skip : 128;
+            runs[used++] = (uint8_t)(n - 1);
+            skip -= n;
+        }
+        runs[used++] = (uint8_t)(0x7F + (i - start));
+        for (size_t k = start; k < i; k++) {
+            runs[used++] = old[k] ^ new[k];
+            old[k] = new[k];
+        }
+    }
+    if (used == 0) {
+        return 0;
+    }
+
+    RewindRegion region = { (uint32_t)offset, (uint32_t)used };
+    memcpy(out, &region, sizeof(region));
+    return sizeof(region) + used;
+}
+
+/**
+ * Encode one region into the rest of the buffer
+ * After an overflow nothing more is encoded; regions are only copied.
+ */
+static void rewind_encode_next(uint8_t *out, size_t *used, uint8_t *old, const uint8_t *new,
+                               size_t offset, size_t length) {
+    if (*used == REWIND_OVERFLOW) {
+        memcpy(old + offset, new + offset, length);
+        return;
+    }
+    size_t size = rewind_encode_region(out + *used, REWIND_ENCODE_SIZE - *used, old, new, offset, length);
+    *used = size == REWIND_OVERFLOW ? REWIND_OVERFLOW : *used + size;
+}
+
+/**
+ * Encode the changes from the reference to the current state
+ * Covers the device state, the pages in the bitmap and the banking
+ * configuration; the reference is brought up to date on the way.
+ *
+ * @param out REWIND_ENCODE_SIZE bytes
+ * @return Bytes written to out, or REWIND_OVERFLOW if the delta would be
+ *         larger than a keyframe
+ */
+static size_t rewind_encode(uint8_t *out, MachineSnapshot *reference, const MachineSnapshot *current,
+                            const uint64_t pages[MEMORY_DIRTY_PAGE_WORDS]) {
+    uint8_t *old = (uint8_t *)reference;
+    const uint8_t *new = (const uint8_t *)current;
+    size_t ram = offsetof(MachineSnapshot, memory);
+    size_t used = 0;
+
+    rewind_encode_next(out, &used, old, new, 0, ram);
+    for (int word = 0; word < MEMORY_DIRTY_PAGE_WORDS; word++) {
+        uint64_t bits = pages[word];
+        while (bits) {
+            int page = (word << 6) + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            rewind_encode_next(out, &used, old, new, ram + (page << 8), 256);
+        }
+    }
+    rewind_encode_next(out, &used, old, new, ram + MEMORY_SIZE, MEMORY_STATE_SIZE - MEMORY_SIZE);
+    return used;
+}
+
+/**
+ * Apply a delta to the state at the record before it
+ */
+static void rewind_apply(MachineSnapshot *state, const RewindRecord *record) {
+    const uint8_t *p = record->data;
+    const uint8_t *end = p + record->size;
+
+    while (p < end) {
+        RewindRegion region;
+        memcpy(&region, p, sizeof(region));
+        p += sizeof(region);
+
+        uint8_t *target = (uint8_t *)state + region.offset;
+        const uint8_t *runs_end = p + region.size;
+        while (p < runs_end) {
+            uint8_t run = *p++;
+            if (run < 0x80) {
+                target += run + 1;
+            } else {
+                int n = run - 0x7F;
+                for (int k = 0; k < n; k++) {
+                    target[k] ^= p[k];
+                }
+                target += n;
+                p += n;
+            }
+        }
+    }
+}
+
+/**
+ * Record the current state
+ * A keyframe every REWIND_KEYFRAME_INTERVAL records, and whenever a
+ * delta would be larger; a delta otherwise.
+ */
+static void rewind_record(Machine *m, RewindState *rw) {
+    uint64_t pages[MEMORY_DIRTY_PAGE_WORDS];
+
+    // A restore or reset went back past the newest record: start again
+    if (rw->count > 0 && m->cycles < rewind_record_at(rw, rw->count - 1)->cycle) {
+        rewind_clear(rw);
+    }
+    int keyframe = rw->count == 0 || rw->since_keyframe + 1 >= REWIND_KEYFRAME_INTERVAL;
+
+    memory_take_dirty_pages_r(m, MEMORY_DIRTY_REWIND, pages);
+    snapshot_capture_devices_r(m, rw->scratch);
+    memory_save_pages_r(m, rw->scratch->memory, pages);
+    size_t size = rewind_encode(rw->buffer, rw->reference, rw->scratch, pages);
+    if (size == REWIND_OVERFLOW) {
+        keyframe = 1;
+    }
+
+    int pushed = keyframe ? rewind_push(rw, m->cycles, 1, rw->reference, sizeof(MachineSnapshot))
+                          : rewind_push(rw, m->cycles, 0, rw->buffer, size);
+    if (!pushed) {
+        // The next delta would have nothing to follow on from
+        printf("Error: Could not allocate a rewind record; history dropped\n");
+        rewind_clear(rw);
+    }
+}
+
+/**
+ * Scheduler event: take a record
+ */
+static void rewind_event(Machine *m, int arg, uint64_t cycle) {
+    RewindState *rw = m->rewind;
+
+    (void)arg;
+    if (!rw) {
+        return;  // Scheduled by a snapshot restore after recording stopped
+    }
+    // Scheduled first, so the record holds the next one
+    sched_schedule(m, rw->event, cycle + REWIND_RECORD_CYCLES);
+    rewind_record(m, rw);
+}
+
+/**
+ * Start recording
+ */
+int rewind_start_r(Machine *m, size_t budget) {
+    RewindState *rw = m->rewind;
+
+    if (budget < 2 * sizeof(MachineSnapshot)) {
+        budget = 2 * sizeof(MachineSnapshot);
+    }
+    if (rw) {
+        rw->budget = budget;
+        rewind_evict(rw);
+        return 1;
+    }
+
+    rw = calloc(1, sizeof(RewindState));
+    if (rw) {
+        rw->reference = calloc(1, sizeof(MachineSnapshot));
+        rw->scratch = calloc(1, sizeof(MachineSnapshot));
+        rw->buffer = malloc(REWIND_ENCODE_SIZE);
+    }
+    if (!rw || !rw->reference || !rw->scratch || !rw->buffer) {
+        printf("Error: Could not allocate the rewind history\n");
+        if (rw) {
+            free(rw->reference);
+            free(rw->scratch);
+            free(rw->buffer);
+            free(rw);
+        }
+        return 0;
+    }
+    rw->budget = budget;
+    rw->event = sched_register(m, "Rewind", rewind_event, 0);
+    if (rw->event < 0) {
+        free(rw->reference);
+        free(rw->scratch);
+        free(rw->buffer);
+        free(rw);
+        return 0;
+    }
+    m->rewind = rw;
+
+    // The first keyframe: the whole current state
+    sched_schedule(m, rw->event, m->cycles + REWIND_RECORD_CYCLES);
+    memory_take_dirty_range_r(m, MEMORY_DIRTY_REWIND, 0x00, 0xFF);
+    memory_save_state_r(m, rw->reference->memory);
+    snapshot_capture_devices_r(m, rw->reference);
+    rw->reference->id = 0;
+    if (!rewind_push(rw, m->cycles, 1, rw->reference, sizeof(MachineSnapshot))) {
+        printf("Error: Could not allocate a rewind record\n");
+        rewind_stop_r(m);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Stop recording and free the history
+ */
+void rewind_stop_r(Machine *m) {
+    RewindState *rw = m->rewind;
+
+    if (!rw) {
+        return;
+    }
+    sched_cancel(m, rw->event);
+    rewind_clear(rw);
+    free(rw->records);
+    free(rw->reference);
+    free(rw->scratch);
+    free(rw->buffer);
+    free(rw);
+    m->rewind = NULL;
+}
+
+/**
+ * Put the machine back to an earlier cycle
+ */
+int rewind_to_r(Machine *m, uint64_t cycle) {
+    RewindState *rw = m->rewind;
+
+    if (!rw || rw->count == 0) {
+        printf("Error: Nothing recorded (start recording with 'rewind on')\n");
+        return 0;
+    }
+    if (cycle > m->cycles) {
+        printf("Error: Cycle %llu is ahead of the machine (cycle %llu)\n",
+               (unsigned long long)cycle, (unsigned long long)m->cycles);
+        return 0;
+    }
+
+    // The newest record at or before the cycle, and the keyframe it follows
+    int target = rw->count - 1;
+    while (target >= 0 && rewind_record_at(rw, target)->cycle > cycle) {
+        target--;
+    }
+    int key = target;
+    while (key >= 0 && !rewind_record_at(rw, key)->keyframe) {
+        key--;
+    }
+    if (key < 0) {
+        printf("Error: History only goes back to cycle %llu\n",
+               (unsigned long long)rewind_record_at(rw, 0)->cycle);
+        return 0;
+    }
+
+    // Rebuild the state at that record in the reference; later records
+    // are dropped, so recording carries on from it
+    memcpy(rw->reference, rewind_record_at(rw, key)->data, sizeof(MachineSnapshot));
+    for (int i = key + 1; i <= target; i++) {
+        rewind_apply(rw->reference, rewind_record_at(rw, i));
+    }
+    while (rw->count > target + 1) {
+        rewind_drop_newest(rw);
+    }
+    rw->since_keyframe = target - key;
+
+    // The reference changes with every record, so the machine can't stay
+    // in step with it as a snapshot
+    snapshot_restore_r(m, rw->reference);
+    m->snapshot = NULL;
+    memory_take_dirty_range_r(m, MEMORY_DIRTY_REWIND, 0x00, 0xFF);
+
+    // Run forward from the record to the cycle
+    if (cycle > m->cycles) {
+        cpu_run_r(m, (uint32_t)(cycle - m->cycles));
+    }
+    return 1;
+}
+
+/**
+ * Keep recording after a reset or restore replaced the clock and events
+ */
+void rewind_clock_changed_r(Machine *m) {
+    RewindState *rw = m->rewind;
+
+    if (!rw) {
+        return;
+    }
+    uint64_t next = sched_event_cycle(m, rw->event);
+    if (next == SCHED_NEVER || next > m->cycles + REWIND_RECORD_CYCLES) {
+        sched_schedule(m, rw->event, m->cycles + REWIND_RECORD_CYCLES);
+    }
+}
+
+/**
+ * Print the size and span of the history
+ */
+void rewind_print_stats_r(Machine *m) {
+    RewindState *rw = m->rewind;
+
+    if (!rw) {
+        printf("Rewind: not recording\n");
+        return;
+    }
+    int keyframes = 0;
+    size_t delta_bytes = 0;
+    for (int i = 0; i < rw->count; i++) {
+        RewindRecord *record = rewind_record_at(rw, i);
+        if (record->keyframe) {
+            keyframes++;
+        } else {
+            delta_bytes += record->size;
+        }
+    }
+    printf("Rewind: recording, %d records (%d keyframes), %.1f of %.1f MB\n",
+           rw->count, keyframes, rw->bytes / 1048576.0, rw->budget / 1048576.0);
+    if (rw->count > 0) {
+        uint64_t oldest = rewind_record_at(rw, 0)->cycle;
+        printf("  History: cycle %llu to %llu (%llu cycles back)\n",
+               (unsigned long long)oldest, (unsigned long long)m->cycles,
+               (unsigned long long)(m->cycles - oldest));
+    }
+    if (rw->count > keyframes) {
+        printf("  Average delta: %zu bytes\n", delta_bytes / (rw->count - keyframes));
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Single-machine API                                                 */
+/* ------------------------------------------------------------------ */
+
+int rewind_start(size_t budget) {
+    return rewind_start_r(machine_default(), budget);
+}
+
+void rewind_stop() {
+    rewind_stop_r(machine_default());
+}
+
+int rewind_to(uint64_t cycle) {
+    return rewind_to_r(machine_default(), cycle);
+}
+
+void rewind_print_stats() {
+    rewind_print_stats_r(machine_default());
+}
@@ -0,0 +1,79 @@
+/**
+ * rewind.h
+ * Rewind history for the Commodore 64 emulator
+ *
+ * While a machine records, its state is recorded once per video frame.
+ * Every REWIND_KEYFRAME_INTERVAL records one is a keyframe: a whole
+ * MachineSnapshot. The records in between are deltas against the record
+ * before: the device state, and each RAM page written since (from the
+ * MEMORY_DIRTY_REWIND set), XORed with what it was and run-length
+ * encoded, so bytes that didn't change cost nothing. Records are kept
+ * oldest first in a ring, and the oldest are dropped when they outgrow
+ * the memory budget.
+ *
+ * Rewinding to a cycle starts from the latest keyframe at or before it,
+ * applies the deltas up to the last record at or before it, restores
+ * that state and runs the CPU forward to the cycle. Records after it are
+ * dropped and recording carries on from there.
+ */
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "machine.h"
+
+#define REWIND_RECORD_CYCLES     VIC_CYCLES_PER_FRAME  // Cycles between records
+#define REWIND_KEYFRAME_INTERVAL 50                    // Records per keyframe (a second of frames)
+#define REWIND_DEFAULT_BUDGET    (16 << 20)            // Bytes of records kept by default
+
+/**
+ * Start recording
+ * Takes a keyframe of the current state straight away. Recording again
+ * with another budget keeps the history.
+ *
+ * @param budget Bytes of records to keep (at least two keyframes' worth)
+ * @return 1 on success, 0 if memory runs out
+ */
+int rewind_start_r(Machine *m, size_t budget);
+
+/**
+ * Stop recording and free the history
+ */
+void rewind_stop_r(Machine *m);
+
+/**
+ * Put the machine back to an earlier cycle
+ * The CPU stops at the first instruction boundary at or after the cycle,
+ * or earlier at a breakpoint.
+ *
+ * @param cycle Cycle to go back to (not after the current one)
+ * @return 1 on success, 0 if the history doesn't go back that far or
+ *         nothing is recorded (the machine is unchanged then)
+ */
+int rewind_to_r(Machine *m, uint64_t cycle);
+
+/**
+ * Keep recording after a reset or restore replaced the clock and events
+ * Schedules the next record if it was cancelled or is now more than a
+ * frame away. The history is started again at the next record if the
+ * clock went back past it.
+ */
+void rewind_clock_changed_r(Machine *m);
+
+/**
+ * Print the size and span of the history
+ */
+void rewind_print_stats_r(Machine *m);
+
+/*
+ * Single-machine API
+ * Each function below calls its _r variant with machine_default().
+ */
+int rewind_start(size_t budget);
+void rewind_stop();
+int rewind_to(uint64_t cycle);
+void rewind_print_stats();
+
+#endif /* REWIND_H */
@@ -0,0 +1,383 @@
+/**
+ * snapshot.c
+ * Machine snapshots for the Commodore 64 emulator
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "snapshot.h"
+#include "rewind.h"
+#include "input_log.h"
+#include "../memory/rom_cache.h"
+
+// Source of snapshot ids, shared by every machine in the process
+static uint64_t snapshot_last_id;
+
+/**
+ * Copy a CIA's state into a snapshot
+ */
+static void snapshot_save_cia(SnapshotCia *saved, const Cia *cia) {
+    memcpy(saved->registers, cia->registers, sizeof(saved->registers));
+    for (int i = 0; i < 2; i++) {
+        saved->latch[i] = cia->timers[i].latch;
+        saved->counter[i] = cia->timers[i].counter;
+        saved->base_cycle[i] = cia->timers[i].base_cycle;
+    }
+    saved->icr_data = cia->icr_data;
+    saved->icr_mask = cia->icr_mask;
+}
+
+/**
+ * Copy a CIA's state back from a snapshot
+ * The chip keeps its scheduler events and interrupt line.
+ */
+static void snapshot_restore_cia(Cia *cia, const SnapshotCia *saved) {
+    memcpy(cia->registers, saved->registers, sizeof(cia->registers));
+    for (int i = 0; i < 2; i++) {
+        cia->timers[i].latch = saved->latch[i];
+        cia->timers[i].counter = saved->counter[i];
+        cia->timers[i].base_cycle = saved->base_cycle[i];
+    }
+    cia->icr_data = saved->icr_data;
+    cia->icr_mask = saved->icr_mask;
+}
+
+/**
+ * Fill in everything but RAM and the id
+ */
+static void snapshot_fill(Machine *m, MachineSnapshot *snapshot) {
+    IoState *io = &m->io;
+
+    memcpy(snapshot->magic, SNAPSHOT_MAGIC, sizeof(snapshot->magic));
+    snapshot->version = SNAPSHOT_VERSION;
+    snapshot->size = sizeof(MachineSnapshot);
+
+    snapshot->cpu = m->cpu;
+    snapshot->cycles = m->cycles;
+    snapshot->irq_pending = m->cpu_state.irq_pending != 0;
+    snapshot->nmi_pending = m->cpu_state.nmi_pending != 0;
+
+    memcpy(snapshot->vic_registers, io->vic_registers, sizeof(snapshot->vic_registers));
+    memcpy(snapshot->sid_registers, io->sid_registers, sizeof(snapshot->sid_registers));
+    snapshot_save_cia(&snapshot->cia[0], &io->cia1);
+    snapshot_save_cia(&snapshot->cia[1], &io->cia2);
+    memcpy(snapshot->screen_data, io->screen_data, sizeof(snapshot->screen_data));
+    memcpy(snapshot->color_ram, io->color_ram, sizeof(snapshot->color_ram));
+    memcpy(snapshot->keyboard_matrix, io->keyboard_matrix, sizeof(snapshot->keyboard_matrix));
+    snapshot->vic_irq_latch = io->vic_irq_latch;
+    snapshot->vic_irq_mask = io->vic_irq_mask;
+    snapshot->audio_enabled = io->audio_enabled != 0;
+    snapshot->frame_count = io->frame_count;
+
+    memset(snapshot->events, 0, sizeof(snapshot->events));
+    snapshot->event_count = m->sched.event_count;
+    for (int i = 0; i < m->sched.event_count; i++) {
+        strncpy(snapshot->events[i].name, m->sched.events[i].name, SNAPSHOT_EVENT_NAME_SIZE - 1);
+        snapshot->events[i].cycle = sched_event_cycle(m, i);
+    }
+
+    snapshot->basic_rom = m->memory.basic_rom;
+    snapshot->kernal_rom = m->memory.kernal_rom;
+    snapshot->char_rom = m->memory.char_rom;
+}
+
+/**
+ * Capture the state of a machine
+ */
+void snapshot_capture_r(Machine *m, MachineSnapshot *snapshot) {
+    uint64_t pages[MEMORY_DIRTY_PAGE_WORDS];
+    int incremental = m->snapshot == snapshot && m->snapshot_id == snapshot->id;
+
+    memory_take_dirty_pages_r(m, MEMORY_DIRTY_SNAPSHOT, pages);
+    if (incremental) {
+        memory_save_pages_r(m, snapshot->memory, pages);
+    } else {
+        memory_save_state_r(m, snapshot->memory);
+    }
+    snapshot_fill(m, snapshot);
+
+    snapshot->id = __atomic_add_fetch(&snapshot_last_id, 1, __ATOMIC_RELAXED);
+    m->snapshot = snapshot;
+    m->snapshot_id = snapshot->id;
+}
+
+/**
+ * Put everything but RAM and the banking configuration back
+ */
+void snapshot_restore_devices_r(Machine *m, const MachineSnapshot *snapshot) {
+    IoState *io = &m->io;
+
+    m->cpu = snapshot->cpu;
+    m->cycles = snapshot->cycles;
+    m->cpu_state.irq_pending = snapshot->irq_pending;
+    m->cpu_state.nmi_pending = snapshot->nmi_pending;
+
+    memcpy(io->vic_registers, snapshot->vic_registers, sizeof(io->vic_registers));
+    memcpy(io->sid_registers, snapshot->sid_registers, sizeof(io->sid_registers));
+    snapshot_restore_cia(&io->cia1, &snapshot->cia[0]);
+    snapshot_restore_cia(&io->cia2, &snapshot->cia[1]);
+    memcpy(io->screen_data, snapshot->screen_data, sizeof(io->screen_data));
+    memcpy(io->color_ram, snapshot->color_ram, sizeof(io->color_ram));
+    memcpy(io->keyboard_matrix, snapshot->keyboard_matrix, sizeof(io->keyboard_matrix));
+    io->vic_irq_latch = snapshot->vic_irq_latch;
+    io->vic_irq_mask = snapshot->vic_irq_mask;
+    io->audio_enabled = snapshot->audio_enabled;
+    io->frame_count = snapshot->frame_count;
+
+    // Events the snapshot doesn't have weren't scheduled when it was taken
+    for (int i = 0; i < m->sched.event_count; i++) {
+        uint64_t cycle = SCHED_NEVER;
+        for (uint32_t j = 0; j < snapshot->event_count && j < SCHED_MAX_EVENTS; j++) {
+            if (strncmp(snapshot->events[j].name, m->sched.events[i].name, SNAPSHOT_EVENT_NAME_SIZE - 1) == 0) {
+                cycle = snapshot->events[j].cycle;
+                break;
+            }
+        }
+        if (cycle == SCHED_NEVER) {
+            sched_cancel(m, i);
+        } else {
+            sched_schedule(m, i, cycle);
+        }
+    }
+}
+
+/**
+ * Restart the exported RAM header updates from the machine's new clock
+ * They follow this machine's clock, not the snapshot's.
+ */
+static void snapshot_export_clock_changed(Machine *m) {
+    if (m->memory.export_header) {
+        sched_schedule(m, m->memory.export_event, m->cycles + MEMORY_EXPORT_INTERVAL);
+    }
+}
+
+/**
+ * Capture everything but RAM and the banking configuration
+ */
+void snapshot_capture_devices_r(Machine *m, MachineSnapshot *snapshot) {
+    snapshot_fill(m, snapshot);
+}
+
+/**
+ * Give a machine the state of another, except RAM
+ * Only the part of a snapshot before RAM is filled in and read back.
+ */
+int snapshot_copy_devices_r(Machine *m, Machine *from) {
+    MachineSnapshot *snapshot = malloc(offsetof(MachineSnapshot, memory));
+    if (!snapshot) {
+        printf("Error: Could not allocate a snapshot\n");
+        return 0;
+    }
+    snapshot_capture_devices_r(from, snapshot);
+    snapshot_restore_devices_r(m, snapshot);
+    snapshot_export_clock_changed(m);
+    free(snapshot);
+    return 1;
+}
+
+/**
+ * Put a machine back in a captured state
+ */
+void snapshot_restore_r(Machine *m, const MachineSnapshot *snapshot) {
+    if (snapshot->basic_rom && snapshot->kernal_rom && snapshot->char_rom) {
+        memory_set_roms_r(m, snapshot->basic_rom, snapshot->kernal_rom, snapshot->char_rom);
+    }
+    if (m->snapshot == snapshot && m->snapshot_id == snapshot->id) {
+        uint64_t pages[MEMORY_DIRTY_PAGE_WORDS];
+        memory_get_dirty_pages_r(m, MEMORY_DIRTY_SNAPSHOT, pages);
+        memory_restore_pages_r(m, snapshot->memory, pages);
+    } else {
+        memory_restore_state_r(m, snapshot->memory);
+    }
+    memory_take_dirty_range_r(m, MEMORY_DIRTY_SNAPSHOT, 0x00, 0xFF);
+    snapshot_restore_devices_r(m, snapshot);
+    snapshot_export_clock_changed(m);
+    rewind_clock_changed_r(m);
+    input_log_clock_changed_r(m);
+
+    m->snapshot = snapshot;
+    m->snapshot_id = snapshot->id;
+}
+
+/**
+ * Save the state of a machine to a file
+ * The machine's own snapshot, if any, stays in step.
+ */
+int snapshot_save_file_r(Machine *m, const char *filename) {
+    MachineSnapshot *snapshot = calloc(1, sizeof(MachineSnapshot));
+    if (!snapshot) {
+        printf("Error: Could not allocate a snapshot\n");
+        return 0;
+    }
+    if (!m->memory.basic_rom || !m->memory.kernal_rom || !m->memory.char_rom) {
+        printf("Error: ROMs are not loaded\n");
+        free(snapshot);
+        return 0;
+    }
+    memory_save_state_r(m, snapshot->memory);
+    snapshot_fill(m, snapshot);
+
+    // The images follow the structure; pointers mean nothing in a file
+    struct iovec parts[4] = {
+        { snapshot, sizeof(MachineSnapshot) },
+        { (void *)snapshot->basic_rom, MEMORY_BASIC_ROM_SIZE },
+        { (void *)snapshot->kernal_rom, MEMORY_KERNAL_ROM_SIZE },
+        { (void *)snapshot->char_rom, MEMORY_CHAR_ROM_SIZE },
+    };
+    snapshot->basic_rom = snapshot->kernal_rom = snapshot->char_rom = NULL;
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Error: Could not create file %s\n", filename);
+        free(snapshot);
+        return 0;
+    }
+    ssize_t written = writev(fd, parts, 4);
+    free(snapshot);
+    if (close(fd) != 0 || written != (ssize_t)SNAPSHOT_FILE_SIZE) {
+        printf("Error: Could not write all data to file %s\n", filename);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Check the header of a snapshot file
+ */
+static int snapshot_check(const char *filename, const MachineSnapshot *snapshot, size_t got) {
+    if (got < offsetof(MachineSnapshot, id) ||
+        memcmp(snapshot->magic, SNAPSHOT_MAGIC, sizeof(snapshot->magic)) != 0) {
+        printf("Error: %s is not a snapshot\n", filename);
+        return 0;
+    }
+    if (snapshot->version != SNAPSHOT_VERSION || snapshot->size != sizeof(MachineSnapshot) ||
+        got != SNAPSHOT_FILE_SIZE) {
+        printf("Error: %s is a snapshot of version %u (%u bytes), expected version %d (%zu bytes)\n",
+               filename, snapshot->version, snapshot->size, SNAPSHOT_VERSION, sizeof(MachineSnapshot));
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Read a snapshot file
+ * The ROM images go into the ROM cache, so reading the same file again
+ * shares them.
+ */
+int snapshot_read_file(const char *filename, MachineSnapshot *snapshot) {
+    uint8_t roms[MEMORY_BASIC_ROM_SIZE + MEMORY_KERNAL_ROM_SIZE + MEMORY_CHAR_ROM_SIZE];
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Could not open file %s\n", filename);
+        return 0;
+    }
+    struct iovec parts[2] = {
+        { snapshot, sizeof(MachineSnapshot) },
+        { roms, sizeof(roms) },
+    };
+    ssize_t got = readv(fd, parts, 2);
+    close(fd);
+
+    if (!snapshot_check(filename, snapshot, got < 0 ? 0 : (size_t)got)) {
+        return 0;
+    }
+    snapshot->basic_rom = rom_cache_intern(roms, MEMORY_BASIC_ROM_SIZE);
+    snapshot->kernal_rom = rom_cache_intern(roms + MEMORY_BASIC_ROM_SIZE, MEMORY_KERNAL_ROM_SIZE);
+    snapshot->char_rom = rom_cache_intern(roms + MEMORY_BASIC_ROM_SIZE + MEMORY_KERNAL_ROM_SIZE,
+                                          MEMORY_CHAR_ROM_SIZE);
+    if (!snapshot->basic_rom || !snapshot->kernal_rom || !snapshot->char_rom) {
+        printf("Error: Could not allocate ROM images\n");
+        return 0;
+    }
+
+    // New contents: no machine is in step with it
+    snapshot->id = __atomic_add_fetch(&snapshot_last_id, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/**
+ * Restore the state of a machine from a file
+ */
+int snapshot_load_file_r(Machine *m, const char *filename) {
+    MachineSnapshot *snapshot = malloc(sizeof(MachineSnapshot));
+    if (!snapshot) {
+        printf("Error: Could not allocate a snapshot\n");
+        return 0;
+    }
+    if (!snapshot_read_file(filename, snapshot)) {
+        free(snapshot);
+        return 0;
+    }
+    snapshot_restore_r(m, snapshot);
+
+    // The machine can't stay in step with a snapshot that is freed
+    m->snapshot = NULL;
+    free(snapshot);
+    return 1;
+}
+
+/**
+ * Map a snapshot file for the life of the process
+ * The mapping is private and writable so the header can be given an id;
+ * pages that are only read stay shared with the page cache. It is
+ * populated up front, which is cheaper than faulting it in page by page.
+ */
+const MachineSnapshot *snapshot_map_file(const char *filename) {
+    struct stat st;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Could not open file %s\n", filename);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)offsetof(MachineSnapshot, id)) {
+        close(fd);
+        printf("Error: %s is not a snapshot\n", filename);
+        return NULL;
+    }
+    uint8_t *data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("Error: Could not map file %s\n", filename);
+        return NULL;
+    }
+
+    MachineSnapshot *snapshot = (MachineSnapshot *)data;
+    if (!snapshot_check(filename, snapshot, (size_t)st.st_size)) {
+        munmap(data, (size_t)st.st_size);
+        return NULL;
+    }
+    snapshot->basic_rom = data + sizeof(MachineSnapshot);
+    snapshot->kernal_rom = snapshot->basic_rom + MEMORY_BASIC_ROM_SIZE;
+    snapshot->char_rom = snapshot->kernal_rom + MEMORY_KERNAL_ROM_SIZE;
+    snapshot->id = __atomic_add_fetch(&snapshot_last_id, 1, __ATOMIC_RELAXED);
+    return snapshot;
+}
+
+/* ------------------------------------------------------------------ */
+/* Single-machine API                                                 */
+/* ------------------------------------------------------------------ */
+
+void snapshot_capture(MachineSnapshot *snapshot) {
+    snapshot_capture_r(machine_default(), snapshot);
+}
+
+void snapshot_restore(const MachineSnapshot *snapshot) {
+    snapshot_restore_r(machine_default(), snapshot);
+}
+
+int snapshot_save_file(const char *filename) {
+    return snapshot_save_file_r(machine_default(), filename);
+}
+
+int snapshot_load_file(const char *filename) {
+    return snapshot_load_file_r(machine_default(), filename);
+}
@@ -0,0 +1,202 @@
+/**
+ * snapshot.h
+ * Machine snapshots for the Commodore 64 emulator
+ *
+ * A MachineSnapshot holds the whole emulated state of a machine: CPU
+ * registers and cycle count, pending interrupts, RAM and the banking
+ * configuration, the VIC-II, SID and CIA registers and timers, screen and
+ * color RAM, the keyboard matrix and the cycle of every scheduled device
+ * event. It points at the ROM images in use rather than copying them
+ * (they are shared and never change). Host-side state (the decode cache,
+ * the JIT, breakpoints, hooks) is not part of it.
+ *
+ * A snapshot file is the flat structure followed by the BASIC, KERNAL and
+ * character ROM images, so saving is a single write and a file can be
+ * mapped and used in place (snapshot_map_file()). It starts with a magic
+ * string, a format version and the structure's size, which are checked
+ * on load; loading only works on a build with the same snapshot layout.
+ *
+ * Capture and restore are incremental. A machine remembers the snapshot
+ * its RAM was last captured into or restored from, and the
+ * MEMORY_DIRTY_SNAPSHOT set records the pages written since. Capturing
+ * into or restoring from that same snapshot again only copies those
+ * pages; any other snapshot is copied in full.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "machine.h"
+
+#define SNAPSHOT_MAGIC           "C64SNAP"
+#define SNAPSHOT_VERSION         2
+#define SNAPSHOT_EVENT_NAME_SIZE 24
+
+// Size of a snapshot file: the structure, then the ROM images
+#define SNAPSHOT_FILE_SIZE (sizeof(MachineSnapshot) + MEMORY_BASIC_ROM_SIZE + \
+                            MEMORY_KERNAL_ROM_SIZE + MEMORY_CHAR_ROM_SIZE)
+
+/**
+ * A scheduled device event, matched by name on restore
+ */
+typedef struct {
+    char name[SNAPSHOT_EVENT_NAME_SIZE];
+    uint64_t cycle;               // SCHED_NEVER if it isn't scheduled
+} SnapshotEvent;
+
+/**
+ * State of a CIA chip
+ */
+typedef struct {
+    uint8_t registers[CIA_REGISTERS_SIZE];
+    uint16_t latch[2];            // Timer A and timer B
+    uint16_t counter[2];
+    uint64_t base_cycle[2];
+    uint8_t icr_data;
+    uint8_t icr_mask;
+} SnapshotCia;
+
+/**
+ * Emulated state of one machine
+ */
+typedef struct MachineSnapshot {
+    char magic[8];                // SNAPSHOT_MAGIC
+    uint32_t version;             // SNAPSHOT_VERSION
+    uint32_t size;                // sizeof(MachineSnapshot)
+    uint64_t id;                  // Changes on every capture; never 0 once captured
+
+    // CPU
+    CPU cpu;
+    uint64_t cycles;
+    uint8_t irq_pending;
+    uint8_t nmi_pending;
+
+    // I/O
+    uint8_t vic_registers[VIC_REGISTERS_SIZE];
+    uint8_t sid_registers[SID_REGISTERS_SIZE];
+    SnapshotCia cia[2];
+    uint8_t screen_data[40 * 25];
+    uint8_t color_ram[COLOR_RAM_SIZE];
+    uint8_t keyboard_matrix[8];
+    uint8_t vic_irq_latch;
+    uint8_t vic_irq_mask;
+    uint8_t audio_enabled;
+    uint64_t frame_count;
+
+    // Scheduled events
+    uint32_t event_count;
+    SnapshotEvent events[SCHED_MAX_EVENTS];
+
+    // ROM images in use (NULL in a file, where the images follow)
+    const uint8_t *basic_rom;
+    const uint8_t *kernal_rom;
+    const uint8_t *char_rom;
+
+    // RAM and the banking configuration (memory_save_state() format)
+    uint8_t memory[MEMORY_STATE_SIZE];
+} MachineSnapshot;
+
+/**
+ * Capture the state of a machine
+ * Only copies the pages written since the last capture or restore if
+ * snapshot is the one the machine was last synchronised with.
+ *
+ * @param snapshot Snapshot to fill in
+ */
+void snapshot_capture_r(Machine *m, MachineSnapshot *snapshot);
+
+/**
+ * Put a machine back in a captured state
+ * Only copies the pages written since the last capture or restore if
+ * snapshot is the one the machine was last synchronised with. Decoded
+ * code on the pages that change is dropped.
+ *
+ * @param snapshot Snapshot made by snapshot_capture() or snapshot_read_file()
+ */
+void snapshot_restore_r(Machine *m, const MachineSnapshot *snapshot);
+
+/**
+ * Capture everything but RAM and the banking configuration
+ * Fills in the part of a snapshot before its memory field; nothing past
+ * offsetof(MachineSnapshot, memory) is written, and the id is left alone.
+ *
+ * @param snapshot Snapshot to fill in
+ */
+void snapshot_capture_devices_r(Machine *m, MachineSnapshot *snapshot);
+
+/**
+ * Put back what snapshot_capture_devices() captured
+ * RAM and the banking configuration are left alone, and every scheduled
+ * event gets exactly the cycle it had, so a caller that puts RAM back
+ * too has the machine as it was. The RAM export and rewind clocks are
+ * not adjusted; use snapshot_restore() to move a machine in time.
+ *
+ * @param snapshot Snapshot filled in by snapshot_capture_devices()
+ */
+void snapshot_restore_devices_r(Machine *m, const MachineSnapshot *snapshot);
+
+/**
+ * Give a machine the state of another machine, except RAM
+ * Copies what a snapshot would hold besides RAM and the banking
+ * configuration: CPU registers, cycle count, pending interrupts, I/O
+ * chips and scheduled events. machine_fork() shares RAM separately.
+ *
+ * @param from Machine to copy the state of
+ * @return 1 on success, 0 if memory runs out (the machine is unchanged)
+ */
+int snapshot_copy_devices_r(Machine *m, Machine *from);
+
+/**
+ * Save the state of a machine to a file
+ *
+ * @param filename File to create or replace
+ * @return 1 on success, 0 on failure
+ */
+int snapshot_save_file_r(Machine *m, const char *filename);
+
+/**
+ * Read a file written by snapshot_save_file()
+ * A harness can read a snapshot once and restore it into machines as
+ * often as it likes.
+ *
+ * @param filename Snapshot file
+ * @param snapshot Snapshot to fill in
+ * @return 1 on success, 0 if the file can't be read or isn't a snapshot
+ *         of this version
+ */
+int snapshot_read_file(const char *filename, MachineSnapshot *snapshot);
+
+/**
+ * Restore the state of a machine from a file written by snapshot_save_file()
+ *
+ * @param filename Snapshot file
+ * @return 1 on success, 0 if the file can't be read or isn't a snapshot
+ *         of this version (the machine is unchanged then)
+ */
+int snapshot_load_file_r(Machine *m, const char *filename);
+
+/**
+ * Map a snapshot file for the life of the process
+ * The file is mapped privately and used in place: restoring it copies
+ * RAM out of the mapping, and the machine runs on the ROM images in the
+ * mapping, so nothing is copied twice. The whole mapping is populated
+ * (read in) when it is made, rather than faulted in a page at a time.
+ * This is how c64emu --resume starts.
+ *
+ * @param filename Snapshot file
+ * @return The snapshot, never unmapped, or NULL if the file can't be
+ *         mapped or isn't a snapshot of this version
+ */
+const MachineSnapshot *snapshot_map_file(const char *filename);
+
+/*
+ * Single-machine API
+ * Each function below calls its _r variant with machine_default().
+ */
+void snapshot_capture(MachineSnapshot *snapshot);
+void snapshot_restore(const MachineSnapshot *snapshot);
+int snapshot_save_file(const char *filename);
+int snapshot_load_file(const char *filename);
+
+#endif /* SNAPSHOT_H */
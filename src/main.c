@@ -19,10 +19,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/stat.h>
 #include "cpu/cpu.h"
 #include "memory/memory.h"
 #include "io/io.h"
 #include "shell/shell.h"
+#include "machine/machine.h"
+#include "machine/snapshot.h"
+#include "machine/input_log.h"
+#include "batch/batch.h"
 
 /**
  * Path to ROM files
@@ -89,6 +94,32 @@ void init_emulator() {
     printf("Commodore 64 Emulator initialized successfully.\n");
 }
 
+/**
+ * Start from a snapshot file instead of booting
+ * The file is mapped and used in place: no ROM files are read and no
+ * startup program is loaded; the machine carries on where the snapshot
+ * was taken, on the ROM images stored in it.
+ * 
+ * @param image Snapshot file written by snapshot_save_file()
+ * @return 1 on success, 0 if the file can't be used
+ */
+int resume_emulator(const char *image) {
+    const MachineSnapshot *snapshot = snapshot_map_file(image);
+    if (!snapshot) {
+        return 0;
+    }
+    
+    // Devices register their events and hooks; the snapshot then overrides their state
+    memory_init();
+    cpu_init();
+    io_init();
+    shell_init();
+    snapshot_restore(snapshot);
+    
+    printf("Commodore 64 Emulator resumed from %s\n", image);
+    return 1;
+}
+
 /**
  * Display emulator and system information
  * Prints a welcome message and basic info about the emulated system
@@ -104,6 +135,34 @@ void show_system_info() {
     printf("Type 'help' to see available commands\n\n");
 }
 
+/**
+ * Run a batch of programs without the shell
+ * Usage: c64emu --batch <manifest> <results> [--jobs <n>]
+ * See src/batch/batch.h for the manifest and results formats.
+ * 
+ * @param argc Number of command line arguments
+ * @param argv Array of command line argument strings
+ * @return Program exit code
+ */
+int run_batch(int argc, char *argv[]) {
+    int workers = 0;  // One per online CPU
+    
+    if (argc == 6 && strcmp(argv[4], "--jobs") == 0) {
+        workers = atoi(argv[5]);
+    } else if (argc != 4) {
+        printf("Usage: %s --batch <manifest> <results> [--jobs <n>]\n", argv[0]);
+        return 2;
+    }
+    
+    // The default machine holds the ROMs every worker starts from
+    memory_init();
+    load_roms();
+    cpu_init();
+    io_init();
+    
+    return batch_run(machine_default(), argv[2], argv[3], workers) ? 0 : 1;
+}
+
 /**
  * Main program entry point
  * Initializes the emulator, displays system information, and runs the shell
@@ -113,13 +172,75 @@ void show_system_info() {
  * @return Program exit code
  */
 int main(int argc, char *argv[]) {
+    const char *export_name = NULL;
+    const char *resume_image = NULL;
+    const char *probe_start = NULL;
+    const char *record_input = NULL;
+    const char *replay_input = NULL;
+    
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        return run_batch(argc, argv);
+    }
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--export-ram") == 0 && i + 1 < argc) {
+            export_name = argv[++i];
+        } else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+            resume_image = argv[++i];
+        } else if (strcmp(argv[i], "--startup-probe") == 0 && i + 1 < argc) {
+            probe_start = argv[++i];
+        } else if (strcmp(argv[i], "--record-input") == 0 && i + 1 < argc && !replay_input) {
+            record_input = argv[++i];
+        } else if (strcmp(argv[i], "--replay-input") == 0 && i + 1 < argc && !record_input) {
+            replay_input = argv[++i];
+        } else {
+            printf("Usage: %s [--export-ram <name>] [--resume <snapshot>]\n", argv[0]);
+            printf("       %*s [--record-input <log> | --replay-input <log>]\n", (int)strlen(argv[0]), "");
+            printf("       %s --batch <manifest> <results> [--jobs <n>]\n", argv[0]);
+            return 1;
+        }
+    }
+    
     printf("Commodore 64 Emulator starting...\n");
     
-    // Create ROMs directory if it doesn't exist
-    system("mkdir -p roms");
+    if (resume_image) {
+        // Carry on from a saved machine
+        if (!resume_emulator(resume_image)) {
+            return 1;
+        }
+    } else {
+        // Create ROMs directory if it doesn't exist
+        mkdir("roms", 0755);
+        
+        // Initialize the emulator
+        init_emulator();
+    }
+    
+    // Startup latency probe (bench startup): run one instruction and report
+    if (probe_start) {
+        struct timespec now;
+        cpu_step();
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        printf("Startup: %lld ns\n",
+               (long long)now.tv_sec * 1000000000LL + now.tv_nsec - atoll(probe_start));
+        return 0;
+    }
+    
+    // Let external tools map guest RAM
+    if (export_name) {
+        if (!memory_export(export_name)) {
+            return 1;
+        }
+        printf("Guest RAM exported to %s\n", export_name);
+    }
     
-    // Initialize the emulator
-    init_emulator();
+    // Log guest input, or take it from a log instead of the terminal
+    if (record_input && !input_log_record(record_input)) {
+        return 1;
+    }
+    if (replay_input && !input_log_replay(replay_input)) {
+        return 1;
+    }
     
     // Show system information
     show_system_info();
@@ -127,6 +248,12 @@ int main(int argc, char *argv[]) {
     // Run the shell interface
     shell_run();
     
+    // Finish the input log, if any
+    input_log_stop();
+    
+    // Remove the shared memory object, if any
+    memory_unexport();
+    
     printf("Emulator shutdown complete.\n");
     return 0;
 }
\ No newline at end of file
@@ -6,192 +6,1079 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "memory.h"
+#include "rom_cache.h"
+#include "../io/io.h"
+#include "../machine/machine.h"
 
-// Main memory array
-static uint8_t memory[MEMORY_SIZE];
+// Bits of a banking configuration index
+#define PLA_LORAM       0x01    // Processor port bit 0
+#define PLA_HIRAM       0x02    // Processor port bit 1
+#define PLA_CHAREN      0x04    // Processor port bit 2
+#define PLA_GAME        0x08    // Cartridge GAME line
+#define PLA_EXROM       0x10    // Cartridge EXROM line
 
-// Memory banking control flags
-static int basic_rom_enabled = 1;
-static int kernal_rom_enabled = 1;
-static int char_rom_enabled = 1;
-static int io_enabled = 1;
+/**
+ * Check whether a page is dirty in every dirty set
+ * Writes to such a page have nothing to record (unless blocks are
+ * recorded), so they can take the direct path.
+ */
+static int memory_page_dirty_everywhere(MemoryState *mem, int page) {
+    for (int set = 0; set < MEMORY_DIRTY_SETS; set++) {
+        if (!((mem->dirty_pages[set][page >> 6] >> (page & 63)) & 1)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Check whether writes to a page can go through a direct pointer
+ * Only unwatched RAM pages with no dirty bit left to set and no shared
+ * copy to drop are written through the pointer.
+ */
+static int memory_page_direct(MemoryState *mem, int page) {
+    return !MEMORY_CODE_PAGE(mem, page) && !mem->dirty_blocks_enabled &&
+           memory_page_dirty_everywhere(mem, page) && !mem->shared_pages[page];
+}
+
+/**
+ * Give a page its direct write pointer in every configuration
+ */
+static void update_write_page(MemoryState *mem, int page) {
+    int direct = memory_page_direct(mem, page);
+    
+    for (int i = 0; i < MEMORY_CONFIG_TABLES; i++) {
+        MemoryConfig *config = &mem->config_tables[i];
+        if (config->write_kind[page] == MEMORY_WRITE_RAM && direct) {
+            config->write_map[page] = mem->ram_pages[page];
+        } else {
+            config->write_map[page] = NULL;
+        }
+    }
+    if (page == 0x00) {
+        mem->zero_page_direct = direct;
+    }
+}
+
+/**
+ * Shared pages that every machine's RAM starts out as: zeros, and zero
+ * page with the processor port's power-on values
+ * Never freed, so they aren't reference counted.
+ */
+static MemoryPage memory_zero_page;
+static MemoryPage memory_reset_page = { 0, { 0x2F, 0x37 } };
+
+/**
+ * Check whether a shared page is one of the pages above
+ */
+static int memory_page_static(const MemoryPage *page) {
+    return page == &memory_zero_page || page == &memory_reset_page;
+}
+
+/**
+ * Take a reference to a shared page
+ */
+static MemoryPage *memory_page_ref(MemoryPage *page) {
+    if (!memory_page_static(page)) {
+        __atomic_add_fetch(&page->refs, 1, __ATOMIC_RELAXED);
+    }
+    return page;
+}
 
-// ROM Data (would be loaded from files in a full implementation)
-static uint8_t basic_rom[8192];   // 8K BASIC ROM
-static uint8_t kernal_rom[8192];  // 8K KERNAL ROM
-static uint8_t char_rom[4096];    // 4K Character ROM
+/**
+ * Drop a reference to a shared page, freeing it with the last one
+ * Forks may drop their references on other threads.
+ */
+static void memory_page_unref(MemoryPage *page) {
+    if (!memory_page_static(page) && __atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(page);
+    }
+}
 
-// Memory access cache for faster lookups
-static uint8_t *memory_read_map[256];  // Fast lookup for pages (256 pages of 256 bytes)
+/**
+ * Drop every shared page and read all of RAM from the machine's own
+ * storage again, if it has any, without copying anything in
+ */
+static void memory_drop_shared(MemoryState *mem) {
+    for (int page = 0; page < 256; page++) {
+        if (mem->shared_pages[page]) {
+            memory_page_unref(mem->shared_pages[page]);
+            mem->shared_pages[page] = NULL;
+        }
+        mem->ram_pages[page] = mem->ram ? &mem->ram[page << 8] : NULL;
+    }
+}
 
 /**
- * Update memory banking and read/write maps
+ * Get the machine's own RAM, allocating it the first time
+ * A new machine or fork reads every page from a shared page, so it needs
+ * no RAM of its own until it writes to one.
+ *
+ * @return The RAM, or NULL if it can't be allocated
  */
-static void update_memory_maps() {
-    // Set up default read map (points to RAM)
-    for (int i = 0; i < 256; i++) {
-        memory_read_map[i] = &memory[i << 8];
+static uint8_t *memory_storage(MemoryState *mem) {
+    if (!mem->ram_storage) {
+        mem->ram_storage = malloc(MEMORY_SIZE);
+        if (!mem->ram_storage) {
+            printf("Error: Could not allocate RAM\n");
+        }
     }
+    return mem->ram_storage;
+}
+
+/**
+ * Get a page of RAM ready to be written
+ * A page still read from a shared page is copied into the machine's own
+ * RAM first, and every configuration reading RAM there is pointed at the
+ * copy. The shared copy no longer matches once the page is written, so
+ * it is dropped.
+ * 
+ * @return The page in the machine's own RAM, or NULL if there is none
+ *         and it can't be allocated (the write is dropped then)
+ */
+static uint8_t *memory_own_page(MemoryState *mem, int page) {
+    MemoryPage *shared = mem->shared_pages[page];
     
-    // Update maps based on banking configuration
-    if (basic_rom_enabled) {
-        // BASIC ROM from $A000-$BFFF
-        for (int i = 0xA0; i <= 0xBF; i++) {
-            memory_read_map[i] = &basic_rom[(i - 0xA0) << 8];
+    if (!mem->ram && !(mem->ram = memory_storage(mem))) {
+        return NULL;
+    }
+    uint8_t *own = &mem->ram[page << 8];
+    if (shared) {
+        if (mem->ram_pages[page] != own) {
+            memcpy(own, shared->data, 256);
+            for (int i = 0; i < MEMORY_CONFIG_TABLES; i++) {
+                if (mem->config_tables[i].read_map[page] == shared->data) {
+                    mem->config_tables[i].read_map[page] = own;
+                }
+            }
+            mem->ram_pages[page] = own;
         }
+        mem->shared_pages[page] = NULL;
+        memory_page_unref(shared);
+        update_write_page(mem, page);
     }
+    return own;
+}
+
+/**
+ * Record a write to RAM from address to address + length - 1 (on one page)
+ * in every dirty set
+ */
+static void memory_mark_dirty(MemoryState *mem, uint16_t address, size_t length) {
+    int page = address >> 8;
     
-    if (kernal_rom_enabled) {
-        // KERNAL ROM from $E000-$FFFF
-        for (int i = 0xE0; i <= 0xFF; i++) {
-            memory_read_map[i] = &kernal_rom[(i - 0xE0) << 8];
+    if (mem->dirty_blocks_enabled) {
+        for (int block = address / MEMORY_DIRTY_BLOCK_SIZE;
+             block <= (int)((address + length - 1) / MEMORY_DIRTY_BLOCK_SIZE); block++) {
+            for (int set = 0; set < MEMORY_DIRTY_SETS; set++) {
+                mem->dirty_blocks[set][block >> 6] |= 1ULL << (block & 63);
+            }
         }
     }
+    if (!memory_page_dirty_everywhere(mem, page)) {
+        for (int set = 0; set < MEMORY_DIRTY_SETS; set++) {
+            mem->dirty_pages[set][page >> 6] |= 1ULL << (page & 63);
+        }
+        update_write_page(mem, page);
+    }
+}
+
+/**
+ * Tell the code hook that a watched page (or, with -1, every page) changed
+ */
+static void memory_code_changed(Machine *m, int page) {
+    MemoryState *mem = &m->memory;
     
-    if (io_enabled) {
-        // I/O region at $D000-$DFFF
-        // In a real implementation, this would be handled specially
-    } else if (char_rom_enabled) {
-        // Character ROM at $D000-$DFFF when I/O is disabled
-        for (int i = 0xD0; i <= 0xDF; i++) {
-            memory_read_map[i] = &char_rom[(i - 0xD0) << 8];
+    if (page < 0) {
+        for (int i = 0; i < 256; i++) {
+            if (MEMORY_CODE_PAGE(mem, i)) {
+                mem->code_pages[i >> 6] &= ~(1ULL << (i & 63));
+                update_write_page(mem, i);
+            }
         }
+    } else {
+        mem->code_pages[page >> 6] &= ~(1ULL << (page & 63));
+        update_write_page(mem, page);
+    }
+    if (mem->code_hook) {
+        mem->code_hook(m, page);
     }
 }
 
 /**
- * Initialize the memory system
+ * Where a page reads from in a banking configuration
  */
-void memory_init() {
-    // Clear all memory
-    memset(memory, 0, MEMORY_SIZE);
+typedef enum {
+    MEMORY_SOURCE_RAM,
+    MEMORY_SOURCE_BASIC,          // BASIC ROM, from $A000
+    MEMORY_SOURCE_KERNAL,         // KERNAL ROM, from $E000
+    MEMORY_SOURCE_CHAR,           // Character ROM, from $D000
+    MEMORY_SOURCE_OPEN_BUS,       // Nothing mapped, or cartridge ROM (not emulated)
+    MEMORY_SOURCE_IO              // I/O device; no read pointer
+} MemorySource;
+
+/**
+ * Layout of one banking configuration: what each page reads from and
+ * what a write to it does
+ * The same for every machine, so the layouts are built once per process
+ * and a machine's page tables only add its own RAM and ROM pointers.
+ */
+typedef struct {
+    uint8_t source[256];          // MemorySource of each page
+    uint8_t write_kind[256];      // MemoryWriteKind of each page
+} MemoryLayout;
+
+static MemoryLayout memory_layouts[MEMORY_CONFIG_COUNT];
+static uint8_t memory_config_table[MEMORY_CONFIG_COUNT];  // Page tables each configuration uses
+static uint8_t memory_table_layout[MEMORY_CONFIG_TABLES]; // A configuration using each one
+static pthread_once_t layouts_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Map a range of pages in a layout
+ */
+static void map_pages(MemoryLayout *layout, int first, int last, MemorySource source, MemoryWriteKind write_kind) {
+    memset(&layout->source[first], source, last - first + 1);
+    memset(&layout->write_kind[first], write_kind, last - first + 1);
+}
+
+/**
+ * Build the layout of one banking configuration
+ * Follows the PLA of the C64: BASIC needs LORAM and HIRAM, KERNAL needs
+ * HIRAM, and $D000 shows I/O or the character ROM unless both are low.
+ * A cartridge (GAME/EXROM low) adds ROML at $8000 and ROMH at $A000, and
+ * GAME low with EXROM high is Ultimax mode, where only the first 4K, I/O
+ * and the cartridge are mapped. Writes to ROM go to the RAM underneath.
+ */
+static void build_memory_layout(int index) {
+    MemoryLayout *layout = &memory_layouts[index];
+    int loram = (index & PLA_LORAM) != 0;
+    int hiram = (index & PLA_HIRAM) != 0;
+    int charen = (index & PLA_CHAREN) != 0;
+    int game = (index & PLA_GAME) != 0;
+    int exrom = (index & PLA_EXROM) != 0;
     
-    // Initialize ROM areas with placeholder patterns
-    memset(basic_rom, 0xEA, sizeof(basic_rom));    // NOP instructions
-    memset(kernal_rom, 0xEA, sizeof(kernal_rom));  // NOP instructions
-    memset(char_rom, 0x00, sizeof(char_rom));      // Empty characters
+    // Start from all RAM; the processor port lives in zero page
+    map_pages(layout, 0x00, 0xFF, MEMORY_SOURCE_RAM, MEMORY_WRITE_RAM);
+    layout->write_kind[0x00] = MEMORY_WRITE_PORT;
     
-    // Set up default memory configuration
-    basic_rom_enabled = 1;
-    kernal_rom_enabled = 1;
-    char_rom_enabled = 1;
-    io_enabled = 1;
+    if (!game && exrom) {
+        // Ultimax: no cartridge ROM is emulated, so ROML and ROMH are open bus too
+        map_pages(layout, 0x10, 0xCF, MEMORY_SOURCE_OPEN_BUS, MEMORY_WRITE_IGNORE);
+        map_pages(layout, 0xD0, 0xDF, MEMORY_SOURCE_IO, MEMORY_WRITE_IO);
+        map_pages(layout, 0xE0, 0xFF, MEMORY_SOURCE_OPEN_BUS, MEMORY_WRITE_IGNORE);
+    } else {
+        if (loram && hiram && !exrom) {
+            // ROML from $8000-$9FFF
+            map_pages(layout, 0x80, 0x9F, MEMORY_SOURCE_OPEN_BUS, MEMORY_WRITE_RAM);
+        }
+        if (hiram && !game) {
+            // ROMH from $A000-$BFFF (16K cartridge)
+            map_pages(layout, 0xA0, 0xBF, MEMORY_SOURCE_OPEN_BUS, MEMORY_WRITE_RAM);
+        } else if (loram && hiram) {
+            // BASIC ROM from $A000-$BFFF
+            map_pages(layout, 0xA0, 0xBF, MEMORY_SOURCE_BASIC, MEMORY_WRITE_RAM);
+        }
+        if (hiram) {
+            // KERNAL ROM from $E000-$FFFF
+            map_pages(layout, 0xE0, 0xFF, MEMORY_SOURCE_KERNAL, MEMORY_WRITE_RAM);
+        }
+        if (charen && (loram || hiram)) {
+            // I/O region at $D000-$DFFF
+            map_pages(layout, 0xD0, 0xDF, MEMORY_SOURCE_IO, MEMORY_WRITE_IO);
+        } else if (!charen && (game ? (loram || hiram) : hiram)) {
+            // Character ROM at $D000-$DFFF
+            map_pages(layout, 0xD0, 0xDF, MEMORY_SOURCE_CHAR, MEMORY_WRITE_RAM);
+        }
+    }
+}
+
+/**
+ * Build the layout of every banking configuration (once per process)
+ * Configurations with the same layout share one set of page tables.
+ */
+static void build_memory_layouts() {
+    int tables = 0;
     
-    // Initialize memory with some default values
-    memory[0x0000] = 0x2F;  // Default data direction register
-    memory[0x0001] = 0x37;  // Default processor port
+    for (int i = 0; i < MEMORY_CONFIG_COUNT; i++) {
+        build_memory_layout(i);
+        int j = 0;
+        while (j < i && memcmp(&memory_layouts[j], &memory_layouts[i], sizeof(MemoryLayout)) != 0) {
+            j++;
+        }
+        if (j < i) {
+            memory_config_table[i] = memory_config_table[j];
+        } else {
+            // MEMORY_CONFIG_TABLES is the number of distinct layouts
+            memory_table_layout[tables] = (uint8_t)i;
+            memory_config_table[i] = (uint8_t)tables++;
+        }
+    }
+}
+
+/**
+ * Get the page tables of a banking configuration
+ */
+static const MemoryConfig *memory_config(MemoryState *mem, int index) {
+    return &mem->config_tables[memory_config_table[index]];
+}
+
+/**
+ * Build one set of page tables from its layout
+ * Write pointers are filled in from write_kind and the pages that can be
+ * written directly.
+ */
+static void build_memory_table(MemoryState *mem, MemoryConfig *config, const MemoryLayout *layout,
+                               const uint8_t direct[256]) {
+    for (int page = 0; page < 256; page++) {
+        switch (layout->source[page]) {
+            case MEMORY_SOURCE_BASIC:
+                config->read_map[page] = &mem->basic_rom[(page - 0xA0) << 8];
+                break;
+            case MEMORY_SOURCE_KERNAL:
+                config->read_map[page] = &mem->kernal_rom[(page - 0xE0) << 8];
+                break;
+            case MEMORY_SOURCE_CHAR:
+                config->read_map[page] = &mem->char_rom[(page - 0xD0) << 8];
+                break;
+            case MEMORY_SOURCE_OPEN_BUS:
+                config->read_map[page] = mem->open_bus;
+                break;
+            case MEMORY_SOURCE_IO:
+                // memory_read() passes I/O pages to io_read()
+                config->read_map[page] = NULL;
+                break;
+            default:
+                config->read_map[page] = mem->ram_pages[page];
+                break;
+        }
+        int ram = layout->write_kind[page] == MEMORY_WRITE_RAM && direct[page];
+        config->write_map[page] = ram ? mem->ram_pages[page] : NULL;
+    }
+    config->write_kind = layout->write_kind;
+}
+
+/**
+ * Build the page tables of every banking configuration
+ * Write pointers are filled in one table at a time (update_write_page()
+ * would visit all of them for each page).
+ */
+static void build_memory_configs(MemoryState *mem) {
+    uint8_t direct[256];
+    
+    for (int page = 0; page < 256; page++) {
+        direct[page] = memory_page_direct(mem, page);
+    }
+    for (int i = 0; i < MEMORY_CONFIG_TABLES; i++) {
+        build_memory_table(mem, &mem->config_tables[i], &memory_layouts[memory_table_layout[i]], direct);
+    }
+    mem->zero_page_direct = direct[0x00];
+}
+
+/**
+ * Bring the header of an exported RAM mapping up to date
+ * The sequence count brackets the update so readers can spot a torn read.
+ */
+static void memory_export_update(Machine *m) {
+    MemoryState *mem = &m->memory;
+    MemoryExportHeader *header = mem->export_header;
+    
+    if (!header) {
+        return;
+    }
+    uint32_t sequence = header->sequence;
+    __atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    header->config = (uint8_t)mem->config_index;
+    header->port = MEMORY_RAM(mem, 0x0001);
+    header->cycles = m->cycles;
+    __atomic_store_n(&header->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Switch to another banking configuration
+ * Decoded code only goes stale if one of its pages now reads from a
+ * different bank.
+ */
+static void select_memory_config(Machine *m, int index) {
+    MemoryState *mem = &m->memory;
+    const MemoryConfig *old = mem->config;
+    
+    if (index == mem->config_index) {
+        return;
+    }
+    const MemoryConfig *config = memory_config(mem, index);
+    mem->config = config;
+    mem->config_index = index;
+    memory_export_update(m);
+    
+    for (int word = 0; word < 4; word++) {
+        uint64_t bits = mem->code_pages[word];
+        while (bits) {
+            int page = (word << 6) + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (old->read_map[page] != config->read_map[page]) {
+                memory_code_changed(m, -1);
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * Index of the configuration selected by the processor port and the cartridge lines
+ */
+static int memory_config_index(MemoryState *mem) {
+    return (MEMORY_RAM(mem, 0x0001) & (PLA_LORAM | PLA_HIRAM | PLA_CHAREN)) |
+           (mem->game_line ? PLA_GAME : 0) |
+           (mem->exrom_line ? PLA_EXROM : 0);
+}
+
+/**
+ * Placeholder ROMs, shared by every machine until real ROMs are loaded
+ */
+static uint8_t placeholder_basic_rom[MEMORY_BASIC_ROM_SIZE];
+static uint8_t placeholder_kernal_rom[MEMORY_KERNAL_ROM_SIZE];
+static uint8_t placeholder_char_rom[MEMORY_CHAR_ROM_SIZE];
+static pthread_once_t placeholder_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Build the placeholder ROMs (once per process)
+ */
+static void build_placeholder_roms() {
+    memset(placeholder_basic_rom, 0xEA, sizeof(placeholder_basic_rom));    // NOP instructions
+    memset(placeholder_kernal_rom, 0xEA, sizeof(placeholder_kernal_rom));  // NOP instructions
+    memset(placeholder_char_rom, 0x00, sizeof(placeholder_char_rom));      // Empty characters
     
     // Set up reset vectors
-    kernal_rom[0x1FFC - 0xE000] = 0x00;  // Set reset vector to $E000
-    kernal_rom[0x1FFD - 0xE000] = 0xE0;
+    placeholder_kernal_rom[0xFFFC - 0xE000] = 0x00;  // Set reset vector to $E000
+    placeholder_kernal_rom[0xFFFD - 0xE000] = 0xE0;
     
     // Set up interrupt vectors
-    kernal_rom[0x1FFA - 0xE000] = 0x43;  // NMI vector
-    kernal_rom[0x1FFB - 0xE000] = 0xFE;
-    kernal_rom[0x1FFE - 0xE000] = 0x48;  // IRQ/BRK vector
-    kernal_rom[0x1FFF - 0xE000] = 0xFF;
+    placeholder_kernal_rom[0xFFFA - 0xE000] = 0x43;  // NMI vector
+    placeholder_kernal_rom[0xFFFB - 0xE000] = 0xFE;
+    placeholder_kernal_rom[0xFFFE - 0xE000] = 0x48;  // IRQ/BRK vector
+    placeholder_kernal_rom[0xFFFF - 0xE000] = 0xFF;
+}
+
+/**
+ * Initialize the memory system
+ */
+void memory_init_r(Machine *m) {
+    MemoryState *mem = &m->memory;
+    
+    // Clear all memory (RAM stays exported across a reset). Every page
+    // starts as a shared page of zeros (zero page with the processor port
+    // set up) and is copied into RAM on its first write; exported RAM is
+    // cleared in place, as it has to show what the CPU sees.
+    if (!mem->export_header) {
+        mem->ram = mem->ram_storage;
+    }
+    memory_drop_shared(mem);
+    if (mem->export_header) {
+        memset(mem->ram, 0, MEMORY_SIZE);
+        memcpy(mem->ram, memory_reset_page.data, 256);
+    } else {
+        for (int page = 0; page < 256; page++) {
+            mem->shared_pages[page] = page ? &memory_zero_page : &memory_reset_page;
+            mem->ram_pages[page] = mem->shared_pages[page]->data;
+        }
+    }
+    
+    // Start with the placeholder ROMs
+    pthread_once(&placeholder_once, build_placeholder_roms);
+    mem->basic_rom = placeholder_basic_rom;
+    mem->kernal_rom = placeholder_kernal_rom;
+    mem->char_rom = placeholder_char_rom;
+    
+    memset(mem->open_bus, 0xFF, sizeof(mem->open_bus));
+    
+    // No cartridge: GAME and EXROM are pulled high
+    mem->game_line = 1;
+    mem->exrom_line = 1;
     
-    // Initialize memory maps
-    update_memory_maps();
+    // All of RAM has changed since any dirty set was last taken
+    memset(mem->dirty_pages, 0xFF, sizeof(mem->dirty_pages));
+    memset(mem->dirty_blocks, 0xFF, sizeof(mem->dirty_blocks));
+    
+    // Build the banking configurations
+    pthread_once(&layouts_once, build_memory_layouts);
+    build_memory_configs(mem);
+    mem->config_index = memory_config_index(mem);
+    mem->config = memory_config(mem, mem->config_index);
+    
+    // Nothing decoded before the reset is valid any more
+    memory_code_changed(m, -1);
 }
 
 /**
  * Read a byte from memory, taking into account memory banking
  */
-uint8_t memory_read(uint16_t address) {
-    uint8_t page = address >> 8;
-    uint8_t offset = address & 0xFF;
+uint8_t memory_read_r(Machine *m, uint16_t address) {
+    const uint8_t *page = m->memory.config->read_map[address >> 8];
     
-    // Special handling for I/O region
-    if (page >= 0xD0 && page <= 0xDF && io_enabled) {
-        // In a full implementation, this would handle I/O chip access
-        return memory[address];
+    // Use the memory map for fast lookups; I/O pages go to their device
+    if (page) {
+        return page[address & 0xFF];
     }
+    return io_read_r(m, address);
+}
+
+/**
+ * Write the processor port at $0001
+ * Bits 0-2 control memory banking.
+ */
+static void memory_write_port(Machine *m, uint8_t value) {
+    MemoryState *mem = &m->memory;
+    uint8_t *zero_page = memory_own_page(mem, 0x00);
     
-    // Use the memory map for fast lookups
-    return memory_read_map[page][offset];
+    if (!zero_page) {
+        return;
+    }
+    zero_page[0x01] = value;
+    memory_mark_dirty(mem, 0x0001, 1);
+    
+    // Every configuration is prebuilt, so this is a pointer swap
+    select_memory_config(m, memory_config_index(mem));
 }
 
 /**
  * Write a byte to memory, taking into account memory banking
  */
-void memory_write(uint16_t address, uint8_t value) {
-    // Check if writing to ROM regions (writes are ignored in ROM)
-    if (basic_rom_enabled && address >= BASIC_ROM_START && address <= BASIC_ROM_END) {
-        // Writing to BASIC ROM area is ignored when ROM is enabled
-        return;
-    } else if (kernal_rom_enabled && address >= KERNAL_ROM_START && address <= KERNAL_ROM_END) {
-        // Writing to KERNAL ROM area is ignored when ROM is enabled
+void memory_write_r(Machine *m, uint16_t address, uint8_t value) {
+    MemoryState *mem = &m->memory;
+    uint8_t *page = mem->config->write_map[address >> 8];
+    
+    // Plain RAM page: one indexed store
+    if (page) {
+        page[address & 0xFF] = value;
         return;
-    } else if (address >= IO_REGION_START && address <= IO_REGION_END) {
-        if (io_enabled) {
-            // Writing to I/O region
-            // In a full implementation, this would handle I/O chip access
-            memory[address] = value;
+    }
+    
+    // Drop decoded instructions before the bytes under them change
+    if (MEMORY_CODE_PAGE(mem, address >> 8)) {
+        memory_code_changed(m, address >> 8);
+    }
+    
+    switch (mem->config->write_kind[address >> 8]) {
+        case MEMORY_WRITE_IGNORE:
+            // Nothing is mapped here
             return;
-        } else if (char_rom_enabled) {
-            // Writing to Character ROM is ignored
+        case MEMORY_WRITE_IO:
+            io_write_r(m, address, value);
             return;
+        case MEMORY_WRITE_PORT:
+            if (address == 0x0001) {
+                memory_write_port(m, value);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    
+    // Default case: write to RAM (copying in a shared page first)
+    uint8_t *own = memory_own_page(mem, address >> 8);
+    if (own) {
+        own[address & 0xFF] = value;
+        memory_mark_dirty(mem, address, 1);
+    }
+}
+
+/**
+ * Check whether an address reaches an I/O device in the current banking
+ */
+int memory_is_io_r(Machine *m, uint16_t address) {
+    return m->memory.config->write_kind[address >> 8] == MEMORY_WRITE_IO;
+}
+
+/**
+ * Clip a block to the end of the address space
+ */
+static size_t memory_clip_block(uint16_t address, size_t length) {
+    if (address + length > MEMORY_SIZE) {
+        printf("Warning: Data exceeds memory bounds\n");
+        length = MEMORY_SIZE - address;
+    }
+    return length;
+}
+
+/**
+ * Number of bytes of a block that are on its first page
+ */
+static size_t memory_page_span(uint16_t address, size_t length) {
+    size_t span = 0x100 - (address & 0xFF);
+    return span < length ? span : length;
+}
+
+/**
+ * Read a block of memory, taking into account memory banking
+ */
+void memory_read_block_r(Machine *m, uint16_t address, uint8_t *buffer, size_t length) {
+    length = memory_clip_block(address, length);
+    
+    while (length > 0) {
+        size_t span = memory_page_span(address, length);
+        const uint8_t *page = m->memory.config->read_map[address >> 8];
+        
+        if (page) {
+            memcpy(buffer, &page[address & 0xFF], span);
+        } else {
+            // I/O page: each register is read from its device
+            for (size_t i = 0; i < span; i++) {
+                buffer[i] = io_read_r(m, (uint16_t)(address + i));
+            }
         }
+        buffer += span;
+        address += span;
+        length -= span;
     }
+}
+
+/**
+ * Get where the bytes of a span on one page are stored
+ * Returns the RAM (or cartridge) the span is written to, with its dirty
+ * bits set and decoded code on it dropped, or NULL for an I/O page, a
+ * page where writes go nowhere or RAM that can't be allocated. Not for the processor port at $0000/$0001.
+ */
+static uint8_t *memory_block_target(Machine *m, uint16_t address, size_t span) {
+    MemoryState *mem = &m->memory;
+    int page = address >> 8;
+    uint8_t *target = mem->config->write_map[page];
     
-    // Special handling for memory control register at $01
-    if (address == 0x0001) {
-        // Bits 0-2 control memory banking
-        uint8_t old_value = memory[0x0001];
-        memory[0x0001] = value;
+    if (!target) {
+        switch (mem->config->write_kind[page]) {
+            case MEMORY_WRITE_IGNORE:
+            case MEMORY_WRITE_IO:
+                return NULL;
+            default:
+                // RAM under ROM, zero page, a page with decoded code or
+                // a shared page
+                if (MEMORY_CODE_PAGE(mem, page)) {
+                    memory_code_changed(m, page);
+                }
+                target = memory_own_page(mem, page);
+                if (!target) {
+                    return NULL;
+                }
+                memory_mark_dirty(mem, address, span);
+                break;
+        }
+    }
+    return &target[address & 0xFF];
+}
+
+/**
+ * Store a block (data) or a repeated byte (data NULL, value) to memory
+ * Does what the same bytes written one by one through memory_write()
+ * would do, a page at a time.
+ */
+static void memory_store_block(Machine *m, uint16_t address, const uint8_t *data, uint8_t value, size_t length) {
+    length = memory_clip_block(address, length);
+    
+    while (length > 0) {
+        // The processor port can change the banking of the rest of the block
+        if (address <= 0x0001) {
+            memory_write_r(m, address, data ? *data++ : value);
+            address++;
+            length--;
+            continue;
+        }
         
-        kernal_rom_enabled = (value & 0x02) != 0;
-        basic_rom_enabled = (value & 0x03) != 0;
-        io_enabled = (value & 0x04) != 0;
-        char_rom_enabled = (value & 0x04) == 0 && (value & 0x03) != 0;
+        size_t span = memory_page_span(address, length);
+        uint8_t *target = memory_block_target(m, address, span);
         
-        // Only update maps if banking configuration changed
-        if ((old_value & 0x07) != (value & 0x07)) {
-            update_memory_maps();
+        if (target) {
+            if (data) {
+                memcpy(target, data, span);
+            } else {
+                memset(target, value, span);
+            }
+        } else if (memory_is_io_r(m, address)) {
+            // I/O page: each register is written to its device
+            for (size_t i = 0; i < span; i++) {
+                io_write_r(m, (uint16_t)(address + i), data ? data[i] : value);
+            }
         }
-        return;
+        if (data) {
+            data += span;
+        }
+        address += span;
+        length -= span;
     }
-    
-    // Default case: write to RAM
-    memory[address] = value;
+}
+
+/**
+ * Write a block of memory, taking into account memory banking
+ */
+void memory_write_block_r(Machine *m, uint16_t address, const uint8_t *data, size_t length) {
+    memory_store_block(m, address, data, 0, length);
+}
+
+/**
+ * Fill a block of memory with one value, taking into account memory banking
+ */
+void memory_fill_r(Machine *m, uint16_t address, uint8_t value, size_t length) {
+    memory_store_block(m, address, NULL, value, length);
 }
 
 /**
  * Load data into memory
  */
-void memory_load(uint16_t address, uint8_t *data, uint16_t length) {
-    // Check if the data will fit in memory
-    if (address + length > MEMORY_SIZE) {
-        printf("Warning: Data exceeds memory bounds\n");
-        length = MEMORY_SIZE - address;
+void memory_load_r(Machine *m, uint16_t address, uint8_t *data, uint16_t length) {
+    memory_write_block_r(m, address, data, length);
+}
+
+/**
+ * Save RAM and the banking configuration
+ */
+void memory_save_state_r(Machine *m, uint8_t *buffer) {
+    MemoryState *mem = &m->memory;
+    
+    // One copy per run of pages that are next to each other, which is all
+    // of RAM unless some pages are still read from shared pages
+    for (int page = 0; page < 256; ) {
+        int end = page + 1;
+        while (end < 256 && mem->ram_pages[end] == mem->ram_pages[end - 1] + 256) {
+            end++;
+        }
+        memcpy(&buffer[page << 8], mem->ram_pages[page], (size_t)(end - page) << 8);
+        page = end;
     }
+    buffer[MEMORY_SIZE + 0] = (uint8_t)mem->config_index;
+    buffer[MEMORY_SIZE + 1] = 0;
+    buffer[MEMORY_SIZE + 2] = 0;
+    buffer[MEMORY_SIZE + 3] = 0;
+}
+
+/**
+ * Save some pages of RAM and the banking configuration
+ */
+void memory_save_pages_r(Machine *m, uint8_t *buffer, const uint64_t pages[MEMORY_DIRTY_PAGE_WORDS]) {
+    MemoryState *mem = &m->memory;
     
-    // Copy the data into memory
-    memcpy(&memory[address], data, length);
+    for (int word = 0; word < MEMORY_DIRTY_PAGE_WORDS; word++) {
+        uint64_t bits = pages[word];
+        while (bits) {
+            int page = (word << 6) + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            memcpy(&buffer[page << 8], mem->ram_pages[page], 256);
+        }
+    }
+    buffer[MEMORY_SIZE + 0] = (uint8_t)mem->config_index;
 }
 
 /**
- * Load ROM data from a file
+ * Restore some pages of RAM and the banking configuration
  */
-int memory_load_rom(const char *filename, uint8_t *rom_buffer, size_t rom_size) {
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        printf("Error: Could not open ROM file: %s\n", filename);
+void memory_restore_pages_r(Machine *m, const uint8_t *buffer, const uint64_t pages[MEMORY_DIRTY_PAGE_WORDS]) {
+    MemoryState *mem = &m->memory;
+    
+    // Copy only the pages that differ so unrelated cached code survives
+    for (int word = 0; word < MEMORY_DIRTY_PAGE_WORDS; word++) {
+        uint64_t bits = pages[word];
+        while (bits) {
+            int page = (word << 6) + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            uint8_t *own;
+            if (memcmp(mem->ram_pages[page], &buffer[page << 8], 256) != 0 &&
+                (own = memory_own_page(mem, page)) != NULL) {
+                memcpy(own, &buffer[page << 8], 256);
+                memory_mark_dirty(mem, page << 8, 256);
+                if (MEMORY_CODE_PAGE(mem, page)) {
+                    memory_code_changed(m, page);
+                }
+            }
+        }
+    }
+    
+    int index = buffer[MEMORY_SIZE + 0] % MEMORY_CONFIG_COUNT;
+    mem->game_line = (index & PLA_GAME) != 0;
+    mem->exrom_line = (index & PLA_EXROM) != 0;
+    select_memory_config(m, index);
+}
+
+/**
+ * Restore RAM and the banking configuration
+ */
+void memory_restore_state_r(Machine *m, const uint8_t *buffer) {
+    static const uint64_t all_pages[MEMORY_DIRTY_PAGE_WORDS] = { ~0ULL, ~0ULL, ~0ULL, ~0ULL };
+    
+    memory_restore_pages_r(m, buffer, all_pages);
+}
+
+/**
+ * Install the code hook
+ */
+void memory_set_code_hook_r(Machine *m, MemoryCodeHook hook) {
+    m->memory.code_hook = hook;
+}
+
+/**
+ * Watch a page for writes
+ */
+void memory_watch_code_page_r(Machine *m, uint8_t page) {
+    MemoryState *mem = &m->memory;
+    
+    if (!MEMORY_CODE_PAGE(mem, page)) {
+        mem->code_pages[page >> 6] |= 1ULL << (page & 63);
+        update_write_page(mem, page);
+    }
+}
+
+/**
+ * Set the cartridge port lines
+ */
+void memory_set_cartridge_lines_r(Machine *m, int game, int exrom) {
+    MemoryState *mem = &m->memory;
+    
+    mem->game_line = game != 0;
+    mem->exrom_line = exrom != 0;
+    select_memory_config(m, memory_config_index(mem));
+}
+
+/**
+ * Copy a dirty set's page bitmap
+ */
+void memory_get_dirty_pages_r(Machine *m, MemoryDirtySet set, uint64_t bitmap[MEMORY_DIRTY_PAGE_WORDS]) {
+    memcpy(bitmap, m->memory.dirty_pages[set], sizeof(m->memory.dirty_pages[set]));
+}
+
+/**
+ * Copy a dirty set's page bitmap and clear it
+ */
+void memory_take_dirty_pages_r(Machine *m, MemoryDirtySet set, uint64_t bitmap[MEMORY_DIRTY_PAGE_WORDS]) {
+    memory_get_dirty_pages_r(m, set, bitmap);
+    memory_take_dirty_range_r(m, set, 0x00, 0xFF);
+}
+
+/**
+ * Clear a range of pages in a dirty set
+ */
+int memory_take_dirty_range_r(Machine *m, MemoryDirtySet set, uint8_t first_page, uint8_t last_page) {
+    MemoryState *mem = &m->memory;
+    int dirty = 0;
+    
+    for (int page = first_page; page <= last_page; page++) {
+        uint64_t bit = 1ULL << (page & 63);
+        if (mem->dirty_pages[set][page >> 6] & bit) {
+            mem->dirty_pages[set][page >> 6] &= ~bit;
+            // The next write has a bit to set again, so take it off the direct path
+            update_write_page(mem, page);
+            dirty = 1;
+        }
+    }
+    return dirty;
+}
+
+/**
+ * Start or stop recording 64-byte blocks
+ */
+void memory_set_dirty_blocks_r(Machine *m, int enabled) {
+    MemoryState *mem = &m->memory;
+    
+    if (enabled) {
+        // Nothing was recorded while disabled, so everything may have changed
+        memset(mem->dirty_blocks, 0xFF, sizeof(mem->dirty_blocks));
+    }
+    mem->dirty_blocks_enabled = enabled != 0;
+    for (int page = 0; page < 256; page++) {
+        update_write_page(mem, page);
+    }
+}
+
+/**
+ * Copy a dirty set's block bitmap and clear it
+ */
+void memory_take_dirty_blocks_r(Machine *m, MemoryDirtySet set, uint64_t bitmap[MEMORY_DIRTY_BLOCK_WORDS]) {
+    memcpy(bitmap, m->memory.dirty_blocks[set], sizeof(m->memory.dirty_blocks[set]));
+    memset(m->memory.dirty_blocks[set], 0, sizeof(m->memory.dirty_blocks[set]));
+}
+
+/**
+ * Scheduler event: refresh the header of exported RAM
+ */
+static void memory_export_event(Machine *m, int arg, uint64_t cycle) {
+    (void)arg;
+    if (!m->memory.export_header) {
+        return;  // Scheduled by a snapshot restore after RAM was unexported
+    }
+    memory_export_update(m);
+    sched_schedule(m, m->memory.export_event, cycle + MEMORY_EXPORT_INTERVAL);
+}
+
+/**
+ * Run on another copy of RAM
+ * Shared pages are copied in too, so the new copy holds all of RAM (they
+ * stay shared with forks until written). The page tables hold pointers
+ * into RAM, so they are rebuilt.
+ */
+static void memory_move_ram(MemoryState *mem, uint8_t *ram) {
+    for (int page = 0; page < 256; page++) {
+        memcpy(&ram[page << 8], mem->ram_pages[page], 256);
+        mem->ram_pages[page] = &ram[page << 8];
+    }
+    mem->ram = ram;
+    build_memory_configs(mem);
+}
+
+/**
+ * Export RAM through a shared mapping
+ */
+int memory_export_r(Machine *m, const char *name) {
+    MemoryState *mem = &m->memory;
+    size_t size = MEMORY_EXPORT_RAM_OFFSET + MEMORY_SIZE;
+    int shm = name[0] == '/';
+    
+    if (strlen(name) >= sizeof(mem->export_name)) {
+        printf("Error: Export name too long: %s\n", name);
+        return 0;
+    }
+    
+    // End any earlier export first (it may use the same name)
+    memory_unexport_r(m);
+    
+    int fd = shm ? shm_open(name, O_RDWR | O_CREAT, 0644) : open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        printf("Error: Could not create %s\n", name);
+        return 0;
+    }
+    if (ftruncate(fd, size) != 0) {
+        printf("Error: Could not size %s\n", name);
+        close(fd);
         return 0;
     }
+    uint8_t *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        printf("Error: Could not map %s\n", name);
+        return 0;
+    }
+    
+    MemoryExportHeader *header = (MemoryExportHeader *)mapping;
+    memset(header, 0, MEMORY_EXPORT_RAM_OFFSET);
+    header->magic = MEMORY_EXPORT_MAGIC;
+    header->version = MEMORY_EXPORT_VERSION;
+    header->ram_offset = MEMORY_EXPORT_RAM_OFFSET;
+    header->ram_size = MEMORY_SIZE;
+    
+    memory_move_ram(mem, mapping + MEMORY_EXPORT_RAM_OFFSET);
+    mem->export_header = header;
+    strcpy(mem->export_name, name);
+    memory_export_update(m);
+    
+    mem->export_event = sched_register(m, "RAM export", memory_export_event, 0);
+    sched_schedule(m, mem->export_event, m->cycles + MEMORY_EXPORT_INTERVAL);
+    return 1;
+}
+
+/**
+ * Stop exporting RAM
+ */
+void memory_unexport_r(Machine *m) {
+    MemoryState *mem = &m->memory;
+    
+    if (!mem->export_header) {
+        return;
+    }
+    if (!memory_storage(mem)) {
+        return;  // Stays exported
+    }
+    sched_cancel(m, mem->export_event);
+    memory_move_ram(mem, mem->ram_storage);
+    munmap(mem->export_header, MEMORY_EXPORT_RAM_OFFSET + MEMORY_SIZE);
+    mem->export_header = NULL;
+    if (mem->export_name[0] == '/') {
+        shm_unlink(mem->export_name);
+    }
+    mem->export_name[0] = '\0';
+}
+
+/**
+ * Fork the RAM of another machine
+ */
+int memory_fork_r(Machine *m, Machine *parent) {
+    MemoryState *mem = &m->memory;
+    MemoryState *from = &parent->memory;
     
-    size_t bytes_read = fread(rom_buffer, 1, rom_size, file);
-    fclose(file);  // Fixed missing parenthesis
+    // Give every page of the parent a shared copy; pages it hasn't written
+    // since it was last forked still have theirs
+    for (int page = 0; page < 256; page++) {
+        if (!from->shared_pages[page]) {
+            MemoryPage *copy = malloc(sizeof(MemoryPage));
+            if (!copy) {
+                printf("Error: Could not allocate shared RAM pages\n");
+                return 0;
+            }
+            copy->refs = 1;
+            memcpy(copy->data, from->ram_pages[page], 256);
+            from->shared_pages[page] = copy;
+            update_write_page(from, page);
+        }
+    }
     
-    if (bytes_read != rom_size) {
-        printf("Warning: ROM file size mismatch (%zu bytes read, expected %zu)\n", 
-               bytes_read, rom_size);
+    // Read every page from the parent's copy. Nothing is left in the
+    // machine's own RAM, so it is freed and allocated again when the
+    // first page is copied in
+    memory_unexport_r(m);
+    free(mem->ram_storage);
+    mem->ram_storage = NULL;
+    mem->ram = NULL;
+    memory_drop_shared(mem);
+    for (int page = 0; page < 256; page++) {
+        mem->shared_pages[page] = memory_page_ref(from->shared_pages[page]);
+        mem->ram_pages[page] = mem->shared_pages[page]->data;
     }
     
-    // Update memory maps after loading ROM
-    update_memory_maps();
+    mem->basic_rom = from->basic_rom;
+    mem->kernal_rom = from->kernal_rom;
+    mem->char_rom = from->char_rom;
+    mem->game_line = from->game_line;
+    mem->exrom_line = from->exrom_line;
+    
+    // All of RAM has changed since any dirty set was last taken
+    memset(mem->dirty_pages, 0xFF, sizeof(mem->dirty_pages));
+    memset(mem->dirty_blocks, 0xFF, sizeof(mem->dirty_blocks));
+    
+    build_memory_configs(mem);
+    mem->config_index = from->config_index;
+    mem->config = memory_config(mem, mem->config_index);
+    memory_code_changed(m, -1);
+    return 1;
+}
+
+/**
+ * Drop the machine's references to shared pages and free its RAM
+ */
+void memory_release_r(Machine *m) {
+    MemoryState *mem = &m->memory;
+    
+    memory_drop_shared(mem);
+    free(mem->ram_storage);
+    mem->ram_storage = NULL;
+    mem->ram = NULL;
+}
+
+/**
+ * Load ROM data from a file
+ */
+int memory_load_rom_r(Machine *m, const char *filename, const uint8_t **rom, size_t rom_size) {
+    const uint8_t *image = rom_cache_load(filename, rom_size);
+    if (!image) {
+        printf("Error: Could not open ROM file: %s\n", filename);
+        return 0;
+    }
+    
+    // Point the page tables at the new image; code decoded from the old
+    // one is stale
+    *rom = image;
+    build_memory_configs(&m->memory);
+    memory_code_changed(m, -1);
     
     return 1;
 }
@@ -199,40 +1086,350 @@ int memory_load_rom(const char *filename, uint8_t *rom_buffer, size_t rom_size)
 /**
  * Load BASIC ROM from a file
  */
-int memory_load_basic_rom(const char *filename) {
-    return memory_load_rom(filename, basic_rom, sizeof(basic_rom));
+int memory_load_basic_rom_r(Machine *m, const char *filename) {
+    return memory_load_rom_r(m, filename, &m->memory.basic_rom, MEMORY_BASIC_ROM_SIZE);
 }
 
 /**
  * Load KERNAL ROM from a file
  */
-int memory_load_kernal_rom(const char *filename) {
-    return memory_load_rom(filename, kernal_rom, sizeof(kernal_rom));
+int memory_load_kernal_rom_r(Machine *m, const char *filename) {
+    return memory_load_rom_r(m, filename, &m->memory.kernal_rom, MEMORY_KERNAL_ROM_SIZE);
 }
 
 /**
  * Load Character ROM from a file
  */
-int memory_load_char_rom(const char *filename) {
-    return memory_load_rom(filename, char_rom, sizeof(char_rom));
+int memory_load_char_rom_r(Machine *m, const char *filename) {
+    return memory_load_rom_r(m, filename, &m->memory.char_rom, MEMORY_CHAR_ROM_SIZE);
 }
 
 /**
- * Dump memory contents for debugging
+ * Share the ROM images of another machine
  */
-void memory_dump(uint16_t start_address, uint16_t length) {
-    uint16_t end_address = start_address + length - 1;
-    if (end_address >= MEMORY_SIZE) {
-        end_address = MEMORY_SIZE - 1;
+void memory_copy_roms_r(Machine *m, const Machine *from) {
+    memory_set_roms_r(m, from->memory.basic_rom, from->memory.kernal_rom, from->memory.char_rom);
+}
+
+/**
+ * Use the given ROM images
+ */
+void memory_set_roms_r(Machine *m, const uint8_t *basic_rom, const uint8_t *kernal_rom, const uint8_t *char_rom) {
+    MemoryState *mem = &m->memory;
+    
+    if (mem->basic_rom == basic_rom && mem->kernal_rom == kernal_rom && mem->char_rom == char_rom) {
+        return;
+    }
+    mem->basic_rom = basic_rom;
+    mem->kernal_rom = kernal_rom;
+    mem->char_rom = char_rom;
+    build_memory_configs(mem);
+    memory_code_changed(m, -1);
+}
+
+/**
+ * Format one dump row: "\n$XXXX: " and "XX " per byte
+ */
+static size_t memory_format_row(char *out, uint16_t address, const uint8_t *row, size_t length) {
+    static const char hex[] = "0123456789ABCDEF";
+    char *p = out;
+    
+    *p++ = '\n';
+    *p++ = '$';
+    *p++ = hex[address >> 12];
+    *p++ = hex[(address >> 8) & 0xF];
+    *p++ = hex[(address >> 4) & 0xF];
+    *p++ = hex[address & 0xF];
+    *p++ = ':';
+    *p++ = ' ';
+    for (size_t i = 0; i < length; i++) {
+        *p++ = hex[row[i] >> 4];
+        *p++ = hex[row[i] & 0xF];
+        *p++ = ' ';
+    }
+    return p - out;
+}
+
+/**
+ * Write a hex dump of memory to a stream
+ */
+void memory_hex_dump_r(Machine *m, FILE *out, uint16_t start_address, size_t length) {
+    uint8_t block[4096];
+    char text[sizeof(block) / 16 * 56 + 1];  // 56 characters per full row
+    
+    if (start_address + length > MEMORY_SIZE) {
+        length = MEMORY_SIZE - start_address;
+    }
+    
+    // Read a block at a time, as the CPU sees it (ROM contents, I/O registers)
+    for (size_t offset = 0; offset < length; offset += sizeof(block)) {
+        size_t block_length = length - offset < sizeof(block) ? length - offset : sizeof(block);
+        size_t used = 0;
+        
+        memory_read_block_r(m, start_address + offset, block, block_length);
+        for (size_t row = 0; row < block_length; row += 16) {
+            size_t row_length = block_length - row < 16 ? block_length - row : 16;
+            used += memory_format_row(text + used, start_address + offset + row, block + row, row_length);
+        }
+        fwrite(text, 1, used, out);
+    }
+    fputc('\n', out);
+}
+
+/**
+ * Dump memory contents
+ */
+void memory_dump_r(Machine *m, uint16_t start_address, size_t length) {
+    if (start_address + length > MEMORY_SIZE) {
+        length = MEMORY_SIZE - start_address;
     }
+    uint16_t end_address = start_address + length - 1;
     
     printf("Memory dump from $%04X to $%04X:\n", start_address, end_address);
+    memory_hex_dump_r(m, stdout, start_address, length);
+}
+
+/**
+ * Save a block of memory to a binary file
+ */
+int memory_save_file_r(Machine *m, const char *filename, uint16_t start_address, size_t length) {
+    uint8_t buffer[MEMORY_SIZE];
+    
+    length = memory_clip_block(start_address, length);
+    memory_read_block_r(m, start_address, buffer, length);
+    
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Error: Could not create file %s\n", filename);
+        return 0;
+    }
+    ssize_t written = write(fd, buffer, length);
+    if (close(fd) != 0 || written != (ssize_t)length) {
+        printf("Error: Could not write all data to file %s\n", filename);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Load a binary file into memory
+ */
+long memory_load_file_r(Machine *m, const char *filename, uint16_t address) {
+    uint8_t buffer[MEMORY_SIZE];
+    struct stat st;
     
-    for (uint16_t addr = start_address; addr <= end_address; addr++) {
-        if ((addr - start_address) % 16 == 0) {
-            printf("\n$%04X: ", addr);
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Could not open file %s\n", filename);
+        return -1;
+    }
+    if (fstat(fd, &st) != 0) {
+        printf("Error: Could not read file %s\n", filename);
+        close(fd);
+        return -1;
+    }
+    
+    // Only read what fits up to $FFFF
+    size_t length = MEMORY_SIZE - address;
+    if ((size_t)st.st_size > length) {
+        printf("Warning: Data exceeds memory bounds\n");
+    } else {
+        length = st.st_size;
+    }
+    ssize_t got = pread(fd, buffer, length, 0);
+    close(fd);
+    if (got != (ssize_t)length) {
+        printf("Error: Could not read all data from file %s\n", filename);
+        return -1;
+    }
+    
+    memory_write_block_r(m, address, buffer, length);
+    return (long)length;
+}
+
+/**
+ * Load a PRG file into memory
+ */
+int memory_load_prg_r(Machine *m, const char *filename, int address, MemoryPrgInfo *info) {
+    uint8_t header[2];
+    struct stat st;
+    
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Could not open file %s\n", filename);
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < 2 || pread(fd, header, 2, 0) != 2) {
+        printf("Error: %s is not a PRG file\n", filename);
+        close(fd);
+        return 0;
+    }
+    if (address < 0) {
+        address = header[0] | (header[1] << 8);
+    }
+    if ((uint64_t)st.st_size - 2 > (uint64_t)(MEMORY_SIZE - address)) {
+        printf("Error: %s does not fit in memory at $%04X\n", filename, address);
+        close(fd);
+        return 0;
+    }
+    size_t length = st.st_size - 2;
+    
+    // Read each page straight into the RAM it is stored to; only I/O,
+    // dropped writes and the processor port go through a bounce buffer
+    uint16_t next = address;
+    off_t offset = 2;
+    size_t left = length;
+    while (left > 0) {
+        uint8_t bounce[256];
+        size_t span = memory_page_span(next, left);
+        uint8_t *target = next > 0x0001 ? memory_block_target(m, next, span) : NULL;
+        
+        if (pread(fd, target ? target : bounce, span, offset) != (ssize_t)span) {
+            printf("Error: Could not read all data from file %s\n", filename);
+            close(fd);
+            return 0;
+        }
+        if (!target) {
+            memory_store_block(m, next, bounce, 0, span);
         }
-        printf("%02X ", memory_read(addr));  // Use memory_read to show ROM contents
+        next += span;
+        offset += span;
+        left -= span;
     }
-    printf("\n");
-}
\ No newline at end of file
+    close(fd);
+    
+    if (info) {
+        info->start = address;
+        info->end = (uint16_t)(address + length);
+        info->length = length;
+    }
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Single-machine API                                                 */
+/* ------------------------------------------------------------------ */
+
+void memory_init() {
+    memory_init_r(machine_default());
+}
+
+uint8_t memory_read(uint16_t address) {
+    return memory_read_r(machine_default(), address);
+}
+
+void memory_write(uint16_t address, uint8_t value) {
+    memory_write_r(machine_default(), address, value);
+}
+
+int memory_is_io(uint16_t address) {
+    return memory_is_io_r(machine_default(), address);
+}
+
+void memory_load(uint16_t address, uint8_t *data, uint16_t length) {
+    memory_load_r(machine_default(), address, data, length);
+}
+
+void memory_read_block(uint16_t address, uint8_t *buffer, size_t length) {
+    memory_read_block_r(machine_default(), address, buffer, length);
+}
+
+void memory_write_block(uint16_t address, const uint8_t *data, size_t length) {
+    memory_write_block_r(machine_default(), address, data, length);
+}
+
+void memory_fill(uint16_t address, uint8_t value, size_t length) {
+    memory_fill_r(machine_default(), address, value, length);
+}
+
+void memory_set_code_hook(MemoryCodeHook hook) {
+    memory_set_code_hook_r(machine_default(), hook);
+}
+
+void memory_watch_code_page(uint8_t page) {
+    memory_watch_code_page_r(machine_default(), page);
+}
+
+void memory_set_cartridge_lines(int game, int exrom) {
+    memory_set_cartridge_lines_r(machine_default(), game, exrom);
+}
+
+void memory_get_dirty_pages(MemoryDirtySet set, uint64_t bitmap[MEMORY_DIRTY_PAGE_WORDS]) {
+    memory_get_dirty_pages_r(machine_default(), set, bitmap);
+}
+
+void memory_take_dirty_pages(MemoryDirtySet set, uint64_t bitmap[MEMORY_DIRTY_PAGE_WORDS]) {
+    memory_take_dirty_pages_r(machine_default(), set, bitmap);
+}
+
+int memory_take_dirty_range(MemoryDirtySet set, uint8_t first_page, uint8_t last_page) {
+    return memory_take_dirty_range_r(machine_default(), set, first_page, last_page);
+}
+
+void memory_set_dirty_blocks(int enabled) {
+    memory_set_dirty_blocks_r(machine_default(), enabled);
+}
+
+void memory_take_dirty_blocks(MemoryDirtySet set, uint64_t bitmap[MEMORY_DIRTY_BLOCK_WORDS]) {
+    memory_take_dirty_blocks_r(machine_default(), set, bitmap);
+}
+
+int memory_export(const char *name) {
+    return memory_export_r(machine_default(), name);
+}
+
+void memory_unexport() {
+    memory_unexport_r(machine_default());
+}
+
+void memory_save_state(uint8_t *buffer) {
+    memory_save_state_r(machine_default(), buffer);
+}
+
+void memory_restore_state(const uint8_t *buffer) {
+    memory_restore_state_r(machine_default(), buffer);
+}
+
+void memory_save_pages(uint8_t *buffer, const uint64_t pages[MEMORY_DIRTY_PAGE_WORDS]) {
+    memory_save_pages_r(machine_default(), buffer, pages);
+}
+
+void memory_restore_pages(const uint8_t *buffer, const uint64_t pages[MEMORY_DIRTY_PAGE_WORDS]) {
+    memory_restore_pages_r(machine_default(), buffer, pages);
+}
+
+void memory_dump(uint16_t start_address, size_t length) {
+    memory_dump_r(machine_default(), start_address, length);
+}
+
+void memory_hex_dump(FILE *out, uint16_t start_address, size_t length) {
+    memory_hex_dump_r(machine_default(), out, start_address, length);
+}
+
+int memory_save_file(const char *filename, uint16_t start_address, size_t length) {
+    return memory_save_file_r(machine_default(), filename, start_address, length);
+}
+
+long memory_load_file(const char *filename, uint16_t address) {
+    return memory_load_file_r(machine_default(), filename, address);
+}
+
+int memory_load_prg(const char *filename, int address, MemoryPrgInfo *info) {
+    return memory_load_prg_r(machine_default(), filename, address, info);
+}
+
+int memory_load_rom(const char *filename, const uint8_t **rom, size_t rom_size) {
+    return memory_load_rom_r(machine_default(), filename, rom, rom_size);
+}
+
+int memory_load_basic_rom(const char *filename) {
+    return memory_load_basic_rom_r(machine_default(), filename);
+}
+
+int memory_load_kernal_rom(const char *filename) {
+    return memory_load_kernal_rom_r(machine_default(), filename);
+}
+
+int memory_load_char_rom(const char *filename) {
+    return memory_load_char_rom_r(machine_default(), filename);
+}
@@ -29,6 +29,7 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -38,60 +39,506 @@
  */
 #define MEMORY_SIZE 65536
 
+// ROM image sizes
+#define MEMORY_BASIC_ROM_SIZE  8192
+#define MEMORY_KERNAL_ROM_SIZE 8192
+#define MEMORY_CHAR_ROM_SIZE   4096
+
+// Emulator instance (see src/machine/machine.h)
+typedef struct Machine Machine;
+
+/**
+ * Code hook
+ * Called with a page number when a watched page is written, or with -1
+ * when the banking configuration or a ROM changes and any page may now
+ * read differently. The watch on the page is cleared before the call.
+ */
+typedef void (*MemoryCodeHook)(Machine *m, int page);
+
+/**
+ * What a write to a page does in a banking configuration
+ */
+typedef enum {
+    MEMORY_WRITE_RAM,             // Store to RAM (also under BASIC, KERNAL and character ROM)
+    MEMORY_WRITE_IGNORE,          // Nothing to store to (Ultimax mode); the write is dropped
+    MEMORY_WRITE_IO,              // I/O chip registers at $D000-$DFFF
+    MEMORY_WRITE_PORT             // Zero page, holding the processor port at $0001
+} MemoryWriteKind;
+
+/**
+ * Number of PLA banking configurations
+ * One for each combination of the processor port bits LORAM, HIRAM and
+ * CHAREN and the cartridge port lines GAME and EXROM.
+ */
+#define MEMORY_CONFIG_COUNT 32
+
+/**
+ * Number of distinct page table layouts among them
+ * Several configurations map the same thing to every page (all RAM, or
+ * any Ultimax one), so a machine builds one set of page tables for each
+ * layout and the configurations share them (see memory.c).
+ */
+#define MEMORY_CONFIG_TABLES 14
+
+/**
+ * Dirty page sets
+ * Each consumer of the dirty bitmaps has its own set, so taking (reading
+ * and clearing) one doesn't hide writes from the others.
+ */
+typedef enum {
+    MEMORY_DIRTY_SCREEN,          // Screen redraws (io_update())
+    MEMORY_DIRTY_SNAPSHOT,        // Incremental snapshots
+    MEMORY_DIRTY_REWIND,          // Rewind deltas (see rewind.h)
+    MEMORY_DIRTY_USER,            // Free for tools and benchmarks
+    MEMORY_DIRTY_SETS
+} MemoryDirtySet;
+
+#define MEMORY_DIRTY_BLOCK_SIZE 64                                  // Bytes per fine-grained block
+#define MEMORY_DIRTY_PAGE_WORDS 4                                   // uint64_t words in a page bitmap
+#define MEMORY_DIRTY_BLOCK_WORDS (MEMORY_SIZE / MEMORY_DIRTY_BLOCK_SIZE / 64)  // ... in a block bitmap
+
+/**
+ * Page tables of one banking configuration
+ * A page that is plain RAM with no decoded code on it and already dirty
+ * in every dirty set has a direct pointer in write_map; every other page
+ * is NULL there and goes through the handler in write_kind. write_kind
+ * is the same for every machine and shared by all of them.
+ */
+typedef struct {
+    const uint8_t *read_map[256]; // Where each page reads from (NULL: I/O device)
+    uint8_t *write_map[256];
+    const uint8_t *write_kind;    // MemoryWriteKind of each page
+} MemoryConfig;
+
+/**
+ * Header of an exported RAM mapping (see memory_export())
+ * The mapping is this header, padded to MEMORY_EXPORT_RAM_OFFSET, then
+ * the 64K of RAM. RAM is live: it is the memory the CPU uses. The fields
+ * after sequence are updated at every bank switch and every
+ * MEMORY_EXPORT_INTERVAL cycles; sequence is odd while they change, so a
+ * reader copies them and retries if sequence was odd or has moved on.
+ */
+#define MEMORY_EXPORT_MAGIC      0x52343643  // "C64R"
+#define MEMORY_EXPORT_VERSION    1
+#define MEMORY_EXPORT_RAM_OFFSET 4096
+#define MEMORY_EXPORT_INTERVAL   10000       // Cycles between header updates
+
+typedef struct {
+    uint32_t magic;               // MEMORY_EXPORT_MAGIC
+    uint32_t version;             // MEMORY_EXPORT_VERSION
+    uint32_t ram_offset;          // Offset of RAM from the start of the mapping
+    uint32_t ram_size;            // MEMORY_SIZE
+    uint32_t sequence;            // Odd while the fields below are being written
+    uint8_t config;               // Banking configuration: LORAM | HIRAM << 1 | CHAREN << 2 | GAME << 3 | EXROM << 4
+    uint8_t port;                 // Processor port ($0001)
+    uint8_t reserved[2];
+    uint64_t cycles;              // CPU cycle count
+} MemoryExportHeader;
+
+/**
+ * A read-only copy of one page of RAM
+ * Shared by a machine and the machines forked from it (see
+ * memory_fork()), and freed with its last reference. Nothing writes to
+ * it while it is shared.
+ */
+typedef struct MemoryPage {
+    uint32_t refs;
+    uint8_t data[256];
+} MemoryPage;
+
+/**
+ * Memory of one machine: RAM, ROM images and the banking configuration
+ * The ROM images are read-only and shared by every machine using the
+ * same ROMs (see src/memory/rom_cache.h).
+ */
+typedef struct {
+    uint8_t *ram;                 // RAM in use: ram_storage, or an exported mapping
+    uint8_t *ram_storage;         // Own RAM, allocated when the first page is copied in
+    
+    // Where each page of RAM is read from: its place in ram, or a shared
+    // page until the first write copies it into ram
+    uint8_t *ram_pages[256];
+    // Shared copy of each page's contents, handed to forks; dropped on the
+    // first write to the page, so pages with one are written out of line
+    MemoryPage *shared_pages[256];
+    
+    const uint8_t *basic_rom;     // 8K BASIC ROM
+    const uint8_t *kernal_rom;    // 8K KERNAL ROM
+    const uint8_t *char_rom;      // 4K Character ROM
+    uint8_t open_bus[256];        // Read by unmapped pages and empty cartridge ROM
+    
+    // Cartridge port lines (1 = high, no cartridge)
+    uint8_t game_line;
+    uint8_t exrom_line;
+    
+    // Page tables of every banking configuration, built by memory_init();
+    // configurations with the same layout share one, and a bank switch
+    // only changes config
+    MemoryConfig config_tables[MEMORY_CONFIG_TABLES];
+    const MemoryConfig *config;
+    int config_index;             // Banking configuration config is for
+    
+    // Pages holding decoded instructions (one bit per page); writing to
+    // one notifies the code hook
+    uint64_t code_pages[4];
+    MemoryCodeHook code_hook;
+    
+    // RAM written since each set was last taken: one bit per page, and one
+    // per 64-byte block while dirty_blocks_enabled is set
+    uint64_t dirty_pages[MEMORY_DIRTY_SETS][MEMORY_DIRTY_PAGE_WORDS];
+    uint64_t dirty_blocks[MEMORY_DIRTY_SETS][MEMORY_DIRTY_BLOCK_WORDS];
+    int dirty_blocks_enabled;
+    
+    // Zero page writes other than $0000/$0001 may store to RAM directly
+    int zero_page_direct;
+    
+    // RAM export (NULL header when RAM isn't exported)
+    MemoryExportHeader *export_header;
+    char export_name[256];        // Shared memory object or file
+    int export_event;             // Scheduler event updating the header
+} MemoryState;
+
+// Nonzero if a page holds decoded instructions
+#define MEMORY_CODE_PAGE(mem, page) (((mem)->code_pages[(page) >> 6] >> ((page) & 63)) & 1)
+
+// The byte of RAM at an address, wherever its page is (for reading)
+#define MEMORY_RAM(mem, address) ((mem)->ram_pages[(address) >> 8][(address) & 0xFF])
+
 /**
  * Initialize the memory system
  * Sets up RAM, ROM regions, and initial memory configuration
  */
-void memory_init();
+void memory_init_r(Machine *m);
 
 /**
  * Read a byte from memory
  * Takes into account the current memory banking configuration
+ * I/O addresses are read from their device through io_read()
  * 
  * @param address 16-bit memory address to read from
  * @return The byte value at the specified address
  */
-uint8_t memory_read(uint16_t address);
+uint8_t memory_read_r(Machine *m, uint16_t address);
 
 /**
  * Write a byte to memory
  * Takes into account the current memory banking configuration
- * Writing to ROM areas is ignored when those ROMs are enabled
+ * Writing to a ROM area stores to the RAM underneath, as on the real PLA;
+ * I/O addresses are written to their device through io_write()
  * 
  * @param address 16-bit memory address to write to
  * @param value The byte value to write
  */
-void memory_write(uint16_t address, uint8_t value);
+void memory_write_r(Machine *m, uint16_t address, uint8_t value);
+
+/**
+ * Check whether an address reaches an I/O device
+ * True for $D000-$DFFF when the banking configuration shows I/O there.
+ * Reads from such an address can change without any CPU write.
+ * 
+ * @param address 16-bit memory address
+ * @return 1 for an I/O address, 0 otherwise
+ */
+int memory_is_io_r(Machine *m, uint16_t address);
+
+/**
+ * Read a block of memory
+ * Returns what reading each byte with memory_read() would: pages mapped
+ * to RAM or ROM are copied with memcpy, I/O pages are read register by
+ * register. A block running past $FFFF is cut off there.
+ * 
+ * @param address 16-bit starting address
+ * @param buffer Buffer of at least length bytes
+ * @param length Number of bytes to read
+ */
+void memory_read_block_r(Machine *m, uint16_t address, uint8_t *buffer, size_t length);
+
+/**
+ * Write a block of memory
+ * Does what writing each byte with memory_write() would: RAM pages
+ * (including RAM under ROM) are copied with memcpy, I/O pages are written
+ * register by register, and a write to the processor port changes the
+ * banking for the rest of the block. Pages holding decoded code are
+ * reported to the code hook. A block running past $FFFF is cut off there.
+ * 
+ * @param address 16-bit starting address
+ * @param data Pointer to the source data
+ * @param length Number of bytes to write
+ */
+void memory_write_block_r(Machine *m, uint16_t address, const uint8_t *data, size_t length);
+
+/**
+ * Fill a block of memory with one value
+ * Same as memory_write_block() with every byte equal to value.
+ * 
+ * @param address 16-bit starting address
+ * @param value The byte value to write
+ * @param length Number of bytes to write
+ */
+void memory_fill_r(Machine *m, uint16_t address, uint8_t value, size_t length);
 
 /**
  * Load data into memory
- * Copies a block of data into memory starting at the specified address
+ * Copies a block of data into memory starting at the specified address,
+ * as memory_write_block() does
  * 
  * @param address 16-bit starting address for the data
  * @param data Pointer to the source data
  * @param length Number of bytes to copy
  */
-void memory_load(uint16_t address, uint8_t *data, uint16_t length);
+void memory_load_r(Machine *m, uint16_t address, uint8_t *data, uint16_t length);
+
+/**
+ * Install the code hook
+ * Used by the CPU to keep its predecoded instructions in step with memory
+ * 
+ * @param hook Function to call, or NULL to remove the hook
+ */
+void memory_set_code_hook_r(Machine *m, MemoryCodeHook hook);
+
+/**
+ * Watch a page for writes
+ * The next write to the page (through memory_write() or a block write)
+ * calls the code hook once; the page has to be watched again afterwards.
+ * 
+ * @param page Page number ($00-$FF)
+ */
+void memory_watch_code_page_r(Machine *m, uint8_t page);
+
+/**
+ * Set the cartridge port lines
+ * GAME and EXROM select the cartridge banking configurations together
+ * with the processor port. Both are high (1) when no cartridge is plugged
+ * in; no cartridge ROM is emulated, so its areas read as open bus.
+ * 
+ * @param game GAME line (0 or 1)
+ * @param exrom EXROM line (0 or 1)
+ */
+void memory_set_cartridge_lines_r(Machine *m, int game, int exrom);
+
+/**
+ * Read a dirty set without clearing it
+ * A page is dirty if RAM in it was written (by the CPU, a block write or
+ * a state restore) since the set was last taken. Every page starts dirty.
+ * 
+ * @param set Dirty set to read
+ * @param bitmap Receives one bit per page (bit n of word n / 64 for page n)
+ */
+void memory_get_dirty_pages_r(Machine *m, MemoryDirtySet set, uint64_t bitmap[MEMORY_DIRTY_PAGE_WORDS]);
+
+/**
+ * Read a dirty set and clear it in one step
+ * The next write to each page is recorded again. Writes to a page that
+ * is already dirty cost nothing, so the first write to each page after
+ * this takes the slower path once.
+ * 
+ * @param set Dirty set to take
+ * @param bitmap Receives the pages as memory_get_dirty_pages() does
+ */
+void memory_take_dirty_pages_r(Machine *m, MemoryDirtySet set, uint64_t bitmap[MEMORY_DIRTY_PAGE_WORDS]);
+
+/**
+ * Take part of a dirty set
+ * Clears the pages from first_page to last_page in the set.
+ * 
+ * @param set Dirty set to take
+ * @param first_page First page of the range
+ * @param last_page Last page of the range
+ * @return 1 if any page in the range was dirty, 0 otherwise
+ */
+int memory_take_dirty_range_r(Machine *m, MemoryDirtySet set, uint8_t first_page, uint8_t last_page);
+
+/**
+ * Record writes per 64-byte block as well as per page
+ * While enabled, every RAM write goes through the out-of-line path, so
+ * CPU stores are slower. Enabling it marks every block dirty.
+ * 
+ * @param enabled 1 to record blocks, 0 to stop
+ */
+void memory_set_dirty_blocks_r(Machine *m, int enabled);
+
+/**
+ * Read the block bitmap of a dirty set and clear it in one step
+ * The page bitmap of the set is not changed.
+ * 
+ * @param set Dirty set to take
+ * @param bitmap Receives one bit per 64-byte block (bit n of word n / 64
+ *               for the block at n * 64)
+ */
+void memory_take_dirty_blocks_r(Machine *m, MemoryDirtySet set, uint64_t bitmap[MEMORY_DIRTY_BLOCK_WORDS]);
+
+/**
+ * Export RAM through a shared mapping
+ * Moves the machine's RAM into a MAP_SHARED mapping with a
+ * MemoryExportHeader in front, so other processes can map the same
+ * object and watch RAM and the banking as the emulator runs, with no
+ * copies. A name starting with '/' is a POSIX shared memory object
+ * (shm_open()); anything else is a file, created if needed. An earlier
+ * export ends first.
+ * 
+ * @param name Shared memory name or file path
+ * @return 1 on success, 0 on failure (RAM is then not exported)
+ */
+int memory_export_r(Machine *m, const char *name);
+
+/**
+ * Stop exporting RAM
+ * Moves RAM back into the machine and unmaps the export. A shared memory
+ * object is unlinked; a file is left with the last contents. RAM stays
+ * exported if the machine's own RAM can't be allocated.
+ */
+void memory_unexport_r(Machine *m);
+
+/**
+ * Fork the RAM of another machine
+ * Gives the machine the parent's RAM, ROM images, cartridge lines and
+ * banking configuration. RAM is not copied: both machines read the same
+ * shared, read-only pages, and each copies a page into its own RAM on
+ * its first write to it (memory_write(), block writes, loads, restores).
+ * The first fork of a parent copies each of its pages once into a
+ * shared page; later forks reuse the pages it hasn't written since, so
+ * forking a parent that is not running costs no copies at all. Decoded
+ * code of the machine is dropped. Parent and fork can then run on
+ * different threads; the parent must not run while it is forked.
+ * 
+ * @param parent Machine to share RAM with
+ * @return 1 on success, 0 if shared pages can't be allocated (the
+ *         machine's memory is unchanged then)
+ */
+int memory_fork_r(Machine *m, Machine *parent);
+
+/**
+ * Drop the machine's references to shared pages and free its RAM
+ * Called by machine_destroy(); the machine must not be used afterwards.
+ */
+void memory_release_r(Machine *m);
+
+/**
+ * Size of a buffer for memory_save_state()
+ * RAM followed by the banking configuration
+ */
+#define MEMORY_STATE_SIZE (MEMORY_SIZE + 4)
+
+/**
+ * Save RAM and the banking configuration
+ * 
+ * @param buffer Buffer of MEMORY_STATE_SIZE bytes
+ */
+void memory_save_state_r(Machine *m, uint8_t *buffer);
+
+/**
+ * Restore RAM and the banking configuration saved by memory_save_state()
+ * Watched pages whose contents change are reported to the code hook.
+ * 
+ * @param buffer Buffer of MEMORY_STATE_SIZE bytes
+ */
+void memory_restore_state_r(Machine *m, const uint8_t *buffer);
+
+/**
+ * Save some pages of RAM and the banking configuration
+ * Brings a memory_save_state() buffer up to date when only the pages in
+ * the bitmap can have changed since, for example the pages of the
+ * MEMORY_DIRTY_SNAPSHOT set.
+ * 
+ * @param buffer Buffer of MEMORY_STATE_SIZE bytes
+ * @param pages Bitmap of the pages to copy (bit n of word n / 64)
+ */
+void memory_save_pages_r(Machine *m, uint8_t *buffer, const uint64_t pages[MEMORY_DIRTY_PAGE_WORDS]);
+
+/**
+ * Restore some pages of RAM and the banking configuration
+ * Like memory_restore_state(), for RAM that only differs from the buffer
+ * in the pages in the bitmap.
+ * 
+ * @param buffer Buffer of MEMORY_STATE_SIZE bytes
+ * @param pages Bitmap of the pages to restore (bit n of word n / 64)
+ */
+void memory_restore_pages_r(Machine *m, const uint8_t *buffer, const uint64_t pages[MEMORY_DIRTY_PAGE_WORDS]);
 
 /**
  * Dump memory contents
  * Displays a formatted hex dump of memory for debugging
  * 
  * @param start_address 16-bit starting address for the dump
- * @param length Number of bytes to dump
+ * @param length Number of bytes to dump (clipped at $FFFF)
  */
-void memory_dump(uint16_t start_address, uint16_t length);
+void memory_dump_r(Machine *m, uint16_t start_address, size_t length);
+
+/**
+ * Write a hex dump of memory to a stream
+ * Memory is read as the CPU sees it, a block at a time, and whole rows
+ * are formatted into a buffer that is written in large chunks, so
+ * dumping all 64K takes a few writes instead of one printf per byte.
+ * The output is the same as memory_dump() without its title line.
+ * 
+ * @param out Stream to write to
+ * @param start_address 16-bit starting address for the dump
+ * @param length Number of bytes to dump (clipped at $FFFF)
+ */
+void memory_hex_dump_r(Machine *m, FILE *out, uint16_t start_address, size_t length);
+
+/**
+ * Save a block of memory to a binary file
+ * The block is read as the CPU sees it (memory_read_block()) and written
+ * with a single write; the file holds just the bytes, with no header.
+ * 
+ * @param filename File to create or replace
+ * @param start_address 16-bit starting address of the block
+ * @param length Number of bytes to save (clipped at $FFFF)
+ * @return 1 on success, 0 on failure
+ */
+int memory_save_file_r(Machine *m, const char *filename, uint16_t start_address, size_t length);
+
+/**
+ * Load a binary file into memory
+ * The whole file is read with one read and stored with
+ * memory_write_block(). Bytes past $FFFF are dropped with a warning.
+ * 
+ * @param filename File to load
+ * @param address 16-bit address of the first byte
+ * @return Number of bytes stored, or -1 on failure
+ */
+long memory_load_file_r(Machine *m, const char *filename, uint16_t address);
+
+/**
+ * Where a PRG file was loaded (see memory_load_prg())
+ */
+typedef struct {
+    uint16_t start;               // Address of the first byte
+    uint16_t end;                 // One past the last byte ($0000 if it ends at $FFFF)
+    size_t length;                // Bytes loaded: the file less its 2-byte header
+} MemoryPrgInfo;
+
+/**
+ * Load a PRG file into memory
+ * A PRG file starts with its little-endian load address. The rest is read
+ * with pread() straight into the RAM pages it is stored to, with no
+ * buffer in between (I/O pages and the processor port get what
+ * memory_write_block() would give them). The ROMs are not touched, so a
+ * batch of programs can be loaded into a machine one after another.
+ * end is what the KERNAL LOAD routine leaves in $AE/$AF and BASIC's LOAD
+ * copies to $2D/$2E (start of variables).
+ * 
+ * @param filename PRG file to load
+ * @param address Load address, or -1 for the address in the file
+ * @param info Set to where the program was loaded (may be NULL)
+ * @return 1 on success, 0 if the file can't be read or doesn't fit below
+ *         $10000 (nothing is loaded then, unless a read fails midway)
+ */
+int memory_load_prg_r(Machine *m, const char *filename, int address, MemoryPrgInfo *info);
 
 /**
  * Load ROM data from a file
- * General function for loading any ROM file into a buffer
+ * General function for loading any ROM file; the image comes from the
+ * ROM cache, so a file already loaded by any machine in the process is
+ * not read again, and the page tables point straight into it.
  * 
  * @param filename Path to the ROM file
- * @param rom_buffer Buffer to store the ROM data
- * @param rom_size Size of the buffer/expected ROM size
+ * @param rom One of the machine's ROM pointers, set to the image
+ * @param rom_size Expected ROM size
  * @return 1 on success, 0 on failure
  */
-int memory_load_rom(const char *filename, uint8_t *rom_buffer, size_t rom_size);
+int memory_load_rom_r(Machine *m, const char *filename, const uint8_t **rom, size_t rom_size);
 
 /**
  * Load BASIC ROM from a file
@@ -100,7 +547,7 @@ int memory_load_rom(const char *filename, uint8_t *rom_buffer, size_t rom_size);
  * @param filename Path to the BASIC ROM file
  * @return 1 on success, 0 on failure
  */
-int memory_load_basic_rom(const char *filename);
+int memory_load_basic_rom_r(Machine *m, const char *filename);
 
 /**
  * Load KERNAL ROM from a file
@@ -109,7 +556,7 @@ int memory_load_basic_rom(const char *filename);
  * @param filename Path to the KERNAL ROM file
  * @return 1 on success, 0 on failure
  */
-int memory_load_kernal_rom(const char *filename);
+int memory_load_kernal_rom_r(Machine *m, const char *filename);
 
 /**
  * Load Character ROM from a file
@@ -118,6 +565,63 @@ int memory_load_kernal_rom(const char *filename);
  * @param filename Path to the Character ROM file
  * @return 1 on success, 0 on failure
  */
+int memory_load_char_rom_r(Machine *m, const char *filename);
+
+/**
+ * Use the BASIC, KERNAL and Character ROMs of another machine
+ * Lets worker machines run with the ROMs loaded into the default machine.
+ * The images are shared, not copied.
+ * 
+ * @param from Machine to take the ROM images from
+ */
+void memory_copy_roms_r(Machine *m, const Machine *from);
+
+/**
+ * Use the given ROM images
+ * The images must stay valid and unchanged while the machine uses them
+ * (ROM cache images, or a mapping that is never unmapped). Nothing is
+ * rebuilt if they are already in use.
+ * 
+ * @param basic_rom MEMORY_BASIC_ROM_SIZE bytes
+ * @param kernal_rom MEMORY_KERNAL_ROM_SIZE bytes
+ * @param char_rom MEMORY_CHAR_ROM_SIZE bytes
+ */
+void memory_set_roms_r(Machine *m, const uint8_t *basic_rom, const uint8_t *kernal_rom, const uint8_t *char_rom);
+
+/*
+ * Single-machine API
+ * Each function below calls its _r variant with machine_default().
+ */
+void memory_init();
+uint8_t memory_read(uint16_t address);
+void memory_write(uint16_t address, uint8_t value);
+int memory_is_io(uint16_t address);
+void memory_load(uint16_t address, uint8_t *data, uint16_t length);
+void memory_read_block(uint16_t address, uint8_t *buffer, size_t length);
+void memory_write_block(uint16_t address, const uint8_t *data, size_t length);
+void memory_fill(uint16_t address, uint8_t value, size_t length);
+void memory_set_code_hook(MemoryCodeHook hook);
+void memory_watch_code_page(uint8_t page);
+void memory_set_cartridge_lines(int game, int exrom);
+void memory_get_dirty_pages(MemoryDirtySet set, uint64_t bitmap[MEMORY_DIRTY_PAGE_WORDS]);
+void memory_take_dirty_pages(MemoryDirtySet set, uint64_t bitmap[MEMORY_DIRTY_PAGE_WORDS]);
+int memory_take_dirty_range(MemoryDirtySet set, uint8_t first_page, uint8_t last_page);
+void memory_set_dirty_blocks(int enabled);
+void memory_take_dirty_blocks(MemoryDirtySet set, uint64_t bitmap[MEMORY_DIRTY_BLOCK_WORDS]);
+int memory_export(const char *name);
+void memory_unexport();
+void memory_save_state(uint8_t *buffer);
+void memory_restore_state(const uint8_t *buffer);
+void memory_save_pages(uint8_t *buffer, const uint64_t pages[MEMORY_DIRTY_PAGE_WORDS]);
+void memory_restore_pages(const uint8_t *buffer, const uint64_t pages[MEMORY_DIRTY_PAGE_WORDS]);
+void memory_dump(uint16_t start_address, size_t length);
+void memory_hex_dump(FILE *out, uint16_t start_address, size_t length);
+int memory_save_file(const char *filename, uint16_t start_address, size_t length);
+long memory_load_file(const char *filename, uint16_t address);
+int memory_load_prg(const char *filename, int address, MemoryPrgInfo *info);
+int memory_load_rom(const char *filename, const uint8_t **rom, size_t rom_size);
+int memory_load_basic_rom(const char *filename);
+int memory_load_kernal_rom(const char *filename);
 int memory_load_char_rom(const char *filename);
 
 /**
@@ -0,0 +1,128 @@
+/**
+ * memory_inline.h
+ * Inline memory accessors for the CPU engines
+ *
+ * memory_read() and memory_write() are out-of-line calls. The accessors
+ * here are compiled into the caller and handle the common cases on the
+ * spot: a page the current banking configuration maps straight to memory
+ * is read or written through its page pointer, and zero page and the
+ * stack, which are RAM in every configuration, are read from their RAM
+ * page directly. Anything else (I/O registers, the processor port, ROM
+ * writes, pages holding decoded code or with a dirty bit to set) goes to
+ * memory_read() or memory_write(), so the results are always the same as
+ * theirs.
+ */
+
+#ifndef MEMORY_INLINE_H
+#define MEMORY_INLINE_H
+
+#include "../machine/machine.h"
+
+/**
+ * Read a byte through the page table
+ * Only pages with no direct pointer (I/O) take the out-of-line path.
+ *
+ * @param address 16-bit memory address
+ * @return The byte memory_read() would return
+ */
+static inline uint8_t memory_read_fast_r(Machine *m, uint16_t address) {
+    const uint8_t *page = m->memory.config->read_map[address >> 8];
+
+    if (page) {
+        return page[address & 0xFF];
+    }
+    return memory_read_r(m, address);
+}
+
+/**
+ * Read a little-endian word, such as the operand of an instruction
+ * When both bytes are on one directly mapped page, the page is looked up
+ * once and both are read through the same pointer.
+ *
+ * @param address Address of the low byte (the high byte wraps at $FFFF)
+ * @return The word memory_read() would return
+ */
+static inline uint16_t memory_fetch16_r(Machine *m, uint16_t address) {
+    const uint8_t *page = m->memory.config->read_map[address >> 8];
+
+    if (page && (address & 0xFF) != 0xFF) {
+        return page[address & 0xFF] | (page[(address & 0xFF) + 1] << 8);
+    }
+    return memory_read_fast_r(m, address) | (memory_read_fast_r(m, (uint16_t)(address + 1)) << 8);
+}
+
+/**
+ * Write a byte through the page table
+ * Only pages with no direct pointer (I/O, ROM, the processor port page,
+ * pages holding decoded code, clean pages) take the out-of-line path.
+ *
+ * @param address 16-bit memory address
+ * @param value The byte value to write
+ */
+static inline void memory_write_fast_r(Machine *m, uint16_t address, uint8_t value) {
+    uint8_t *page = m->memory.config->write_map[address >> 8];
+
+    if (page) {
+        page[address & 0xFF] = value;
+        return;
+    }
+    memory_write_r(m, address, value);
+}
+
+/**
+ * Read a byte from zero page
+ * Zero page is RAM in every configuration; the processor port at $0001
+ * keeps its value in RAM as well.
+ *
+ * @param address Zero page address
+ * @return The byte at $00xx
+ */
+static inline uint8_t memory_read_zp_r(Machine *m, uint8_t address) {
+    return m->memory.ram_pages[0x00][address];
+}
+
+/**
+ * Write a byte to zero page
+ * $0000 and $0001 (the processor port) take the out-of-line path, and so
+ * does the rest of zero page while it has no direct write pointer.
+ *
+ * @param address Zero page address
+ * @param value The byte value to write
+ */
+static inline void memory_write_zp_r(Machine *m, uint8_t address, uint8_t value) {
+    if (address > 0x01 && m->memory.zero_page_direct) {
+        m->memory.ram_pages[0x00][address] = value;
+        return;
+    }
+    memory_write_r(m, address, value);
+}
+
+/**
+ * Read a byte from the stack page
+ *
+ * @param sp Stack pointer ($01xx offset)
+ * @return The byte at $0100 + sp
+ */
+static inline uint8_t memory_read_stack_r(Machine *m, uint8_t sp) {
+    return m->memory.ram_pages[0x01][sp];
+}
+
+/**
+ * Write a byte to the stack page
+ * A stack page with no direct pointer (decoded code on it, or clean)
+ * takes the out-of-line path.
+ *
+ * @param sp Stack pointer ($01xx offset)
+ * @param value The byte value to write
+ */
+static inline void memory_write_stack_r(Machine *m, uint8_t sp, uint8_t value) {
+    uint8_t *page = m->memory.config->write_map[0x01];
+
+    if (page) {
+        page[sp] = value;
+        return;
+    }
+    memory_write_r(m, 0x0100 | sp, value);
+}
+
+#endif /* MEMORY_INLINE_H */
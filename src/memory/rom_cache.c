@@ -0,0 +1,202 @@
+/**
+ * rom_cache.c
+ * Process-wide cache of read-only ROM images
+ *
+ * Entries form a list protected by one mutex. Several entries can share
+ * an image: a file whose contents match an image already cached gets an
+ * entry of its own (so the next load by file is a hit) that points at
+ * the existing image, and its own mapping is dropped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rom_cache.h"
+
+/**
+ * A cached image, with the file it came from if any
+ */
+typedef struct RomCacheEntry {
+    char *path;                   // NULL for images interned from a buffer
+    dev_t device;
+    ino_t inode;
+    off_t file_size;
+    struct timespec modified;
+    size_t size;
+    uint64_t hash;                // FNV-1a of the image
+    const uint8_t *data;
+    struct RomCacheEntry *next;
+} RomCacheEntry;
+
+static pthread_mutex_t rom_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static RomCacheEntry *rom_cache_entries;
+static int rom_cache_images;      // Distinct images
+static int rom_cache_reads;       // Files mapped or read
+static int rom_cache_hits;        // Loads served without reading the file
+
+/**
+ * FNV-1a hash of an image
+ */
+static uint64_t rom_cache_hash(const uint8_t *data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Find a cached image with the given contents (lock held)
+ */
+static const uint8_t *rom_cache_find(const uint8_t *data, size_t size, uint64_t hash) {
+    for (RomCacheEntry *entry = rom_cache_entries; entry; entry = entry->next) {
+        if (entry->size == size && entry->hash == hash && memcmp(entry->data, data, size) == 0) {
+            return entry->data;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Add an entry for an image (lock held)
+ */
+static RomCacheEntry *rom_cache_add(const uint8_t *data, size_t size, uint64_t hash) {
+    RomCacheEntry *entry = calloc(1, sizeof(RomCacheEntry));
+    if (!entry) {
+        return NULL;
+    }
+    entry->size = size;
+    entry->hash = hash;
+    entry->data = data;
+    entry->next = rom_cache_entries;
+    rom_cache_entries = entry;
+    return entry;
+}
+
+/**
+ * Map a ROM file, or read it into a zero-padded copy if it is short
+ */
+static uint8_t *rom_cache_map_file(int fd, off_t file_size, size_t size, int *mapped) {
+    uint8_t *data;
+
+    if (file_size >= (off_t)size) {
+        data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        *mapped = 1;
+        return data == MAP_FAILED ? NULL : data;
+    }
+
+    printf("Warning: ROM file size mismatch (%lld bytes, expected %zu)\n",
+           (long long)file_size, size);
+    data = calloc(1, size);
+    if (data && pread(fd, data, (size_t)file_size, 0) < 0) {
+        free(data);
+        data = NULL;
+    }
+    *mapped = 0;
+    return data;
+}
+
+/**
+ * Get the image of a ROM file
+ */
+const uint8_t *rom_cache_load(const char *filename, size_t size) {
+    struct stat st;
+    const uint8_t *image = NULL;
+
+    if (stat(filename, &st) != 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&rom_cache_lock);
+
+    // Same file, unchanged since it was cached: no file I/O at all
+    for (RomCacheEntry *entry = rom_cache_entries; entry; entry = entry->next) {
+        if (entry->path && entry->size == size && entry->device == st.st_dev &&
+            entry->inode == st.st_ino && entry->file_size == st.st_size &&
+            entry->modified.tv_sec == st.st_mtim.tv_sec &&
+            entry->modified.tv_nsec == st.st_mtim.tv_nsec) {
+            rom_cache_hits++;
+            pthread_mutex_unlock(&rom_cache_lock);
+            return entry->data;
+        }
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0) {
+        int mapped;
+        uint8_t *data = rom_cache_map_file(fd, st.st_size, size, &mapped);
+        close(fd);
+
+        if (data) {
+            rom_cache_reads++;
+            uint64_t hash = rom_cache_hash(data, size);
+
+            // Same contents as another image: keep that one
+            image = rom_cache_find(data, size, hash);
+            if (image) {
+                if (mapped) {
+                    munmap(data, size);
+                } else {
+                    free(data);
+                }
+            } else {
+                image = data;
+                rom_cache_images++;
+            }
+
+            RomCacheEntry *entry = rom_cache_add(image, size, hash);
+            if (entry) {
+                entry->path = strdup(filename);
+                entry->device = st.st_dev;
+                entry->inode = st.st_ino;
+                entry->file_size = st.st_size;
+                entry->modified = st.st_mtim;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&rom_cache_lock);
+    return image;
+}
+
+/**
+ * Get the cached image with the same contents as a buffer
+ */
+const uint8_t *rom_cache_intern(const uint8_t *data, size_t size) {
+    uint64_t hash = rom_cache_hash(data, size);
+
+    pthread_mutex_lock(&rom_cache_lock);
+
+    const uint8_t *image = rom_cache_find(data, size, hash);
+    if (!image) {
+        uint8_t *copy = malloc(size);
+        if (copy) {
+            memcpy(copy, data, size);
+            if (rom_cache_add(copy, size, hash)) {
+                image = copy;
+                rom_cache_images++;
+            } else {
+                free(copy);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&rom_cache_lock);
+    return image;
+}
+
+/**
+ * Print the number of images, files read and cache hits
+ */
+void rom_cache_print_stats() {
+    pthread_mutex_lock(&rom_cache_lock);
+    printf("ROM cache: %d images, %d files read, %d loads served from the cache\n",
+           rom_cache_images, rom_cache_reads, rom_cache_hits);
+    pthread_mutex_unlock(&rom_cache_lock);
+}
@@ -0,0 +1,48 @@
+/**
+ * rom_cache.h
+ * Process-wide cache of read-only ROM images
+ *
+ * Every machine in a process reads its BASIC, KERNAL and character ROMs
+ * from images held here instead of carrying its own copies. A ROM file is
+ * mapped read-only (MAP_SHARED), so the page cache also shares it with
+ * other emulator processes using the same file. Images are looked up by
+ * file (device, inode, size and modification time) and by content hash,
+ * so loading a file that is already cached reads nothing, and two files
+ * or buffers with the same contents share one image.
+ *
+ * Images are never freed; the functions are thread safe.
+ */
+
+#ifndef ROM_CACHE_H
+#define ROM_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Get the image of a ROM file
+ * A file shorter than size is read into a zero-padded copy instead of
+ * being mapped; a longer one is mapped up to size.
+ *
+ * @param filename Path to the ROM file
+ * @param size Size of the ROM in bytes
+ * @return size read-only bytes, or NULL if the file can't be opened
+ */
+const uint8_t *rom_cache_load(const char *filename, size_t size);
+
+/**
+ * Get the cached image with the same contents as a buffer
+ * The buffer is copied into the cache if no image matches it.
+ *
+ * @param data ROM contents
+ * @param size Size of the ROM in bytes
+ * @return size read-only bytes, or NULL if out of memory
+ */
+const uint8_t *rom_cache_intern(const uint8_t *data, size_t size);
+
+/**
+ * Print the number of images, files read and cache hits
+ */
+void rom_cache_print_stats();
+
+#endif /* ROM_CACHE_H */
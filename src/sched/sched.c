@@ -0,0 +1,217 @@
+/**
+ * sched.c
+ * Cycle-based event scheduler implementation for the Commodore 64 emulator
+ *
+ * Scheduled events are kept in a binary min-heap ordered by cycle (ties go
+ * to the event registered first), so finding the next event is a single
+ * read and scheduling or cancelling one is O(log n).
+ */
+
+#include <stdio.h>
+#include "sched.h"
+#include "../machine/machine.h"
+
+/**
+ * Check whether event a fires before event b
+ */
+static int sched_before(const SchedState *s, int a, int b) {
+    if (s->events[a].cycle != s->events[b].cycle) {
+        return s->events[a].cycle < s->events[b].cycle;
+    }
+    return a < b;
+}
+
+/**
+ * Put an event into a heap slot and record where it is
+ */
+static void sched_place(SchedState *s, int index, int id) {
+    s->heap[index] = id;
+    s->events[id].heap_index = index;
+}
+
+/**
+ * Move the event at a heap slot towards the root until the heap is ordered
+ */
+static void sched_sift_up(SchedState *s, int index) {
+    int id = s->heap[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!sched_before(s, id, s->heap[parent])) {
+            break;
+        }
+        sched_place(s, index, s->heap[parent]);
+        index = parent;
+    }
+    sched_place(s, index, id);
+}
+
+/**
+ * Move the event at a heap slot towards the leaves until the heap is ordered
+ */
+static void sched_sift_down(SchedState *s, int index) {
+    int id = s->heap[index];
+    for (;;) {
+        int child = index * 2 + 1;
+        if (child >= s->heap_size) {
+            break;
+        }
+        if (child + 1 < s->heap_size && sched_before(s, s->heap[child + 1], s->heap[child])) {
+            child++;
+        }
+        if (!sched_before(s, s->heap[child], id)) {
+            break;
+        }
+        sched_place(s, index, s->heap[child]);
+        index = child;
+    }
+    sched_place(s, index, id);
+}
+
+/**
+ * Take an event out of the heap
+ */
+static void sched_remove(SchedState *s, int id) {
+    int index = s->events[id].heap_index;
+    s->events[id].heap_index = -1;
+    s->heap_size--;
+    if (index == s->heap_size) {
+        return;
+    }
+
+    // Fill the hole with the last event and restore the order around it
+    sched_place(s, index, s->heap[s->heap_size]);
+    sched_sift_up(s, index);
+    sched_sift_down(s, s->events[s->heap[index]].heap_index);
+}
+
+/**
+ * Register an event source
+ */
+int sched_register(Machine *m, const char *name, SchedCallback callback, int arg) {
+    SchedState *s = &m->sched;
+
+    // Already registered by an earlier init
+    for (int i = 0; i < s->event_count; i++) {
+        if (s->events[i].callback == callback && s->events[i].arg == arg) {
+            return i;
+        }
+    }
+    if (s->event_count >= SCHED_MAX_EVENTS) {
+        printf("Error: Too many scheduler events (registering %s)\n", name);
+        return -1;
+    }
+
+    SchedEvent *event = &s->events[s->event_count];
+    event->name = name;
+    event->callback = callback;
+    event->arg = arg;
+    event->cycle = SCHED_NEVER;
+    event->heap_index = -1;
+    event->fired = 0;
+    return s->event_count++;
+}
+
+/**
+ * Schedule an event, replacing any earlier schedule for it
+ */
+void sched_schedule(Machine *m, int id, uint64_t cycle) {
+    SchedState *s = &m->sched;
+
+    if (id < 0 || id >= s->event_count) {
+        return;
+    }
+
+    uint64_t old_next = sched_next(m);
+    s->events[id].cycle = cycle;
+    if (s->events[id].heap_index < 0) {
+        sched_place(s, s->heap_size++, id);
+    }
+    sched_sift_up(s, s->events[id].heap_index);
+    sched_sift_down(s, s->events[id].heap_index);
+
+    if (cycle < old_next && s->change_hook) {
+        s->change_hook(m, cycle);
+    }
+}
+
+/**
+ * Remove an event from the schedule
+ */
+void sched_cancel(Machine *m, int id) {
+    SchedState *s = &m->sched;
+
+    if (id >= 0 && id < s->event_count && s->events[id].heap_index >= 0) {
+        sched_remove(s, id);
+    }
+}
+
+/**
+ * Remove every event from the schedule
+ */
+void sched_cancel_all(Machine *m) {
+    SchedState *s = &m->sched;
+
+    for (int i = 0; i < s->heap_size; i++) {
+        s->events[s->heap[i]].heap_index = -1;
+    }
+    s->heap_size = 0;
+}
+
+/**
+ * Get the cycle an event is scheduled for
+ */
+uint64_t sched_event_cycle(Machine *m, int id) {
+    SchedState *s = &m->sched;
+
+    if (id < 0 || id >= s->event_count || s->events[id].heap_index < 0) {
+        return SCHED_NEVER;
+    }
+    return s->events[id].cycle;
+}
+
+/**
+ * Get the cycle of the earliest scheduled event
+ */
+uint64_t sched_next(Machine *m) {
+    const SchedState *s = &m->sched;
+    return s->heap_size > 0 ? s->events[s->heap[0]].cycle : SCHED_NEVER;
+}
+
+/**
+ * Fire every event scheduled at or before a cycle
+ */
+void sched_run_due(Machine *m, uint64_t now) {
+    SchedState *s = &m->sched;
+
+    while (s->heap_size > 0 && s->events[s->heap[0]].cycle <= now) {
+        SchedEvent *event = &s->events[s->heap[0]];
+        sched_remove(s, s->heap[0]);
+        event->fired++;
+        event->callback(m, event->arg, event->cycle);
+    }
+}
+
+/**
+ * Install the hook called when the next event moves earlier
+ */
+void sched_set_change_hook(Machine *m, SchedChangeHook hook) {
+    m->sched.change_hook = hook;
+}
+
+/**
+ * Print the scheduled events and how often each one fired
+ */
+void sched_print_events(Machine *m) {
+    const SchedState *s = &m->sched;
+
+    printf("Scheduler events:\n");
+    for (int i = 0; i < s->event_count; i++) {
+        if (s->events[i].heap_index >= 0) {
+            printf("  %-16s at cycle %-14llu fired %llu times\n", s->events[i].name,
+                   (unsigned long long)s->events[i].cycle, (unsigned long long)s->events[i].fired);
+        } else {
+            printf("  %-16s %-23s fired %llu times\n", s->events[i].name, "not scheduled",
+                   (unsigned long long)s->events[i].fired);
+        }
+    }
+}
@@ -0,0 +1,129 @@
+/**
+ * sched.h
+ * Cycle-based event scheduler for the Commodore 64 emulator
+ *
+ * Devices register an event once and then schedule it for an absolute CPU
+ * cycle. The CPU run loop only compares the cycle counter with
+ * sched_next(); when it is reached, sched_run_due() calls the callbacks
+ * of every event that has come due, in cycle order.
+ *
+ * Every machine has its own schedule (SchedState in the Machine). Events
+ * name their callback and an integer argument rather than a pointer, so
+ * nothing in the schedule points into a particular machine.
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+#define SCHED_MAX_EVENTS 16
+#define SCHED_NEVER      UINT64_MAX  // sched_next() when nothing is scheduled
+
+// Emulator instance (see src/machine/machine.h)
+typedef struct Machine Machine;
+
+/**
+ * Event callback
+ * @param m Machine the event belongs to
+ * @param arg Argument given to sched_register()
+ * @param cycle Cycle the event was scheduled for (the CPU may be a few
+ *              cycles past it, since events fire between instructions)
+ */
+typedef void (*SchedCallback)(Machine *m, int arg, uint64_t cycle);
+
+/**
+ * Called when the next event moves earlier, so a running CPU can stop sooner
+ * @param m Machine whose schedule changed
+ * @param next_cycle New value of sched_next()
+ */
+typedef void (*SchedChangeHook)(Machine *m, uint64_t next_cycle);
+
+/**
+ * A registered event source
+ */
+typedef struct {
+    const char *name;
+    SchedCallback callback;
+    int arg;
+    uint64_t cycle;   // When it fires (valid while scheduled)
+    int heap_index;   // Position in the heap, or -1 when not scheduled
+    uint64_t fired;   // Times the callback ran
+} SchedEvent;
+
+/**
+ * Schedule of one machine
+ */
+typedef struct {
+    SchedEvent events[SCHED_MAX_EVENTS];
+    int event_count;
+    int heap[SCHED_MAX_EVENTS];   // Ids of the scheduled events, earliest first at index 0
+    int heap_size;
+    SchedChangeHook change_hook;
+} SchedState;
+
+/**
+ * Register an event source
+ * The event starts unscheduled. Registrations live as long as the machine;
+ * registering the same callback and argument again returns the existing
+ * id, so init functions can simply register every time they run.
+ *
+ * @param name Name shown by sched_print_events()
+ * @param callback Called when the event comes due
+ * @param arg Passed to the callback
+ * @return Event id, or -1 if the table is full
+ */
+int sched_register(Machine *m, const char *name, SchedCallback callback, int arg);
+
+/**
+ * Schedule an event, replacing any earlier schedule for it
+ * A cycle that has already passed fires at the next instruction boundary.
+ * @param id Event id from sched_register()
+ * @param cycle Absolute cycle to fire at
+ */
+void sched_schedule(Machine *m, int id, uint64_t cycle);
+
+/**
+ * Remove an event from the schedule
+ * @param id Event id from sched_register()
+ */
+void sched_cancel(Machine *m, int id);
+
+/**
+ * Remove every event from the schedule
+ */
+void sched_cancel_all(Machine *m);
+
+/**
+ * Get the cycle an event is scheduled for
+ * @param id Event id from sched_register()
+ * @return The cycle, or SCHED_NEVER if the event isn't scheduled
+ */
+uint64_t sched_event_cycle(Machine *m, int id);
+
+/**
+ * Get the cycle of the earliest scheduled event
+ * @return The cycle, or SCHED_NEVER if nothing is scheduled
+ */
+uint64_t sched_next(Machine *m);
+
+/**
+ * Fire every event scheduled at or before a cycle
+ * Each event is removed before its callback runs, so the callback may
+ * schedule it again. It must schedule it after now, or it fires again.
+ * @param now Current cycle
+ */
+void sched_run_due(Machine *m, uint64_t now);
+
+/**
+ * Install the hook called when the next event moves earlier
+ * @param hook Function to call, or NULL
+ */
+void sched_set_change_hook(Machine *m, SchedChangeHook hook);
+
+/**
+ * Print the scheduled events and how often each one fired
+ */
+void sched_print_events(Machine *m);
+
+#endif /* SCHED_H */
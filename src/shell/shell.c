@@ -8,21 +8,18 @@
 #include <string.h>
 #include <ctype.h>
 #include "shell.h"
-#include "../cpu/cpu.h"
-#include "../memory/memory.h"
-#include "../io/io.h"
-
-// Shell state
-static int running = 0;
-static int in_basic_mode = 0;
-static char input_buffer[256];
+#include "../machine/machine.h"
+#include "../machine/snapshot.h"
+#include "../machine/rewind.h"
+#include "../memory/rom_cache.h"
+#include "../bench/bench.h"
 
 /**
  * Initialize the shell
  */
-void shell_init() {
-    running = 1;
-    in_basic_mode = 0;
+void shell_init_r(Machine *m) {
+    m->shell.running = 1;
+    m->shell.in_basic_mode = 0;
     
     printf("Commodore 64 Emulator Shell\n");
     printf("Type 'help' for a list of commands\n");
@@ -31,18 +28,18 @@ void shell_init() {
 /**
  * Run the shell main loop
  */
-void shell_run() {
-    while (running) {
-        shell_prompt();
-        shell_handle_input();
+void shell_run_r(Machine *m) {
+    while (m->shell.running) {
+        shell_prompt_r(m);
+        shell_handle_input_r(m);
     }
 }
 
 /**
  * Display the shell prompt
  */
-void shell_prompt() {
-    if (in_basic_mode) {
+void shell_prompt_r(Machine *m) {
+    if (m->shell.in_basic_mode) {
         printf("READY.\n");
     }
     printf("> ");
@@ -52,30 +49,30 @@ void shell_prompt() {
 /**
  * Handle user input from the shell
  */
-void shell_handle_input() {
-    if (fgets(input_buffer, sizeof(input_buffer), stdin) == NULL) {
+void shell_handle_input_r(Machine *m) {
+    if (fgets(m->shell.input_buffer, sizeof(m->shell.input_buffer), stdin) == NULL) {
         // Handle EOF
-        running = 0;
+        m->shell.running = 0;
         return;
     }
     
     // Remove trailing newline
-    size_t len = strlen(input_buffer);
-    if (len > 0 && input_buffer[len - 1] == '\n') {
-        input_buffer[len - 1] = '\0';
+    size_t len = strlen(m->shell.input_buffer);
+    if (len > 0 && m->shell.input_buffer[len - 1] == '\n') {
+        m->shell.input_buffer[len - 1] = '\0';
     }
     
     // Skip empty lines
-    if (strlen(input_buffer) == 0) {
+    if (strlen(m->shell.input_buffer) == 0) {
         return;
     }
     
     // Process the input
-    if (in_basic_mode) {
-        shell_process_basic_line(input_buffer);
+    if (m->shell.in_basic_mode) {
+        shell_process_basic_line_r(m, m->shell.input_buffer);
     } else {
         // Split into command and arguments
-        char* args = input_buffer;
+        char* args = m->shell.input_buffer;
         while (*args && !isspace(*args)) {
             args++;
         }
@@ -89,8 +86,8 @@ void shell_handle_input() {
         }
         
         // Parse and execute the command
-        ShellCommand cmd = shell_parse_command(input_buffer);
-        shell_execute_command(cmd, args);
+        ShellCommand cmd = shell_parse_command(m->shell.input_buffer);
+        shell_execute_command_r(m, cmd, args);
     }
 }
 
@@ -111,6 +108,14 @@ ShellCommand shell_parse_command(const char* input) {
     if (strcmp(input, "poke") == 0) return CMD_POKE;
     if (strcmp(input, "peek") == 0) return CMD_PEEK;
     if (strcmp(input, "sys") == 0) return CMD_SYS;
+    if (strcmp(input, "break") == 0) return CMD_BREAK;
+    if (strcmp(input, "bench") == 0) return CMD_BENCH;
+    if (strcmp(input, "jit") == 0) return CMD_JIT;
+    if (strcmp(input, "stats") == 0) return CMD_STATS;
+    if (strcmp(input, "save") == 0) return CMD_SAVE;
+    if (strcmp(input, "bload") == 0) return CMD_BLOAD;
+    if (strcmp(input, "snapshot") == 0) return CMD_SNAPSHOT;
+    if (strcmp(input, "rewind") == 0) return CMD_REWIND;
     
     return CMD_UNKNOWN;
 }
@@ -118,7 +123,7 @@ ShellCommand shell_parse_command(const char* input) {
 /**
  * Execute a shell command
  */
-void shell_execute_command(ShellCommand cmd, const char* args) {
+void shell_execute_command_r(Machine *m, ShellCommand cmd, const char* args) {
     switch (cmd) {
         case CMD_HELP:
             shell_print_help();
@@ -126,25 +131,30 @@ void shell_execute_command(ShellCommand cmd, const char* args) {
             
         case CMD_RUN:
             printf("Running program...\n");
-            cpu_execute(1000000);  // Run for a large number of cycles
+            shell_run_cpu_r(m, 1000000);  // Run for a large number of cycles
             break;
             
         case CMD_LOAD:
             if (!args || !*args) {
                 printf("Usage: load <filename> [address]\n");
-                printf("If address is not specified, the default is $0800\n");
+                printf("The file is a PRG; address overrides the load address in its first two bytes\n");
             } else {
                 char filename[256];
-                uint16_t address = 0x0800;  // Default load address
+                unsigned int address;
+                int load_address = -1;  // From the PRG header
                 
                 // Parse the arguments
-                if (sscanf(args, "%255s %hx", filename, &address) < 1) {
+                int count = sscanf(args, "%255s %x", filename, &address);
+                if (count < 1 || (count == 2 && address > 0xFFFF)) {
                     printf("Error: Invalid arguments\n");
                     break;
                 }
+                if (count == 2) {
+                    load_address = address;
+                }
                 
-                printf("Loading program from '%s' to address $%04X...\n", filename, address);
-                if (shell_load_file(filename, address)) {
+                printf("Loading program from '%s'...\n", filename);
+                if (shell_load_file_r(m, filename, load_address)) {
                     printf("Program loaded successfully\n");
                 } else {
                     printf("Failed to load program\n");
@@ -161,18 +171,18 @@ void shell_execute_command(ShellCommand cmd, const char* args) {
         case CMD_DUMP:
             {
                 uint16_t start = 0;
-                uint16_t length = 256;
+                unsigned int length = 256;
                 if (args && *args) {
-                    sscanf(args, "%hx %hx", &start, &length);
+                    sscanf(args, "%hx %x", &start, &length);
                 }
-                memory_dump(start, length);
+                memory_dump_r(m, start, length);
             }
             break;
             
         case CMD_RESET:
             printf("Resetting system...\n");
-            cpu_reset();
-            io_init();
+            cpu_reset_r(m);
+            io_init_r(m);
             break;
             
         case CMD_STEP:
@@ -183,9 +193,9 @@ void shell_execute_command(ShellCommand cmd, const char* args) {
                 }
                 printf("Stepping %d instruction(s)...\n", count);
                 for (int i = 0; i < count; i++) {
-                    cpu_step();
+                    cpu_step_r(m);
                 }
-                cpu_print_state();
+                cpu_print_state_r(m);
             }
             break;
             
@@ -203,12 +213,12 @@ void shell_execute_command(ShellCommand cmd, const char* args) {
             
         case CMD_QUIT:
             printf("Exiting emulator...\n");
-            running = 0;
+            m->shell.running = 0;
             break;
             
         case CMD_BASIC:
             printf("Entering BASIC mode\n");
-            shell_enter_basic_mode();
+            shell_enter_basic_mode_r(m);
             break;
             
         case CMD_POKE:
@@ -216,7 +226,7 @@ void shell_execute_command(ShellCommand cmd, const char* args) {
                 uint16_t address;
                 uint8_t value;
                 if (args && *args && sscanf(args, "%hu,%hhu", &address, &value) == 2) {
-                    memory_write(address, value);
+                    memory_write_r(m, address, value);
                     printf("Poked %d into address %d\n", value, address);
                 } else {
                     printf("Usage: poke <address>,<value>\n");
@@ -228,7 +238,7 @@ void shell_execute_command(ShellCommand cmd, const char* args) {
             {
                 uint16_t address;
                 if (args && *args && sscanf(args, "%hu", &address) == 1) {
-                    uint8_t value = memory_read(address);
+                    uint8_t value = memory_read_r(m, address);
                     printf("Peek(%d) = %d ($%02X)\n", address, value, value);
                 } else {
                     printf("Usage: peek <address>\n");
@@ -242,19 +252,141 @@ void shell_execute_command(ShellCommand cmd, const char* args) {
                 if (args && *args && sscanf(args, "%hx", &address) == 1) {
                     printf("Calling system routine at $%04X...\n", address);
                     // Set the PC to the specified address using the API
-                    cpu_set_pc(address);
+                    cpu_set_pc_r(m, address);
                     // Execute a number of instructions
-                    cpu_execute(1000000);  // Run for many cycles
-                    cpu_print_state();
+                    shell_run_cpu_r(m, 1000000);  // Run for many cycles
+                    cpu_print_state_r(m);
                 } else {
                     printf("Usage: sys <address>\n");
                 }
             }
             break;
             
+        case CMD_BREAK:
+            {
+                uint16_t address;
+                if (args && strcmp(args, "clear") == 0) {
+                    cpu_clear_breakpoints_r(m);
+                    printf("All breakpoints cleared\n");
+                } else if (args && *args && sscanf(args, "%hx", &address) == 1) {
+                    cpu_set_breakpoint_r(m, address);
+                    printf("Breakpoint set at $%04X\n", address);
+                } else {
+                    printf("Usage: break <address> | break clear\n");
+                }
+            }
+            break;
+            
+        case CMD_BENCH:
+            if (args && strcmp(args, "list") == 0) {
+                bench_list();
+            } else if (!bench_run(args)) {
+                printf("Unknown benchmark: %s\n", args);
+                bench_list();
+            }
+            break;
+            
+        case CMD_JIT:
+            if (!args || !*args || strcmp(args, "stats") == 0) {
+                cpu_jit_print_stats_r(m);
+            } else if (strcmp(args, "on") == 0) {
+                if (cpu_jit_set_mode_r(m, CPU_JIT_ON)) printf("JIT enabled\n");
+            } else if (strcmp(args, "check") == 0) {
+                if (cpu_jit_set_mode_r(m, CPU_JIT_CHECK)) printf("JIT enabled in lockstep check mode\n");
+            } else if (strcmp(args, "off") == 0) {
+                cpu_jit_set_mode_r(m, CPU_JIT_OFF);
+                printf("JIT disabled\n");
+            } else {
+                printf("Usage: jit [on|off|check|stats]\n");
+            }
+            break;
+            
+        case CMD_STATS:
+            cpu_print_stats_r(m);
+            sched_print_events(m);
+            rom_cache_print_stats();
+            break;
+            
+        case CMD_SAVE:
+            {
+                char filename[256];
+                uint16_t start, end;
+                if (args && *args && sscanf(args, "%255s %hx %hx", filename, &start, &end) == 3 && end >= start) {
+                    if (memory_save_file_r(m, filename, start, end - start + 1)) {
+                        printf("Saved $%04X-$%04X (%d bytes) to '%s'\n", start, end, end - start + 1, filename);
+                    }
+                } else {
+                    printf("Usage: save <file> <start> <end>\n");
+                }
+            }
+            break;
+            
+        case CMD_BLOAD:
+            {
+                char filename[256];
+                uint16_t address;
+                if (args && *args && sscanf(args, "%255s %hx", filename, &address) == 2) {
+                    long length = memory_load_file_r(m, filename, address);
+                    if (length > 0) {
+                        printf("Loaded %ld bytes from '%s' to $%04X-$%04lX\n",
+                               length, filename, address, address + length - 1);
+                    } else if (length == 0) {
+                        printf("'%s' is empty\n", filename);
+                    }
+                } else {
+                    printf("Usage: bload <file> <address>\n");
+                }
+            }
+            break;
+            
+        case CMD_SNAPSHOT:
+            {
+                char action[8];
+                char filename[256];
+                if (args && sscanf(args, "%7s %255s", action, filename) == 2 && strcmp(action, "save") == 0) {
+                    if (snapshot_save_file_r(m, filename)) {
+                        printf("Machine state saved to '%s'\n", filename);
+                    }
+                } else if (args && sscanf(args, "%7s %255s", action, filename) == 2 && strcmp(action, "load") == 0) {
+                    if (snapshot_load_file_r(m, filename)) {
+                        printf("Machine state restored from '%s'\n", filename);
+                        cpu_print_state_r(m);
+                    }
+                } else {
+                    printf("Usage: snapshot save <file> | snapshot load <file>\n");
+                }
+            }
+            break;
+            
+        case CMD_REWIND:
+            {
+                unsigned long long cycles;
+                unsigned megabytes = REWIND_DEFAULT_BUDGET >> 20;
+                if (!args || !*args || strcmp(args, "stats") == 0) {
+                    rewind_print_stats_r(m);
+                } else if (strncmp(args, "on", 2) == 0 && (args[2] == '\0' || args[2] == ' ')) {
+                    if (args[2] && sscanf(args + 2, "%u", &megabytes) != 1) {
+                        printf("Usage: rewind on [MB]\n");
+                    } else if (rewind_start_r(m, (size_t)megabytes << 20)) {
+                        printf("Rewind recording on (%u MB of history)\n", megabytes);
+                    }
+                } else if (strcmp(args, "off") == 0) {
+                    rewind_stop_r(m);
+                    printf("Rewind recording off\n");
+                } else if (sscanf(args, "%llu", &cycles) == 1) {
+                    uint64_t target = cycles < m->cycles ? m->cycles - cycles : 0;
+                    if (rewind_to_r(m, target)) {
+                        cpu_print_state_r(m);
+                    }
+                } else {
+                    printf("Usage: rewind on [MB] | rewind off | rewind <cycles> | rewind stats\n");
+                }
+            }
+            break;
+            
         case CMD_UNKNOWN:
         default:
-            printf("Unknown command: %s\n", input_buffer);
+            printf("Unknown command: %s\n", m->shell.input_buffer);
             printf("Type 'help' for a list of commands\n");
             break;
     }
@@ -267,9 +399,13 @@ void shell_print_help() {
     printf("Available commands:\n");
     printf("  help        - Show this help message\n");
     printf("  run         - Run the current program\n");
-    printf("  load <file> - Load a program from a file\n");
+    printf("  load <file> [addr] - Load a PRG file (at addr, hex, instead of its own)\n");
     printf("  list        - List the current BASIC program\n");
     printf("  dump [addr] [len] - Dump memory contents\n");
+    printf("  save f s e  - Save memory from s to e (hex) to a binary file\n");
+    printf("  bload f a   - Load a binary file into memory at a (hex)\n");
+    printf("  snapshot save|load f - Save or restore the whole machine state\n");
+    printf("  rewind [n]  - Go back n cycles ('rewind on [MB]'/'off' records, no n shows stats)\n");
     printf("  reset       - Reset the system\n");
     printf("  step [n]    - Execute n instructions (default: 1)\n");
     printf("  trace [0|1] - Enable/disable instruction tracing\n");
@@ -277,41 +413,54 @@ void shell_print_help() {
     printf("  poke a,v    - Write a value to memory address\n");
     printf("  peek a      - Read a value from memory address\n");
     printf("  sys addr    - Call a machine language routine\n");
+    printf("  break addr  - Stop run/sys at an address ('break clear' removes all)\n");
+    printf("  bench [name]- Run built-in benchmarks ('bench list' shows them)\n");
+    printf("  jit [mode]  - JIT on/off/check (lockstep with interpreter), or stats\n");
+    printf("  stats       - Show cycle count and superinstruction counters\n");
     printf("  quit        - Exit the emulator\n");
 }
 
+/**
+ * Run the CPU for a cycle budget and report why it stopped
+ */
+void shell_run_cpu_r(Machine *m, uint32_t budget) {
+    if (cpu_run_r(m, budget) == CPU_EXIT_BREAKPOINT) {
+        printf("\nBreakpoint reached at $%04X\n", cpu_get_pc_r(m));
+    }
+}
+
 /**
  * Enter BASIC mode
  */
-void shell_enter_basic_mode() {
-    in_basic_mode = 1;
-    io_clear_screen();
-    io_print_text(0, 0, "    **** COMMODORE 64 BASIC V2 ****");
-    io_print_text(0, 2, " 64K RAM SYSTEM  38911 BASIC BYTES FREE");
-    io_update_display();
+void shell_enter_basic_mode_r(Machine *m) {
+    m->shell.in_basic_mode = 1;
+    io_clear_screen_r(m);
+    io_print_text_r(m, 0, 0, "    **** COMMODORE 64 BASIC V2 ****");
+    io_print_text_r(m, 0, 2, " 64K RAM SYSTEM  38911 BASIC BYTES FREE");
+    io_update_display_r(m);
 }
 
 /**
  * Exit BASIC mode
  */
-void shell_exit_basic_mode() {
-    in_basic_mode = 0;
+void shell_exit_basic_mode_r(Machine *m) {
+    m->shell.in_basic_mode = 0;
 }
 
 /**
  * Check if in BASIC mode
  */
-int shell_is_in_basic_mode() {
-    return in_basic_mode;
+int shell_is_in_basic_mode_r(Machine *m) {
+    return m->shell.in_basic_mode;
 }
 
 /**
  * Process a line of BASIC input
  */
-void shell_process_basic_line(const char* line) {
+void shell_process_basic_line_r(Machine *m, const char* line) {
     // Exit BASIC mode if the user types "exit" or "quit"
     if (strcmp(line, "exit") == 0 || strcmp(line, "quit") == 0) {
-        shell_exit_basic_mode();
+        shell_exit_basic_mode_r(m);
         return;
     }
     
@@ -326,50 +475,77 @@ void shell_process_basic_line(const char* line) {
         printf("%s\n", text);
     } else if (strncmp(line, "CLS", 3) == 0 || strncmp(line, "cls", 3) == 0) {
         // Clear the screen
-        io_clear_screen();
-        io_update_display();
+        io_clear_screen_r(m);
+        io_update_display_r(m);
     } else if (strlen(line) > 0) {
         printf("?SYNTAX ERROR\n");
     }
 }
 
 /**
- * Load a binary program file into memory
+ * Load a PRG file into memory and set the end pointers
  */
-int shell_load_file(const char* filename, uint16_t load_address) {
-    FILE* file = fopen(filename, "rb");
-    if (file == NULL) {
-        printf("Error: Could not open file %s\n", filename);
-        return 0;
-    }
-    
-    // Get the file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+int shell_load_file_r(Machine *m, const char* filename, int load_address) {
+    MemoryPrgInfo info;
     
-    // Allocate buffer for the file data
-    uint8_t* buffer = (uint8_t*)malloc(file_size);
-    if (buffer == NULL) {
-        printf("Error: Could not allocate memory for file data\n");
-        fclose(file);
+    if (!memory_load_prg_r(m, filename, load_address, &info)) {
         return 0;
     }
     
-    // Read the file data
-    size_t read_size = fread(buffer, 1, file_size, file);
-    fclose(file);
+    // Leave the end pointers where LOAD would: $AE/$AF and BASIC's $2D/$2E
+    memory_write_r(m, 0xAE, info.end & 0xFF);
+    memory_write_r(m, 0xAF, info.end >> 8);
+    memory_write_r(m, 0x2D, info.end & 0xFF);
+    memory_write_r(m, 0x2E, info.end >> 8);
     
-    if (read_size != file_size) {
-        printf("Error: Could not read all data from file\n");
-        free(buffer);
-        return 0;
-    }
-    
-    // Load the data into memory
-    memory_load(load_address, buffer, file_size);
-    free(buffer);
-    
-    printf("Loaded %ld bytes from '%s' into memory at $%04X\n", file_size, filename, load_address);
+    printf("Loaded %zu bytes from '%s' into memory at $%04X\n", info.length, filename, info.start);
     return 1;
-}
\ No newline at end of file
+}
+
+/* ------------------------------------------------------------------ */
+/* Single-machine API                                                 */
+/* ------------------------------------------------------------------ */
+
+void shell_init() {
+    shell_init_r(machine_default());
+}
+
+void shell_run() {
+    shell_run_r(machine_default());
+}
+
+void shell_execute_command(ShellCommand cmd, const char* args) {
+    shell_execute_command_r(machine_default(), cmd, args);
+}
+
+void shell_handle_input() {
+    shell_handle_input_r(machine_default());
+}
+
+void shell_prompt() {
+    shell_prompt_r(machine_default());
+}
+
+void shell_run_cpu(uint32_t budget) {
+    shell_run_cpu_r(machine_default(), budget);
+}
+
+int shell_load_file(const char* filename, int load_address) {
+    return shell_load_file_r(machine_default(), filename, load_address);
+}
+
+void shell_enter_basic_mode() {
+    shell_enter_basic_mode_r(machine_default());
+}
+
+void shell_exit_basic_mode() {
+    shell_exit_basic_mode_r(machine_default());
+}
+
+int shell_is_in_basic_mode() {
+    return shell_is_in_basic_mode_r(machine_default());
+}
+
+void shell_process_basic_line(const char* line) {
+    shell_process_basic_line_r(machine_default(), line);
+}
@@ -23,22 +23,59 @@ typedef enum {
     CMD_POKE,
     CMD_PEEK,
     CMD_SYS,
+    CMD_BREAK,
+    CMD_BENCH,
+    CMD_JIT,
+    CMD_STATS,
+    CMD_SAVE,
+    CMD_BLOAD,
+    CMD_SNAPSHOT,
+    CMD_REWIND,
     CMD_UNKNOWN
 } ShellCommand;
 
+// Emulator instance (see src/machine/machine.h)
+typedef struct Machine Machine;
+
+// Shell state, kept in the Machine
+typedef struct {
+    int running;
+    int in_basic_mode;
+    char input_buffer[256];
+} ShellState;
+
 // Shell functions
-void shell_init();
-void shell_run();
+void shell_init_r(Machine *m);
+void shell_run_r(Machine *m);
 ShellCommand shell_parse_command(const char* input);
-void shell_execute_command(ShellCommand cmd, const char* args);
+void shell_execute_command_r(Machine *m, ShellCommand cmd, const char* args);
 void shell_print_help();
-void shell_handle_input();
-void shell_prompt();
+void shell_handle_input_r(Machine *m);
+void shell_prompt_r(Machine *m);
+
+// Program execution
+void shell_run_cpu_r(Machine *m, uint32_t budget);
 
 // File operations
-int shell_load_file(const char* filename, uint16_t load_address);
+int shell_load_file_r(Machine *m, const char* filename, int load_address);
 
 // BASIC mode
+void shell_enter_basic_mode_r(Machine *m);
+void shell_exit_basic_mode_r(Machine *m);
+int shell_is_in_basic_mode_r(Machine *m);
+void shell_process_basic_line_r(Machine *m, const char* line);
+
+/*
+ * Single-machine API
+ * Each function below calls its _r variant with machine_default().
+ */
+void shell_init();
+void shell_run();
+void shell_execute_command(ShellCommand cmd, const char* args);
+void shell_handle_input();
+void shell_prompt();
+void shell_run_cpu(uint32_t budget);
+int shell_load_file(const char* filename, int load_address);
 void shell_enter_basic_mode();
 void shell_exit_basic_mode();
 int shell_is_in_basic_mode();